@@ -0,0 +1,675 @@
+// Measures the throughput of each phase of making a chart (parse, layout,
+// rasterise and encode) over a set of synthetic charts, plus some PolygonFiller
+// micro-benchmarks. The results are written as JSON, one benchmark per line. If
+// given the results of an earlier run with --baseline, it exits with status 1 if
+// any benchmark got slower by more than the threshold, so that CI can catch
+// performance regressions.
+
+// Project headers
+#include "antialiased_draw.h"
+#include "bmp_stream_writer.h"
+#include "chart_snapshot.h"
+#include "coverage_compositor.h"
+#include "main.h"
+#include "message_sequence_chart.h"
+#include "msc_generator.h"
+#include "polygon/polygon.h"
+#include "vector2.h"
+
+// Deadfrog headers
+#include "fonts/df_mono.h"
+#include "df_bitmap.h"
+#include "df_font.h"
+#include "df_time.h"
+
+// Standard headers
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+#define BAND_HEIGHT 256
+#define MIN_BENCH_SECONDS 0.25
+#define MIN_ITERATIONS 3
+#define MIN_SAMPLE_SECONDS 0.002
+#define MAX_ENCODE_ROWS (16 * BAND_HEIGHT)
+#define ZOOMED_OUT_SHIFT 4
+
+
+static MscGeneratorParams const g_charts[] = {
+    // name           entities arcs  lines length boxes ellipses seed
+    { "small",        4,       100,  1,    20,    0,    0,       1 },
+    { "many_entities", 30,     1000, 1,    12,    10,   0,       2 },
+    { "long",         8,       5000, 1,    20,    10,   0,       3 },
+    { "long_labels",  8,       2000, 3,    60,    10,   0,       4 },
+    { "boxes",        8,       2000, 2,    20,    100,  0,       5 },
+    { "ellipses",     8,       2000, 1,    20,    10,   30,      6 },
+};
+
+
+struct BenchResult
+{
+    std::string m_name;
+    double m_seconds;       // Fastest iteration.
+    double m_items;         // Work done per iteration, in m_unit.
+    char const *m_unit;
+};
+
+
+static std::vector <BenchResult> g_results;
+static char const *g_filter = NULL;
+
+
+void FatalError(char const *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    exit(2);
+}
+
+
+typedef void (*BenchFunc)(void *context);
+
+
+// Runs func repeatedly for at least MIN_BENCH_SECONDS and MIN_ITERATIONS, and
+// returns the time of the fastest iteration. The fastest is the one least
+// disturbed by everything else happening on the machine. Functions that are too
+// quick to time on their own are timed in batches of at least MIN_SAMPLE_SECONDS.
+static double TimeBest(BenchFunc func, void *context)
+{
+    double startTime = GetRealTime();
+    func(context);
+    double firstDuration = GetRealTime() - startTime;
+    int batchSize = 1;
+    if (firstDuration < MIN_SAMPLE_SECONDS) {
+        batchSize = (int)(MIN_SAMPLE_SECONDS / (firstDuration + 1e-9)) + 1;
+    }
+
+    double best = 1e30;
+    double totalTime = 0.0;
+    for (int i = 0; i < MIN_ITERATIONS || totalTime < MIN_BENCH_SECONDS; i++) {
+        startTime = GetRealTime();
+        for (int j = 0; j < batchSize; j++) {
+            func(context);
+        }
+        double duration = GetRealTime() - startTime;
+        if (duration < best) {
+            best = duration;
+        }
+        totalTime += duration;
+    }
+
+    return best / batchSize;
+}
+
+
+static bool IsSelected(std::string const &name)
+{
+    return !g_filter || strstr(name.c_str(), g_filter);
+}
+
+
+static void RunBench(std::string const &name, BenchFunc func, void *context, double items,
+                     char const *unit)
+{
+    if (!IsSelected(name)) {
+        return;
+    }
+
+    BenchResult result;
+    result.m_name = name;
+    result.m_seconds = TimeBest(func, context);
+    result.m_items = items;
+    result.m_unit = unit;
+    g_results.push_back(result);
+
+    fprintf(stderr, "%-32s %10.3f ms %14.0f %s/s\n", name.c_str(), result.m_seconds * 1000.0,
+            items / result.m_seconds, unit);
+}
+
+
+// ***************************************************************************
+// Chart phases
+// ***************************************************************************
+
+struct ChartBenchContext
+{
+    char const *m_filename;
+    char const *m_snapshotFilename;
+    MessageSequenceChart *m_chart;
+    DfBitmap *m_band;
+    char const *m_outputFilename;
+};
+
+
+static void BenchParse(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+
+    MessageSequenceChart chart;
+    ChartError err;
+    chart.Load(ctx->m_filename, &err);
+}
+
+
+// For comparison with BenchParse, which uses a thread per core on large charts.
+static void BenchParseSerial(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+
+    MessageSequenceChart chart;
+    chart.m_maxParseThreads = 1;
+    ChartError err;
+    chart.Load(ctx->m_filename, &err);
+}
+
+
+static void BenchSnapshot(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+
+    MessageSequenceChart chart;
+    LoadChartSnapshot(&chart, ctx->m_filename, ctx->m_snapshotFilename);
+}
+
+
+static void BenchLayout(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+    ctx->m_chart->Layout();
+}
+
+
+static void BenchRasterise(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+    int height = ctx->m_chart->GetHeight();
+    for (int y = 0; y < height; y += BAND_HEIGHT) {
+        BitmapClear(ctx->m_band, g_colourWhite);
+        ctx->m_chart->Render(ctx->m_band, y);
+    }
+}
+
+
+// Renders the whole chart as the viewer does when zoomed all the way out.
+static void BenchZoomedOut(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+    int height = ctx->m_chart->GetHeight();
+    int bandRows = BAND_HEIGHT << ZOOMED_OUT_SHIFT;
+    RenderContext renderCtx(g_antialiasedDraw);
+    for (int y = 0; y < height; y += bandRows) {
+        BitmapClear(ctx->m_band, g_colourWhite);
+        ctx->m_chart->RenderZoomedOut(ctx->m_band, y, ZOOMED_OUT_SHIFT, &renderCtx);
+    }
+}
+
+
+// Encodes the same band over and over, so that this measures only the encoder.
+// Long charts are cut short, so as not to write gigabytes to disk.
+static int GetEncodeHeight(MessageSequenceChart *chart)
+{
+    int height = chart->GetHeight();
+    return height < MAX_ENCODE_ROWS ? height : MAX_ENCODE_ROWS;
+}
+
+
+static void BenchEncode(void *context)
+{
+    ChartBenchContext *ctx = (ChartBenchContext *)context;
+    int height = GetEncodeHeight(ctx->m_chart);
+
+    BmpStreamWriter writer;
+    if (!writer.Open(ctx->m_outputFilename, ctx->m_band->width, height)) {
+        FatalError("Couldn't open '%s'", ctx->m_outputFilename);
+    }
+    for (int y = 0; y < height; y += BAND_HEIGHT) {
+        writer.WriteRows(ctx->m_band, BAND_HEIGHT);
+    }
+    if (!writer.Close()) {
+        FatalError("Couldn't write '%s'", ctx->m_outputFilename);
+    }
+}
+
+
+static void RunChartBenchmark(std::string const &prefix, char const *filename, char const *workDir)
+{
+    std::string outputFilename = std::string(workDir) + "/bench_output.bmp";
+    std::string snapshotFilename = std::string(workDir) + "/bench_snapshot.snap";
+
+    MessageSequenceChart chart;
+    ChartError err;
+    if (!chart.Load(filename, &err)) {
+        FatalError("%s: line %d: %s", filename, err.m_lineNum, err.m_message);
+    }
+    chart.Layout();
+    if (!SaveChartSnapshot(&chart, filename, snapshotFilename.c_str())) {
+        FatalError("Couldn't write '%s'", snapshotFilename.c_str());
+    }
+
+    ChartBenchContext ctx;
+    ctx.m_filename = filename;
+    ctx.m_snapshotFilename = snapshotFilename.c_str();
+    ctx.m_chart = &chart;
+    ctx.m_band = BitmapCreate(chart.GetWidth(), BAND_HEIGHT);
+    ctx.m_outputFilename = outputFilename.c_str();
+
+    double numArcs = chart.m_arcs.size();
+    double numPixels = (double)chart.GetWidth() * chart.GetHeight();
+    RunBench("parse/" + prefix, BenchParse, &ctx, numArcs, "arcs");
+    RunBench("parse_serial/" + prefix, BenchParseSerial, &ctx, numArcs, "arcs");
+    RunBench("snapshot/" + prefix, BenchSnapshot, &ctx, numArcs, "arcs");
+    RunBench("layout/" + prefix, BenchLayout, &ctx, numArcs, "arcs");
+    RunBench("rasterise/" + prefix, BenchRasterise, &ctx, numPixels, "pixels");
+    RunBench("zoomed_out/" + prefix, BenchZoomedOut, &ctx, numPixels, "pixels");
+    RunBench("encode/" + prefix, BenchEncode, &ctx,
+             (double)chart.GetWidth() * GetEncodeHeight(&chart), "pixels");
+
+    BitmapDelete(ctx.m_band);
+    remove(outputFilename.c_str());
+    remove(snapshotFilename.c_str());
+}
+
+
+static bool IsChartSelected(std::string const &prefix)
+{
+    return IsSelected("parse/" + prefix) || IsSelected("parse_serial/" + prefix) ||
+           IsSelected("snapshot/" + prefix) ||
+           IsSelected("layout/" + prefix) ||
+           IsSelected("rasterise/" + prefix) || IsSelected("zoomed_out/" + prefix) ||
+           IsSelected("encode/" + prefix);
+}
+
+
+static void RunSyntheticChartBenchmarks(char const *workDir, bool keepCharts)
+{
+    int numCharts = sizeof(g_charts) / sizeof(g_charts[0]);
+    for (int i = 0; i < numCharts; i++) {
+        MscGeneratorParams const &params = g_charts[i];
+        std::string prefix = params.m_name;
+        if (!IsChartSelected(prefix)) {
+            continue;
+        }
+
+        std::string filename = std::string(workDir) + "/bench_" + prefix + ".msc";
+        if (!GenerateMsc(params, filename.c_str())) {
+            FatalError("Couldn't write '%s'", filename.c_str());
+        }
+
+        RunChartBenchmark(prefix, filename.c_str(), workDir);
+
+        if (!keepCharts) {
+            remove(filename.c_str());
+        }
+    }
+}
+
+
+// Benchmarks each chart named on the command line. They are named after the file,
+// without its path or extension.
+static void RunChartFileBenchmarks(std::vector <char const *> const &filenames, char const *workDir)
+{
+    for (int i = 0; i < filenames.size(); i++) {
+        std::string prefix = filenames[i];
+        size_t slash = prefix.find_last_of("/\\");
+        if (slash != std::string::npos) {
+            prefix.erase(0, slash + 1);
+        }
+        size_t dot = prefix.rfind('.');
+        if (dot != std::string::npos) {
+            prefix.erase(dot);
+        }
+
+        if (IsChartSelected(prefix)) {
+            RunChartBenchmark(prefix, filenames[i], workDir);
+        }
+    }
+}
+
+
+// ***************************************************************************
+// PolygonFiller micro-benchmarks
+// ***************************************************************************
+
+struct PolyBenchContext
+{
+    PolygonFiller *m_filler;
+    DfBitmap *m_bmp;
+    unsigned char *m_bytes;     // For the 8-bit formats. The same size as m_bmp.
+    PolygonTarget m_target;
+    PolygonBlendMode m_blend;
+    std::vector <PolygonData *> m_polys;
+};
+
+
+// Each set of polygons is drawn onto each of these. The first is what charts use.
+// The last leaves a coverage mask for the composite benchmark.
+struct PolyBenchVariant
+{
+    char const *m_prefix;
+    PolygonPixelFormat m_format;
+    PolygonBlendMode m_blend;
+    bool m_linearBlending;
+};
+
+static PolyBenchVariant const g_polyVariants[] = {
+    { "poly/", POLYGON_FORMAT_BGRA32, POLYGON_BLEND_OVER, false },
+    { "poly_linear/", POLYGON_FORMAT_BGRA32, POLYGON_BLEND_OVER, true },
+    { "poly_add/", POLYGON_FORMAT_BGRA32, POLYGON_BLEND_ADD, false },
+    { "poly_gray8/", POLYGON_FORMAT_GRAY8, POLYGON_BLEND_OVER, false },
+    { "poly_mask/", POLYGON_FORMAT_GRAY8, POLYGON_BLEND_REPLACE, false },
+    { "poly_indexed8/", POLYGON_FORMAT_INDEXED8, POLYGON_BLEND_OVER, false },
+    { "poly_coverage8/", POLYGON_FORMAT_COVERAGE8, POLYGON_BLEND_ADD, false }
+};
+
+
+// Makes a quad covering the line from (x1, y1) to (x2, y2).
+static PolygonData *CreateLineQuad(float x1, float y1, float x2, float y2, float thickness)
+{
+    Vector2 delta(x2 - x1, y2 - y1);
+    Vector2 ortho(delta.y, -delta.x);
+    ortho.SetLen(thickness / 2.0);
+
+    PolygonData *poly = new PolygonData(4);
+    poly->m_vertices[0].Set(x1 + ortho.x, y1 + ortho.y);
+    poly->m_vertices[1].Set(x2 + ortho.x, y2 + ortho.y);
+    poly->m_vertices[2].Set(x2 - ortho.x, y2 - ortho.y);
+    poly->m_vertices[3].Set(x1 - ortho.x, y1 - ortho.y);
+    return poly;
+}
+
+
+static void BenchPolygons(void *context)
+{
+    PolyBenchContext *ctx = (PolyBenchContext *)context;
+    for (int i = 0; i < ctx->m_polys.size(); i++) {
+        ctx->m_filler->DrawPoly(ctx->m_target, ctx->m_polys[i], g_colourBlack, ctx->m_blend);
+    }
+}
+
+
+static void BenchComposite(void *context)
+{
+    PolyBenchContext *ctx = (PolyBenchContext *)context;
+    CompositeCoverage(ctx->m_bmp, 0, 0, ctx->m_target, g_colourBlack);
+}
+
+
+static void RunPolygonBenchmark(char const *name, PolyBenchContext *ctx)
+{
+    int numVariants = sizeof(g_polyVariants) / sizeof(g_polyVariants[0]);
+    for (int v = 0; v < numVariants; v++) {
+        PolyBenchVariant const &variant = g_polyVariants[v];
+        if (variant.m_format == POLYGON_FORMAT_BGRA32) {
+            ctx->m_target.m_pixels = ctx->m_bmp->pixels;
+        }
+        else {
+            ctx->m_target.m_pixels = ctx->m_bytes;
+        }
+        ctx->m_target.m_format = variant.m_format;
+        ctx->m_blend = variant.m_blend;
+        ctx->m_filler->SetLinearBlending(variant.m_linearBlending);
+
+        // Draw once to find out how many pixels the polygons touch.
+        BitmapClear(ctx->m_bmp, g_colourWhite);
+        memset(ctx->m_bytes, 255, ctx->m_bmp->width * ctx->m_bmp->height);
+        PolygonFillerStats before = ctx->m_filler->GetStats();
+        BenchPolygons(ctx);
+        PolygonFillerStats after = ctx->m_filler->GetStats();
+        double pixels = (after.m_pixelsFilled - before.m_pixelsFilled) +
+                        (after.m_pixelsBlended - before.m_pixelsBlended);
+
+        RunBench(std::string(variant.m_prefix) + name, BenchPolygons, ctx, pixels, "pixels");
+    }
+    ctx->m_filler->SetLinearBlending(false);
+
+    // Composite the coverage mask of the polygons left by the last variant.
+    RunBench(std::string("composite/") + name, BenchComposite, ctx,
+             ctx->m_bmp->width * ctx->m_bmp->height, "pixels");
+
+    for (int i = 0; i < ctx->m_polys.size(); i++) {
+        delete ctx->m_polys[i];
+    }
+    ctx->m_polys.clear();
+}
+
+
+static void RunPolygonBenchmarks()
+{
+    PolyBenchContext ctx;
+    ctx.m_filler = new PolygonFiller;
+    ctx.m_bmp = BitmapCreate(1024, 1024);
+    ctx.m_bytes = new unsigned char[1024 * 1024];
+    ctx.m_target = PolygonTarget(ctx.m_bmp);
+
+    // Black and white, for POLYGON_FORMAT_INDEXED8.
+    DfColour palette[2] = { g_colourBlack, g_colourWhite };
+    ctx.m_target.m_palette = palette;
+    ctx.m_target.m_paletteSize = 2;
+
+    // Thin: short horizontal lines, like arrow shafts.
+    for (int i = 0; i < 1000; i++) {
+        float y = 10.5f + i;
+        float x = (i * 37) % 800 + 0.3f;
+        ctx.m_polys.push_back(CreateLineQuad(x, y, x + 200.0f, y, 1.4f));
+    }
+    RunPolygonBenchmark("thin", &ctx);
+
+    // Thick: large, slightly rotated squares.
+    for (int i = 0; i < 100; i++) {
+        float x = (i * 53) % 700 + 50.0f;
+        float y = (i * 97) % 700 + 50.0f;
+        ctx.m_polys.push_back(CreateLineQuad(x, y, x + 200.0f, y + 10.0f, 200.0f));
+    }
+    RunPolygonBenchmark("thick", &ctx);
+
+    // Long: lines across the whole bitmap.
+    for (int i = 0; i < 1000; i++) {
+        float y = 10.25f + i;
+        ctx.m_polys.push_back(CreateLineQuad(2.0f, y, 1022.0f, y + 3.0f, 1.4f));
+    }
+    RunPolygonBenchmark("long", &ctx);
+
+    // Diagonal: 45 degree lines, where every pixel has partial coverage.
+    for (int i = 0; i < 1000; i++) {
+        float x = (i * 41) % 700 + 10.0f;
+        float y = (i * 67) % 700 + 10.0f;
+        ctx.m_polys.push_back(CreateLineQuad(x, y, x + 300.0f, y + 300.0f, 1.4f));
+    }
+    RunPolygonBenchmark("diagonal", &ctx);
+
+    BitmapDelete(ctx.m_bmp);
+    delete[] ctx.m_bytes;
+    delete ctx.m_filler;
+}
+
+
+// ***************************************************************************
+// Results
+// ***************************************************************************
+
+static bool WriteResults(char const *filename)
+{
+    FILE *out = filename ? fopen(filename, "w") : stdout;
+    if (!out) {
+        return false;
+    }
+
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < g_results.size(); i++) {
+        BenchResult const &r = g_results[i];
+        fprintf(out, "    { \"name\": \"%s\", \"seconds\": %.9f, \"items_per_second\": %.1f, \"unit\": \"%s\" }%s\n",
+                r.m_name.c_str(), r.m_seconds, r.m_items / r.m_seconds, r.m_unit,
+                i + 1 < g_results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    bool ok = !ferror(out);
+    if (filename && fclose(out) != 0) {
+        ok = false;
+    }
+
+    return ok;
+}
+
+
+// Reads the name and time of each benchmark from a file written by WriteResults().
+// This isn't a general JSON parser. It relies on each benchmark being on one line.
+static bool ReadBaseline(char const *filename, std::vector <BenchResult> *baseline)
+{
+    FILE *in = fopen(filename, "r");
+    if (!in) {
+        return false;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        char const *name = strstr(line, "\"name\": \"");
+        char const *seconds = strstr(line, "\"seconds\": ");
+        if (!name || !seconds) {
+            continue;
+        }
+
+        name += strlen("\"name\": \"");
+        char const *nameEnd = strchr(name, '"');
+        if (!nameEnd) {
+            continue;
+        }
+
+        BenchResult result;
+        result.m_name.assign(name, nameEnd);
+        result.m_seconds = strtod(seconds + strlen("\"seconds\": "), NULL);
+        result.m_items = 0.0;
+        result.m_unit = "";
+        baseline->push_back(result);
+    }
+
+    fclose(in);
+    return true;
+}
+
+
+// Returns the number of benchmarks that are more than thresholdPercent slower
+// than in the baseline.
+static int CompareWithBaseline(std::vector <BenchResult> const &baseline, double thresholdPercent)
+{
+    int numRegressions = 0;
+    int numCompared = 0;
+    double sumLogRatio = 0.0;
+    for (int i = 0; i < g_results.size(); i++) {
+        BenchResult const &r = g_results[i];
+        for (int j = 0; j < baseline.size(); j++) {
+            if (baseline[j].m_name != r.m_name || baseline[j].m_seconds <= 0.0) {
+                continue;
+            }
+
+            double change = (r.m_seconds / baseline[j].m_seconds - 1.0) * 100.0;
+            bool regressed = change > thresholdPercent;
+            fprintf(stderr, "%-32s %+7.1f%%%s\n", r.m_name.c_str(), change,
+                    regressed ? "  REGRESSION" : "");
+            if (regressed) {
+                numRegressions++;
+            }
+
+            sumLogRatio += log(baseline[j].m_seconds / r.m_seconds);
+            numCompared++;
+            break;
+        }
+    }
+
+    // The geometric mean, so that no one benchmark dominates.
+    if (numCompared > 0) {
+        fprintf(stderr, "%-32s %7.3fx\n", "overall speedup", exp(sumLogRatio / numCompared));
+    }
+
+    return numRegressions;
+}
+
+
+static void PrintUsageAndExit()
+{
+    puts("Usage: benchmark [options]");
+    puts("");
+    puts("Options:");
+    puts("  --output <file>       Write the JSON results to file instead of stdout.");
+    puts("  --baseline <file>     Compare with the results of an earlier run.");
+    puts("  --threshold <percent> Slow down that counts as a regression. Default 10.");
+    puts("  --filter <text>       Only run benchmarks whose name contains text.");
+    puts("  --work-dir <dir>      Where to write the generated charts. Default '.'.");
+    puts("  --keep-charts         Don't delete the generated charts afterwards.");
+    puts("  --chart <file>        Benchmark this chart instead of the generated ones.");
+    puts("                        Can be given more than once.");
+    exit(0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    char const *outputFilename = NULL;
+    char const *baselineFilename = NULL;
+    double thresholdPercent = 10.0;
+    char const *workDir = ".";
+    bool keepCharts = false;
+    std::vector <char const *> chartFilenames;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputFilename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselineFilename = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue) {
+            thresholdPercent = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && hasValue) {
+            g_filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--work-dir") == 0 && hasValue) {
+            workDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--keep-charts") == 0) {
+            keepCharts = true;
+        }
+        else if (strcmp(argv[i], "--chart") == 0 && hasValue) {
+            chartFilenames.push_back(argv[++i]);
+        }
+        else {
+            PrintUsageAndExit();
+        }
+    }
+
+    g_defaultFont = LoadFontFromMemory(deadfrog_mono_7x13, sizeof(deadfrog_mono_7x13));
+    g_antialiasedDraw = new AntialiasedDraw;
+
+    if (chartFilenames.empty()) {
+        RunSyntheticChartBenchmarks(workDir, keepCharts);
+    }
+    else {
+        RunChartFileBenchmarks(chartFilenames, workDir);
+    }
+    RunPolygonBenchmarks();
+
+    if (!WriteResults(outputFilename)) {
+        FatalError("Couldn't write results to '%s'", outputFilename);
+    }
+
+    if (baselineFilename) {
+        std::vector <BenchResult> baseline;
+        if (!ReadBaseline(baselineFilename, &baseline)) {
+            FatalError("Couldn't read baseline '%s'", baselineFilename);
+        }
+        if (CompareWithBaseline(baseline, thresholdPercent) > 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
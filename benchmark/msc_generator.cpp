@@ -0,0 +1,107 @@
+#include "msc_generator.h"
+
+// Standard headers
+#include <stdio.h>
+
+
+// A small LCG, so that the charts are the same on every platform.
+static unsigned NextRandom(unsigned *state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+
+static void WriteLabel(FILE *out, MscGeneratorParams const &params, unsigned *randState)
+{
+    static char const words[][8] = {
+        "request", "reply", "ack", "data", "open", "close", "sync", "retry"
+    };
+    int const numWords = sizeof(words) / sizeof(words[0]);
+
+    fputs("label=\"", out);
+    for (int line = 0; line < params.m_labelLines; line++) {
+        if (line > 0) {
+            fputs("\\n", out);
+        }
+
+        int len = 0;
+        while (len < params.m_labelLength) {
+            char const *word = words[NextRandom(randState) % numWords];
+            for (int i = 0; word[i] && len < params.m_labelLength; i++, len++) {
+                fputc(word[i], out);
+            }
+            if (len < params.m_labelLength) {
+                fputc(' ', out);
+                len++;
+            }
+        }
+    }
+    fputc('"', out);
+}
+
+
+bool GenerateMsc(MscGeneratorParams const &params, char const *filename)
+{
+    FILE *out = fopen(filename, "w");
+    if (!out) {
+        return false;
+    }
+
+    unsigned randState = params.m_seed;
+
+    // Wide enough that labels between neighbouring entities don't overlap much.
+    int width = (params.m_numEntities + 2) * (params.m_labelLength * 7 + 40);
+    if (width < 400) width = 400;
+    if (width > 9000) width = 9000;
+
+    fprintf(out, "msc {\n");
+    fprintf(out, "  width=%d;\n", width);
+    fprintf(out, "  title=\"%s\";\n", params.m_name);
+
+    for (int i = 0; i < params.m_numEntities; i++) {
+        fprintf(out, "  e%d [label=\"Entity %d\"]%s\n", i, i,
+                i + 1 < params.m_numEntities ? "," : ";");
+    }
+    fputc('\n', out);
+
+    for (int i = 0; i < params.m_numArcs; i++) {
+        unsigned kind = NextRandom(&randState) % 100;
+        if (kind < (unsigned)params.m_ellipsisPercent) {
+            fprintf(out, "  ...;\n");
+            continue;
+        }
+
+        int from = NextRandom(&randState) % params.m_numEntities;
+        int to = NextRandom(&randState) % params.m_numEntities;
+        bool isBox = kind < (unsigned)(params.m_ellipsisPercent + params.m_boxPercent);
+        if (!isBox && to == from) {
+            to = (from + 1) % params.m_numEntities;
+        }
+
+        if (isBox) {
+            if (to < from) {
+                int tmp = from;
+                from = to;
+                to = tmp;
+            }
+            fprintf(out, "  e%d box e%d [", from, to);
+            WriteLabel(out, params, &randState);
+            fprintf(out, ", textbgcolour=\"#%06x\"];\n", NextRandom(&randState) & 0xffffff);
+        }
+        else {
+            fprintf(out, "  e%d => e%d [", from, to);
+            WriteLabel(out, params, &randState);
+            fprintf(out, "];\n");
+        }
+    }
+
+    fprintf(out, "}\n");
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+
+    return ok;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+
+// Describes a synthetic chart for benchmarking.
+struct MscGeneratorParams
+{
+    char const *m_name;
+    int m_numEntities;
+    int m_numArcs;
+    int m_labelLines;           // Lines of text in each arc label.
+    int m_labelLength;          // Characters per line.
+    int m_boxPercent;           // Percentage of arcs that are boxes rather than arrows.
+    int m_ellipsisPercent;      // Percentage of arcs that are "..." rows.
+    unsigned m_seed;
+};
+
+
+// Writes a chart with the given shape to filename. The same params always
+// produce the same file. Returns false if the file couldn't be written.
+bool GenerateMsc(MscGeneratorParams const &params, char const *filename);
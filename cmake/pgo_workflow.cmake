@@ -0,0 +1,105 @@
+# Builds a profile guided optimised chart-chisel and reports how much faster it
+# is than a plain Release build. Run by the 'pgo' target, or directly with:
+#
+#   cmake -DSOURCE_DIR=<repo> -DWORK_DIR=<dir> -DDEADFROG_DIR=<dir> -P cmake/pgo_workflow.cmake
+#
+# Steps:
+#   1. Build a plain Release in WORK_DIR/release. This is the baseline.
+#   2. Build an instrumented binary in WORK_DIR/pgo.
+#   3. Train it by rendering each chart in benchmark/corpus and by running the
+#      chart benchmarks on them.
+#   4. Rebuild WORK_DIR/pgo using the profiles, with LTO. GCC names its profiles
+#      after the object files, so this has to be the same binary dir as step 2.
+#   5. Run the corpus benchmarks with both builds and compare them.
+#
+# Optional variables: CXX_COMPILER, GENERATOR, LLVM_PROFDATA.
+
+cmake_minimum_required(VERSION 3.13)
+
+foreach(var SOURCE_DIR WORK_DIR DEADFROG_DIR)
+    if(NOT ${var})
+        message(FATAL_ERROR "pgo_workflow.cmake needs -D${var}=...")
+    endif()
+endforeach()
+
+set(RELEASE_DIR "${WORK_DIR}/release")
+set(PGO_DIR "${WORK_DIR}/pgo")
+set(PROFILE_DIR "${WORK_DIR}/profiles")
+set(TRAIN_DIR "${WORK_DIR}/train")
+
+file(GLOB CORPUS "${SOURCE_DIR}/benchmark/corpus/*.msc")
+if(NOT CORPUS)
+    message(FATAL_ERROR "No charts found in ${SOURCE_DIR}/benchmark/corpus")
+endif()
+
+set(CONFIGURE_ARGS -S "${SOURCE_DIR}" -DCMAKE_BUILD_TYPE=Release "-DDEADFROG_DIR=${DEADFROG_DIR}")
+if(GENERATOR)
+    list(APPEND CONFIGURE_ARGS -G "${GENERATOR}")
+endif()
+if(CXX_COMPILER)
+    list(APPEND CONFIGURE_ARGS "-DCMAKE_CXX_COMPILER=${CXX_COMPILER}")
+endif()
+
+set(CHART_ARGS)
+foreach(chart ${CORPUS})
+    list(APPEND CHART_ARGS --chart "${chart}")
+endforeach()
+
+
+function(run)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        string(REPLACE ";" " " cmd "${ARGN}")
+        message(FATAL_ERROR "Failed (${result}): ${cmd}")
+    endif()
+endfunction()
+
+function(build binaryDir)
+    run(${CMAKE_COMMAND} ${CONFIGURE_ARGS} -B "${binaryDir}" ${ARGN})
+    run(${CMAKE_COMMAND} --build "${binaryDir}" --target chart-chisel benchmark --parallel)
+endfunction()
+
+
+message(STATUS "PGO: building the Release baseline")
+build("${RELEASE_DIR}" -DCHISEL_PGO=OFF -DCHISEL_LTO=OFF)
+
+message(STATUS "PGO: building the instrumented binaries")
+file(REMOVE_RECURSE "${PROFILE_DIR}")
+build("${PGO_DIR}" -DCHISEL_PGO=GENERATE -DCHISEL_LTO=OFF "-DCHISEL_PGO_DIR=${PROFILE_DIR}")
+
+message(STATUS "PGO: training on ${SOURCE_DIR}/benchmark/corpus")
+file(REMOVE_RECURSE "${TRAIN_DIR}")
+file(MAKE_DIRECTORY "${TRAIN_DIR}")
+foreach(chart ${CORPUS})
+    # chart-chisel writes its output next to the input, so work on a copy.
+    get_filename_component(name "${chart}" NAME)
+    configure_file("${chart}" "${TRAIN_DIR}/${name}" COPYONLY)
+    run("${PGO_DIR}/chart-chisel" batch "${TRAIN_DIR}/${name}")
+endforeach()
+run("${PGO_DIR}/benchmark" ${CHART_ARGS} --work-dir "${TRAIN_DIR}"
+    --output "${TRAIN_DIR}/training.json")
+
+file(GLOB RAW_PROFILES "${PROFILE_DIR}/*.profraw")
+if(RAW_PROFILES)
+    # Clang writes raw profiles that have to be merged before they can be used.
+    if(NOT LLVM_PROFDATA)
+        find_program(LLVM_PROFDATA NAMES llvm-profdata)
+    endif()
+    if(NOT LLVM_PROFDATA)
+        message(FATAL_ERROR "llvm-profdata is needed to merge Clang's profiles")
+    endif()
+    run("${LLVM_PROFDATA}" merge "-output=${PROFILE_DIR}/default.profdata" ${RAW_PROFILES})
+endif()
+
+message(STATUS "PGO: building the optimised binaries")
+build("${PGO_DIR}" -DCHISEL_PGO=USE -DCHISEL_LTO=ON "-DCHISEL_PGO_DIR=${PROFILE_DIR}")
+
+message(STATUS "PGO: comparing with the Release baseline")
+run("${RELEASE_DIR}/benchmark" ${CHART_ARGS} --work-dir "${TRAIN_DIR}"
+    --output "${WORK_DIR}/release.json")
+
+# A large threshold, because a regression here is a result to report, not a failure.
+run("${PGO_DIR}/benchmark" ${CHART_ARGS} --work-dir "${TRAIN_DIR}"
+    --output "${WORK_DIR}/pgo.json" --baseline "${WORK_DIR}/release.json" --threshold 1000)
+
+message(STATUS "PGO: optimised binaries are in ${PGO_DIR}")
@@ -6,6 +6,7 @@
 
 
 AntialiasedDraw *g_antialiasedDraw = NULL;
+bool g_linearBlending = false;
 
 
 AntialiasedDraw::AntialiasedDraw()
@@ -22,13 +23,43 @@ AntialiasedDraw::~AntialiasedDraw()
 }
 
 
+void AntialiasedDraw::SetClipRect(int x, int y, int width, int height)
+{
+    m_polyFiller->SetClipRect(x, y, width, height);
+}
+
+
+void AntialiasedDraw::ClearClipRect()
+{
+    m_polyFiller->ClearClipRect();
+}
+
+
+void AntialiasedDraw::SetTimingEnabled(bool enabled)
+{
+    m_polyFiller->SetTimingEnabled(enabled);
+}
+
+
+void AntialiasedDraw::SetLinearBlending(bool enabled)
+{
+    m_polyFiller->SetLinearBlending(enabled);
+}
+
+
+PolygonFillerStats AntialiasedDraw::GetFillerStats() const
+{
+    return m_polyFiller->GetStats();
+}
+
+
 void AntialiasedDraw::DrawSingleArrow(DfBitmap *bmp, Vector2 start, Vector2 end, float thickness, DfColour c)
 {
     Vector2 delta = end - start;
     Vector2 ortho(delta.y, -delta.x);
 
     float const arrowHeadLen = thickness * 10.0;
-    float const arrowHeadWidth = thickness * 7.0;
+    float const arrowHeadWidth = GetArrowHeadWidth(thickness);
     delta.SetLen(arrowHeadLen);
     Vector2 lineB = end - delta;
 
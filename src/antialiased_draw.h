@@ -9,6 +9,7 @@
 
 class PolygonData;
 class PolygonFiller;
+struct PolygonFillerStats;
 
 
 class AntialiasedDraw
@@ -21,12 +22,28 @@ public:
     AntialiasedDraw();
     ~AntialiasedDraw();
 
+    // Restricts drawing to a rectangle of the target bitmap.
+    void SetClipRect(int x, int y, int width, int height);
+    void ClearClipRect();
+
+    // Instrumentation from the polygon filler. See PolygonFiller::SetTimingEnabled().
+    void SetTimingEnabled(bool enabled);
+    PolygonFillerStats GetFillerStats() const;
+
+    // See PolygonFiller::SetLinearBlending(). Off by default.
+    void SetLinearBlending(bool enabled);
+
     void DrawSingleArrow(DfBitmap *bmp, Vector2 start, Vector2 end, float thickness, DfColour c);
+    static float GetArrowHeadWidth(float thickness) { return thickness * 7.0f; }
     void DrawEllipse(DfBitmap *bmp, Vector2 centre, float width, float height, float thickness, DfColour c);
 };
 
 
 extern AntialiasedDraw *g_antialiasedDraw;
 
+// Set by --linear-blend. chart-chisel passes it to SetLinearBlending() on each
+// AntialiasedDraw it creates. ChartRenderer doesn't use it.
+extern bool g_linearBlending;
+
 
 #endif
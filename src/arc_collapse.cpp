@@ -0,0 +1,261 @@
+#include "arc_collapse.h"
+
+// Project headers
+#include "hash.h"
+#include "message_sequence_chart.h"
+#include "string_pool.h"
+
+// Standard headers
+#include <ctype.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Multiplier of the rolling hash. Any large odd number will do.
+static unsigned long long const ROLLING_BASE = 0x9e3779b97f4a7c15ULL;
+
+
+// Finds the arcs that are copies of each other, and the hashes of blocks of them.
+class ArcMatcher
+{
+private:
+    std::vector <Arc *> const *m_arcs;
+    std::vector <unsigned> m_templateIds;           // By string id.
+    std::vector <unsigned long long> m_prefixHashes; // Rolling hash of the first i arcs.
+    unsigned long long m_powers[MAX_COLLAPSE_PERIOD + 1];
+
+    unsigned long long HashArc(Arc const *a) const;
+
+public:
+    ArcMatcher(MessageSequenceChart *chart);
+
+    bool ArcsMatch(int i, int j) const;
+
+    // True if the len arcs starting at i are copies of those starting at j.
+    bool BlocksMatch(int i, int j, int len) const;
+};
+
+
+// A label's template is its text with each run of digits replaced by a '#'. Each
+// distinct template gets an id, so that labels can be compared with integers.
+ArcMatcher::ArcMatcher(MessageSequenceChart *chart)
+{
+    m_arcs = &chart->m_arcs;
+
+    StringPool templates;
+    std::string text;
+    m_templateIds.resize(chart->m_strings.GetCount());
+    for (unsigned i = 0; i < m_templateIds.size(); i++) {
+        char const *str = chart->m_strings.GetString(i);
+        text.clear();
+        for (char const *c = str; *c; c++) {
+            if (!isdigit((unsigned char)*c)) {
+                text += *c;
+            }
+            else if (c == str || !isdigit((unsigned char)c[-1])) {
+                text += '#';
+            }
+        }
+        m_templateIds[i] = templates.Intern(text.c_str());
+    }
+
+    m_powers[0] = 1;
+    for (int i = 1; i <= MAX_COLLAPSE_PERIOD; i++) {
+        m_powers[i] = m_powers[i - 1] * ROLLING_BASE;
+    }
+
+    m_prefixHashes.resize(m_arcs->size() + 1);
+    m_prefixHashes[0] = 0;
+    for (int i = 0; i < m_arcs->size(); i++) {
+        m_prefixHashes[i + 1] = m_prefixHashes[i] * ROLLING_BASE + HashArc((*m_arcs)[i]);
+    }
+}
+
+
+unsigned long long ArcMatcher::HashArc(Arc const *a) const
+{
+    unsigned long long h = HASH_INITIAL_VALUE;
+    h = HashBytes(h, &a->m_type, sizeof(a->m_type));
+    h = HashBytes(h, a->m_entities, sizeof(a->m_entities));
+    h = HashBytes(h, &a->m_params.m_bgColour.c, sizeof(a->m_params.m_bgColour.c));
+    for (int i = 0; i < a->m_params.m_label.size(); i++) {
+        unsigned templateId = m_templateIds[a->m_params.m_label[i]];
+        h = HashBytes(h, &templateId, sizeof(templateId));
+    }
+    return h;
+}
+
+
+bool ArcMatcher::ArcsMatch(int i, int j) const
+{
+    Arc const *a = (*m_arcs)[i];
+    Arc const *b = (*m_arcs)[j];
+    if (a->m_type != b->m_type ||
+        a->m_entities[0] != b->m_entities[0] || a->m_entities[1] != b->m_entities[1] ||
+        a->m_params.m_bgColour.c != b->m_params.m_bgColour.c ||
+        a->m_params.m_label.size() != b->m_params.m_label.size()) {
+        return false;
+    }
+
+    for (int k = 0; k < a->m_params.m_label.size(); k++) {
+        if (m_templateIds[a->m_params.m_label[k]] != m_templateIds[b->m_params.m_label[k]]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool ArcMatcher::BlocksMatch(int i, int j, int len) const
+{
+    unsigned long long hashI = m_prefixHashes[i + len] - m_prefixHashes[i] * m_powers[len];
+    unsigned long long hashJ = m_prefixHashes[j + len] - m_prefixHashes[j] * m_powers[len];
+    if (hashI != hashJ) {
+        return false;
+    }
+
+    // The hashes only say the blocks are probably the same.
+    for (int k = 0; k < len; k++) {
+        if (!ArcsMatch(i + k, j + k)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// There's no point replacing a run of spacers or "..."s with a "...".
+static bool DrawsBetweenEntities(std::vector <Arc *> const &arcs, int first, int len)
+{
+    for (int i = first; i < first + len; i++) {
+        if (arcs[i]->m_type == Arc::TYPE_ARROW || arcs[i]->m_type == Arc::TYPE_BOX) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Makes the "..." arc that stands for the copies that were removed. It is drawn
+// between the outermost entities of the block.
+static Arc *CreateRepeatArc(MessageSequenceChart *chart, int first, int period, int count,
+                            std::unordered_map <Entity const *, int> const &entityIndices)
+{
+    Arc *rv = new Arc;
+    rv->m_type = Arc::TYPE_ELLIPSIS;
+
+    int minIndex = -1;
+    int maxIndex = -1;
+    for (int i = first; i < first + period; i++) {
+        for (int j = 0; j < 2; j++) {
+            Entity const *e = chart->m_arcs[i]->m_entities[j];
+            if (!e) {
+                continue;
+            }
+            int index = entityIndices.find(e)->second;
+            if (minIndex < 0 || index < minIndex) {
+                minIndex = index;
+            }
+            if (index > maxIndex) {
+                maxIndex = index;
+            }
+        }
+    }
+    if (minIndex >= 0) {
+        rv->m_entities[0] = chart->m_entities[minIndex];
+        rv->m_entities[1] = chart->m_entities[maxIndex];
+    }
+
+    char label[32];
+    sprintf(label, "x%d", count);
+    rv->m_params.m_label.push_back(chart->m_strings.Intern(label));
+    return rv;
+}
+
+
+int CollapseRepeatedArcs(MessageSequenceChart *chart, int minRepeats)
+{
+    if (minRepeats < 2) {
+        return 0;
+    }
+
+    std::vector <Arc *> &arcs = chart->m_arcs;
+    int numArcs = arcs.size();
+    ArcMatcher matcher(chart);
+
+    std::unordered_map <Entity const *, int> entityIndices;
+    for (int i = 0; i < chart->m_entities.size(); i++) {
+        entityIndices[chart->m_entities[i]] = i;
+    }
+
+    // Where the last run found for each period ended. ArcsMatch() is an exact
+    // comparison, so every block of that period that starts inside the run
+    // matches the blocks after it up to the end of the run. Those blocks aren't
+    // compared again, even when the run was too short to collapse and i only
+    // moves on by one, so the time taken is linear in the number of arcs.
+    int runEnds[MAX_COLLAPSE_PERIOD + 1] = { 0 };
+
+    std::vector <Arc *> kept;
+    kept.reserve(numArcs);
+    int numRemoved = 0;
+    int i = 0;
+    while (i < numArcs) {
+        // Find the period whose copies cover the most arcs.
+        int bestPeriod = 0;
+        int bestCount = 0;
+        for (int period = 1; period <= MAX_COLLAPSE_PERIOD && i + period <= numArcs; period++) {
+            // A block that ends with an unspacer would put the "..." on the row of
+            // its last arc.
+            if (arcs[i + period - 1]->m_type == Arc::TYPE_UNSPACER) {
+                continue;
+            }
+            if (!DrawsBetweenEntities(arcs, i, period)) {
+                continue;
+            }
+
+            int count = std::max(1, (runEnds[period] - i) / period);
+            while (i + (count + 1) * period <= numArcs &&
+                   matcher.BlocksMatch(i, i + count * period, period)) {
+                count++;
+            }
+            runEnds[period] = i + count * period;
+
+            // Likewise an unspacer after the run puts the next arc on the row of the
+            // run's last arc, so that copy has to stay.
+            int end = i + count * period;
+            if (end < numArcs && arcs[end]->m_type == Arc::TYPE_UNSPACER) {
+                count--;
+            }
+
+            if (count >= minRepeats && count * period > bestCount * bestPeriod) {
+                bestPeriod = period;
+                bestCount = count;
+            }
+        }
+
+        if (bestCount == 0) {
+            kept.push_back(arcs[i]);
+            i++;
+            continue;
+        }
+
+        for (int j = i; j < i + bestPeriod; j++) {
+            kept.push_back(arcs[j]);
+        }
+        kept.push_back(CreateRepeatArc(chart, i, bestPeriod, bestCount, entityIndices));
+        for (int j = i + bestPeriod; j < i + bestCount * bestPeriod; j++) {
+            delete arcs[j];
+            numRemoved++;
+        }
+        i += bestCount * bestPeriod;
+    }
+
+    arcs.swap(kept);
+    return numRemoved;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+
+class MessageSequenceChart;
+
+
+// Generated traces often repeat the same exchange thousands of times, eg. a
+// request and its response with only a sequence number changing. This finds runs
+// of at least minRepeats copies of a block of up to MAX_COLLAPSE_PERIOD arcs and
+// replaces each run with its first copy, followed by a "..." arc labelled with
+// the number of copies, eg. "x1000".
+//
+// Two arcs are copies if they have the same type, entities and colour, and their
+// labels are the same apart from the numbers in them. The search uses a rolling
+// hash over the arcs, so the time it takes is linear in the number of arcs.
+//
+// Call it after the chart is loaded and before Layout(). Returns the number of
+// arcs removed.
+
+#define MAX_COLLAPSE_PERIOD 8
+
+int CollapseRepeatedArcs(MessageSequenceChart *chart, int minRepeats);
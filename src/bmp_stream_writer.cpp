@@ -0,0 +1,146 @@
+#include "bmp_stream_writer.h"
+
+// Project headers
+#include "stats.h"
+
+// Standard headers
+#include <string.h>
+
+
+static void WriteU16(unsigned char *buf, unsigned val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+}
+
+
+static void WriteU32(unsigned char *buf, unsigned val)
+{
+    WriteU16(buf, val & 0xffff);
+    WriteU16(buf + 2, val >> 16);
+}
+
+
+BmpStreamWriter::BmpStreamWriter()
+{
+    m_file = NULL;
+    m_width = 0;
+    m_height = 0;
+    m_rowsWritten = 0;
+    m_rowBuf = NULL;
+    m_rowBytes = 0;
+    m_heightKnown = true;
+}
+
+
+BmpStreamWriter::~BmpStreamWriter()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+    delete[] m_rowBuf;
+}
+
+
+bool BmpStreamWriter::Open(char const *filename, int width, int height)
+{
+    m_file = fopen(filename, "wb");
+    if (!m_file) {
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_heightKnown = height > 0;
+    m_rowsWritten = 0;
+    m_rowBytes = (width * 3 + 3) & ~3;
+    delete[] m_rowBuf;
+    m_rowBuf = new unsigned char[m_rowBytes];
+    memset(m_rowBuf, 0, m_rowBytes);
+
+    return WriteHeader();
+}
+
+
+bool BmpStreamWriter::WriteHeader()
+{
+    enum { FILE_HEADER_SIZE = 14, INFO_HEADER_SIZE = 40 };
+    unsigned char header[FILE_HEADER_SIZE + INFO_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+
+    // BITMAPFILEHEADER
+    header[0] = 'B';
+    header[1] = 'M';
+    WriteU32(header + 2, sizeof(header) + m_rowBytes * m_height);
+    WriteU32(header + 10, sizeof(header));
+
+    // BITMAPINFOHEADER
+    unsigned char *info = header + FILE_HEADER_SIZE;
+    WriteU32(info, INFO_HEADER_SIZE);
+    WriteU32(info + 4, m_width);
+    WriteU32(info + 8, -m_height);   // Negative means the rows are top-down.
+    WriteU16(info + 12, 1);          // Planes
+    WriteU16(info + 14, 24);         // Bits per pixel
+    WriteU32(info + 20, m_rowBytes * m_height);
+    WriteU32(info + 24, 2835);       // 72 DPI
+    WriteU32(info + 28, 2835);
+
+    return fwrite(header, sizeof(header), 1, m_file) == 1;
+}
+
+
+bool BmpStreamWriter::WriteRows(DfBitmap *bmp, int numRows)
+{
+    ScopedStatTimer timer(STAT_TIMER_ENCODE);
+
+    if (!m_file) {
+        return false;
+    }
+
+    if (m_heightKnown && numRows > m_height - m_rowsWritten) {
+        numRows = m_height - m_rowsWritten;
+    }
+
+    for (int y = 0; y < numRows; y++) {
+        DfColour *src = bmp->pixels + y * bmp->width;
+        unsigned char *dst = m_rowBuf;
+        for (int x = 0; x < m_width; x++) {
+            dst[0] = src[x].b;
+            dst[1] = src[x].g;
+            dst[2] = src[x].r;
+            dst += 3;
+        }
+
+        if (fwrite(m_rowBuf, m_rowBytes, 1, m_file) != 1) {
+            return false;
+        }
+    }
+
+    m_rowsWritten += numRows;
+    StatsCount(STAT_COUNTER_BYTES_ENCODED, (long long)m_rowBytes * numRows);
+    return true;
+}
+
+
+bool BmpStreamWriter::Close()
+{
+    if (!m_file) {
+        return false;
+    }
+
+    bool ok = true;
+    if (m_heightKnown) {
+        ok = m_rowsWritten == m_height;
+    }
+    else {
+        m_height = m_rowsWritten;
+        ok = fseek(m_file, 0, SEEK_SET) == 0 && WriteHeader();
+    }
+
+    if (fclose(m_file) != 0) {
+        ok = false;
+    }
+    m_file = NULL;
+
+    return ok;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "df_bitmap.h"
+
+#include <stdio.h>
+
+
+// Writes a 24-bit BMP file a few rows at a time, so that the whole image never
+// has to be in memory. The rows are stored top-down (negative height in the
+// header), so they can go straight to the file in the order they are rendered.
+class BmpStreamWriter
+{
+private:
+    FILE *m_file;
+    int m_width;
+    int m_height;
+    int m_rowsWritten;
+    unsigned char *m_rowBuf;    // One row converted to the file's pixel format.
+    unsigned m_rowBytes;        // Including the padding to a multiple of 4 bytes.
+    bool m_heightKnown;
+
+    bool WriteHeader();
+
+public:
+    BmpStreamWriter();
+    ~BmpStreamWriter();
+
+    // If height is zero, the image is as tall as the rows written, and Close()
+    // fills in the height in the header. That needs a file that can be seeked.
+    bool Open(char const *filename, int width, int height);
+
+    // Writes the first numRows rows of bmp, which must be at least as wide as the
+    // image. Rows beyond the height given to Open() are ignored.
+    bool WriteRows(DfBitmap *bmp, int numRows);
+
+    // Returns false if the file was short of rows or couldn't be written.
+    bool Close();
+};
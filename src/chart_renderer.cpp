@@ -0,0 +1,156 @@
+#include "chart_renderer.h"
+
+// Project headers
+#include "antialiased_draw.h"
+#include "png_writer.h"
+#include "stats.h"
+
+// Deadfrog headers
+#include "fonts/df_mono.h"
+#include "df_bitmap.h"
+#include "df_font.h"
+
+// Standard headers
+#include <string.h>
+#include <algorithm>
+
+
+static bool SetError(ChartError *err, char const *message)
+{
+    err->m_lineNum = 0;
+    err->m_column = 0;
+    strncpy(err->m_message, message, sizeof(err->m_message) - 1);
+    err->m_message[sizeof(err->m_message) - 1] = '\0';
+    return false;
+}
+
+
+ChartRenderer::ChartRenderer()
+{
+    m_font = LoadFontFromMemory(deadfrog_mono_7x13, sizeof(deadfrog_mono_7x13));
+    m_aaDraw = new AntialiasedDraw;
+    m_aaDraw->SetTimingEnabled(g_statsEnabled);
+    m_band = NULL;
+    m_chart = NULL;
+}
+
+
+ChartRenderer::~ChartRenderer()
+{
+    delete m_chart;
+    if (m_band) {
+        BitmapDelete(m_band);
+    }
+    delete m_aaDraw;
+    FontDelete(m_font);
+}
+
+
+bool ChartRenderer::Parse(char const *text, int len, ChartError *err)
+{
+    delete m_chart;
+    m_chart = new MessageSequenceChart;
+    m_chart->m_font = m_font;
+
+    if (!m_chart->LoadFromMemory(text, len, err)) {
+        delete m_chart;
+        m_chart = NULL;
+        return false;
+    }
+
+    m_chart->Layout();
+    return true;
+}
+
+
+int ChartRenderer::GetWidth() const
+{
+    return m_chart ? m_chart->GetWidth() : 0;
+}
+
+
+int ChartRenderer::GetHeight() const
+{
+    return m_chart ? m_chart->GetHeight() : 0;
+}
+
+
+// Renders the band whose top is at chart Y coordinate y into m_band.
+DfBitmap *ChartRenderer::RenderBand(int y)
+{
+    int width = m_chart->GetWidth();
+    if (!m_band || m_band->width != width) {
+        if (m_band) {
+            BitmapDelete(m_band);
+        }
+        m_band = BitmapCreate(width, BAND_HEIGHT);
+    }
+
+    BitmapClear(m_band, g_colourWhite);
+    RenderContext ctx(m_aaDraw);
+    m_chart->Render(m_band, y, &ctx);
+    StatsCount(STAT_COUNTER_BANDS);
+
+    return m_band;
+}
+
+
+bool ChartRenderer::RenderToPixels(void *pixels, int width, int height, int strideBytes,
+                                   ChartError *err)
+{
+    if (!m_chart) {
+        return SetError(err, "No chart has been parsed");
+    }
+    if (width <= 0 || height <= 0 || strideBytes < width * (int)sizeof(DfColour)) {
+        return SetError(err, "Invalid pixel buffer size");
+    }
+
+    int copyWidth = std::min(width, m_chart->GetWidth());
+    int chartHeight = std::min(height, m_chart->GetHeight());
+
+    for (int y = 0; y < chartHeight; y += BAND_HEIGHT) {
+        DfBitmap *band = RenderBand(y);
+        int numRows = std::min((int)BAND_HEIGHT, chartHeight - y);
+        for (int i = 0; i < numRows; i++) {
+            DfColour *dst = (DfColour *)((char *)pixels + (y + i) * (size_t)strideBytes);
+            memcpy(dst, band->pixels + i * band->width, copyWidth * sizeof(DfColour));
+            std::fill(dst + copyWidth, dst + width, g_colourWhite);
+        }
+    }
+
+    for (int y = chartHeight; y < height; y++) {
+        DfColour *dst = (DfColour *)((char *)pixels + y * (size_t)strideBytes);
+        std::fill(dst, dst + width, g_colourWhite);
+    }
+
+    return true;
+}
+
+
+bool ChartRenderer::RenderToPng(std::vector <unsigned char> *png, ChartError *err)
+{
+    if (!m_chart) {
+        return SetError(err, "No chart has been parsed");
+    }
+
+    int width = m_chart->GetWidth();
+    int height = m_chart->GetHeight();
+
+    PngWriter writer;
+    writer.Open(png, width, height);
+    for (int y = 0; y < height; y += BAND_HEIGHT) {
+        writer.WriteRows(RenderBand(y), std::min((int)BAND_HEIGHT, height - y));
+    }
+
+    if (!writer.Close()) {
+        return SetError(err, "Couldn't encode the PNG");
+    }
+
+    return true;
+}
+
+
+void ChartRenderer::SetLinearBlending(bool enabled)
+{
+    m_aaDraw->SetLinearBlending(enabled);
+}
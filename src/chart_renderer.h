@@ -0,0 +1,56 @@
+#pragma once
+
+#include "message_sequence_chart.h"
+
+#include <vector>
+
+
+class AntialiasedDraw;
+struct DfBitmap;
+struct DfFont;
+
+
+// Parses and renders charts without a window, without any globals and without
+// calling exit(). The font, polygon filler and band bitmap all belong to the
+// ChartRenderer, so several threads can render at once as long as each has its
+// own ChartRenderer. Failures are described by a ChartError.
+//
+// The chart is rendered BAND_HEIGHT rows at a time, so the memory a ChartRenderer
+// uses beyond the caller's buffer depends on the width of the chart, not its height.
+class ChartRenderer
+{
+public:
+    enum { BAND_HEIGHT = 256 };
+
+private:
+    DfFont *m_font;
+    AntialiasedDraw *m_aaDraw;
+    DfBitmap *m_band;
+    MessageSequenceChart *m_chart;
+
+    DfBitmap *RenderBand(int y);
+
+public:
+    ChartRenderer();
+    ~ChartRenderer();
+
+    // Parses the text of a .msc file and lays the chart out, replacing any chart
+    // parsed before. The text doesn't need to be nul terminated.
+    bool Parse(char const *text, int len, ChartError *err);
+
+    // The size of image the parsed chart needs. Zero if there isn't one.
+    int GetWidth() const;
+    int GetHeight() const;
+
+    // Renders the parsed chart into the caller's width by height buffer of DfColour
+    // pixels, with rows strideBytes apart. The chart is drawn from the top left
+    // corner. Any part of the buffer it doesn't cover is cleared to white.
+    bool RenderToPixels(void *pixels, int width, int height, int strideBytes, ChartError *err);
+
+    // Appends the parsed chart to png as a PNG file.
+    bool RenderToPng(std::vector <unsigned char> *png, ChartError *err);
+
+    // Whether antialiased edges are blended in linear light. Off by default, and
+    // independent of chart-chisel's --linear-blend. See PolygonFiller::SetLinearBlending().
+    void SetLinearBlending(bool enabled);
+};
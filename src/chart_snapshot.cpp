@@ -0,0 +1,312 @@
+#include "chart_snapshot.h"
+
+// Project headers
+#include "hash.h"
+#include "mapped_file.h"
+#include "message_sequence_chart.h"
+#include "stats.h"
+#include "string_pool.h"
+
+// Standard headers
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+#define SNAPSHOT_VERSION 2
+
+static char const SNAPSHOT_MAGIC[8] = { 'M', 'S', 'C', 'S', 'N', 'A', 'P', '\0' };
+static unsigned const NO_ENTITY = 0xffffffff;
+
+
+// The file is a SnapshotHeader, then m_numEntities SnapshotEntities, then
+// m_numArcs SnapshotArcs, then m_numLabels string ids, then m_numStrings offsets
+// into the string pool, then the string pool. The first m_numTitleLines labels
+// are the title. String ids are the same as in the chart's StringPool.
+struct SnapshotHeader
+{
+    char m_magic[8];
+    unsigned m_version;
+    unsigned m_headerSize;          // Catches a build with different struct packing.
+    unsigned long long m_sourceHash;
+    unsigned long long m_sourceSize;
+    int m_pixelWidth;
+    unsigned m_numTitleLines;
+    unsigned m_numEntities;
+    unsigned m_numArcs;
+    unsigned m_numLabels;
+    unsigned m_numStrings;
+    unsigned m_stringPoolSize;
+};
+
+struct SnapshotEntity
+{
+    unsigned m_name;                // String id.
+    unsigned m_firstLabel;
+    unsigned m_numLabels;
+    unsigned m_bgColour;
+};
+
+struct SnapshotArc
+{
+    unsigned m_entities[2];         // Indices into the entity table, or NO_ENTITY.
+    int m_type;
+    unsigned m_firstLabel;
+    unsigned m_numLabels;
+    unsigned m_bgColour;
+};
+
+
+static bool HashFile(char const *filename, unsigned long long *hash, unsigned long long *size)
+{
+    MappedFile source;
+    if (!source.Open(filename)) {
+        return false;
+    }
+
+    unsigned long long h = HashBytes(HASH_INITIAL_VALUE, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    *hash = HashBytes(h, source.GetData(), source.GetSize());
+    *size = source.GetSize();
+    return true;
+}
+
+
+static unsigned AddLines(std::vector <unsigned> const &lines, std::vector <unsigned> *labels)
+{
+    unsigned first = labels->size();
+    labels->insert(labels->end(), lines.begin(), lines.end());
+    return first;
+}
+
+
+bool SaveChartSnapshot(MessageSequenceChart *chart, char const *sourceFilename,
+                       char const *snapshotFilename)
+{
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!HashFile(sourceFilename, &header.m_sourceHash, &header.m_sourceSize)) {
+        return false;
+    }
+
+    // The chart's strings are already unique, so they are written as they are.
+    StringPool const &pool = chart->m_strings;
+    std::vector <unsigned> stringOffsets(pool.GetCount());
+    std::vector <char> stringPool;
+    std::unordered_map <char const *, unsigned> stringIds;
+    for (unsigned i = 0; i < pool.GetCount(); i++) {
+        char const *str = pool.GetString(i);
+        stringOffsets[i] = stringPool.size();
+        stringPool.insert(stringPool.end(), str, str + strlen(str) + 1);
+        stringIds[str] = i;
+    }
+
+    std::vector <unsigned> labels;
+    AddLines(chart->m_title, &labels);
+
+    std::unordered_map <Entity const *, unsigned> entityIndices;
+    std::vector <SnapshotEntity> entities(chart->m_entities.size());
+    for (int i = 0; i < chart->m_entities.size(); i++) {
+        Entity const *e = chart->m_entities[i];
+        entityIndices[e] = i;
+        entities[i].m_name = stringIds[e->m_name];
+        entities[i].m_firstLabel = AddLines(e->m_params.m_label, &labels);
+        entities[i].m_numLabels = e->m_params.m_label.size();
+        entities[i].m_bgColour = e->m_params.m_bgColour.c;
+    }
+
+    std::vector <SnapshotArc> arcs(chart->m_arcs.size());
+    for (int i = 0; i < chart->m_arcs.size(); i++) {
+        Arc const *a = chart->m_arcs[i];
+        for (int j = 0; j < 2; j++) {
+            arcs[i].m_entities[j] = a->m_entities[j] ? entityIndices[a->m_entities[j]] : NO_ENTITY;
+        }
+        arcs[i].m_type = a->m_type;
+        arcs[i].m_firstLabel = AddLines(a->m_params.m_label, &labels);
+        arcs[i].m_numLabels = a->m_params.m_label.size();
+        arcs[i].m_bgColour = a->m_params.m_bgColour.c;
+    }
+
+    memcpy(header.m_magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.m_version = SNAPSHOT_VERSION;
+    header.m_headerSize = sizeof(SnapshotHeader);
+    header.m_pixelWidth = chart->m_pixelWidth;
+    header.m_numTitleLines = chart->m_title.size();
+    header.m_numEntities = entities.size();
+    header.m_numArcs = arcs.size();
+    header.m_numLabels = labels.size();
+    header.m_numStrings = stringOffsets.size();
+    header.m_stringPoolSize = stringPool.size();
+
+    FILE *out = fopen(snapshotFilename, "wb");
+    if (!out) {
+        return false;
+    }
+
+    // The header goes last, so that a snapshot that was only partly written
+    // doesn't have a valid header.
+    SnapshotHeader blankHeader;
+    memset(&blankHeader, 0, sizeof(blankHeader));
+    bool ok = fwrite(&blankHeader, sizeof(blankHeader), 1, out) == 1;
+    ok = ok && (entities.empty() ||
+                fwrite(&entities[0], sizeof(SnapshotEntity), entities.size(), out) == entities.size());
+    ok = ok && (arcs.empty() ||
+                fwrite(&arcs[0], sizeof(SnapshotArc), arcs.size(), out) == arcs.size());
+    ok = ok && (labels.empty() ||
+                fwrite(&labels[0], sizeof(unsigned), labels.size(), out) == labels.size());
+    ok = ok && (stringOffsets.empty() ||
+                fwrite(&stringOffsets[0], sizeof(unsigned), stringOffsets.size(), out) ==
+                stringOffsets.size());
+    ok = ok && (stringPool.empty() ||
+                fwrite(&stringPool[0], 1, stringPool.size(), out) == stringPool.size());
+    ok = ok && fflush(out) == 0;
+    ok = ok && fseek(out, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, out) == 1;
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        remove(snapshotFilename);
+    }
+    return ok;
+}
+
+
+// Copies the labels [first, first + count) to lines. Returns false if they are
+// out of range. The string ids were checked when the file was opened.
+static bool GetLines(SnapshotHeader const *header, unsigned const *labels,
+                     unsigned first, unsigned count, std::vector <unsigned> *lines)
+{
+    if (first > header->m_numLabels || count > header->m_numLabels - first) {
+        return false;
+    }
+
+    lines->assign(labels + first, labels + first + count);
+    return true;
+}
+
+
+static bool Fail(MessageSequenceChart *chart)
+{
+    chart->Clear();
+    return false;
+}
+
+
+bool LoadChartSnapshot(MessageSequenceChart *chart, char const *sourceFilename,
+                       char const *snapshotFilename)
+{
+    ScopedStatTimer timer(STAT_TIMER_LOAD);
+
+    if (!chart->m_entities.empty() || !chart->m_arcs.empty() || chart->m_stringStorage) {
+        return false;
+    }
+
+    MappedFile *file = new MappedFile;
+    if (!file->Open(snapshotFilename) || file->GetSize() < sizeof(SnapshotHeader)) {
+        delete file;
+        return false;
+    }
+
+    SnapshotHeader const *header = (SnapshotHeader const *)file->GetData();
+    unsigned long long sourceHash = 0;
+    unsigned long long sourceSize = 0;
+    if (memcmp(header->m_magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header->m_version != SNAPSHOT_VERSION ||
+        header->m_headerSize != sizeof(SnapshotHeader) ||
+        !HashFile(sourceFilename, &sourceHash, &sourceSize) ||
+        header->m_sourceHash != sourceHash || header->m_sourceSize != sourceSize) {
+        delete file;
+        return false;
+    }
+
+    unsigned long long expectedSize = sizeof(SnapshotHeader) +
+        (unsigned long long)header->m_numEntities * sizeof(SnapshotEntity) +
+        (unsigned long long)header->m_numArcs * sizeof(SnapshotArc) +
+        (unsigned long long)header->m_numLabels * sizeof(unsigned) +
+        (unsigned long long)header->m_numStrings * sizeof(unsigned) +
+        header->m_stringPoolSize;
+    SnapshotEntity const *entities = (SnapshotEntity const *)(header + 1);
+    SnapshotArc const *arcs = (SnapshotArc const *)(entities + header->m_numEntities);
+    unsigned const *labels = (unsigned const *)(arcs + header->m_numArcs);
+    unsigned const *stringOffsets = labels + header->m_numLabels;
+    char const *pool = (char const *)(stringOffsets + header->m_numStrings);
+    if (file->GetSize() != expectedSize || header->m_numTitleLines > header->m_numLabels ||
+        (header->m_stringPoolSize > 0 && pool[header->m_stringPoolSize - 1] != '\0')) {
+        delete file;
+        return false;
+    }
+
+    // From here on, the chart owns the file. If something is wrong, Clear() frees
+    // both it and whatever has been built so far.
+    chart->m_stringStorage = file;
+    chart->m_pixelWidth = header->m_pixelWidth;
+    for (unsigned i = 0; i < header->m_numStrings; i++) {
+        if (stringOffsets[i] >= header->m_stringPoolSize) {
+            return Fail(chart);
+        }
+        chart->m_strings.AddExternal(pool + stringOffsets[i]);
+    }
+    for (unsigned i = 0; i < header->m_numLabels; i++) {
+        if (labels[i] >= header->m_numStrings) {
+            return Fail(chart);
+        }
+    }
+
+    if (header->m_pixelWidth < 40 || header->m_pixelWidth > 9000 ||
+        !GetLines(header, labels, 0, header->m_numTitleLines, &chart->m_title)) {
+        return Fail(chart);
+    }
+
+    chart->m_entities.reserve(header->m_numEntities);
+    for (unsigned i = 0; i < header->m_numEntities; i++) {
+        SnapshotEntity const &se = entities[i];
+        Entity *e = new Entity;
+        chart->m_entities.push_back(e);
+        if (se.m_name >= header->m_numStrings) {
+            return Fail(chart);
+        }
+        e->m_name = chart->m_strings.GetString(se.m_name);
+        e->m_params.m_bgColour.c = se.m_bgColour;
+        if (!GetLines(header, labels, se.m_firstLabel, se.m_numLabels, &e->m_params.m_label)) {
+            return Fail(chart);
+        }
+    }
+
+    chart->IndexEntities();
+
+    chart->m_arcs.reserve(header->m_numArcs);
+    for (unsigned i = 0; i < header->m_numArcs; i++) {
+        SnapshotArc const &sa = arcs[i];
+        Arc *a = new Arc;
+        chart->m_arcs.push_back(a);
+        // Render() and Layout() switch on the type, and don't expect anything else.
+        if (sa.m_type < Arc::TYPE_UNKNOWN || sa.m_type > Arc::TYPE_COMMENT) {
+            return Fail(chart);
+        }
+        a->m_type = sa.m_type;
+        a->m_params.m_bgColour.c = sa.m_bgColour;
+        for (int j = 0; j < 2; j++) {
+            if (sa.m_entities[j] == NO_ENTITY) {
+                a->m_entities[j] = NULL;
+            }
+            else if (sa.m_entities[j] < header->m_numEntities) {
+                a->m_entities[j] = chart->m_entities[sa.m_entities[j]];
+            }
+            else {
+                return Fail(chart);
+            }
+        }
+
+        // Arrows and boxes are drawn between two entities.
+        bool needsEntities = a->m_type == Arc::TYPE_ARROW || a->m_type == Arc::TYPE_BOX;
+        if ((needsEntities && (!a->m_entities[0] || !a->m_entities[1])) ||
+            !GetLines(header, labels, sa.m_firstLabel, sa.m_numLabels, &a->m_params.m_label)) {
+            return Fail(chart);
+        }
+    }
+
+    return true;
+}
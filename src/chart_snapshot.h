@@ -0,0 +1,24 @@
+#pragma once
+
+
+class MessageSequenceChart;
+
+
+// A snapshot is a binary copy of a parsed chart: a table of entities, an array of
+// arcs that refer to the entities by index, and a pool of the strings, each stored
+// once. Loading one maps the file into memory and points the chart's strings
+// straight into the mapping, so large charts load much faster than parsing them.
+//
+// Snapshots are only portable between builds with the same endianness and
+// SNAPSHOT_VERSION. A snapshot that doesn't match is ignored, not misread.
+
+// Writes a snapshot of chart, which must have been loaded from sourceFilename. The
+// source file is hashed, so that LoadChartSnapshot() can tell if it has changed.
+bool SaveChartSnapshot(MessageSequenceChart *chart, char const *sourceFilename,
+                       char const *snapshotFilename);
+
+// Fills in chart, which must be empty, from a snapshot. Returns false if the
+// snapshot is missing, damaged or wasn't made from the current contents of
+// sourceFilename. The chart still needs Layout() afterwards.
+bool LoadChartSnapshot(MessageSequenceChart *chart, char const *sourceFilename,
+                       char const *snapshotFilename);
@@ -0,0 +1,166 @@
+#include "chart_stream.h"
+
+// Project headers
+#include "message_sequence_chart.h"
+
+// Standard headers
+#include <string.h>
+
+
+ChartStream::ChartStream(MessageSequenceChart *chart)
+{
+    m_chart = chart;
+    m_state = STATE_START;
+    m_headerWidth = 0;
+    m_headerNumTitleLines = 0;
+    m_in = NULL;
+    m_inputEnded = false;
+}
+
+
+ChartStream::~ChartStream()
+{
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+}
+
+
+void ChartStream::Open(FILE *in)
+{
+    m_in = in;
+    m_reader = std::thread(&ChartStream::ReaderMain, this);
+}
+
+
+void ChartStream::ReaderMain()
+{
+    // fgets() returns as soon as a line arrives, where fread() would wait for the
+    // buffer to fill.
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), m_in)) {
+        {
+            std::lock_guard <std::mutex> lock(m_mutex);
+            m_pendingText += buf;
+        }
+        m_textArrived.notify_all();
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+        m_inputEnded = true;
+    }
+    m_textArrived.notify_all();
+}
+
+
+bool ChartStream::IsTextWaiting()
+{
+    if (m_state == STATE_FINISHED || m_state == STATE_FAILED) {
+        return false;
+    }
+
+    std::lock_guard <std::mutex> lock(m_mutex);
+    return m_inputEnded || m_pendingText.find('\n') != std::string::npos;
+}
+
+
+bool ChartStream::Update(bool wait, ChartError *err)
+{
+    if (m_state == STATE_FAILED) {
+        return false;
+    }
+    if (m_state == STATE_FINISHED) {
+        return true;
+    }
+
+    bool inputEnded;
+    {
+        std::unique_lock <std::mutex> lock(m_mutex);
+        if (wait && !m_tokenizer.IsStatementAvailable()) {
+            while (!m_inputEnded && m_pendingText.find('\n') == std::string::npos) {
+                m_textArrived.wait(lock);
+            }
+        }
+
+        // The tokenizer is only given whole lines, unless the input has ended
+        // part way through one.
+        inputEnded = m_inputEnded;
+        size_t len = m_pendingText.rfind('\n') + 1;    // Zero if there's no newline.
+        if (inputEnded) {
+            len = m_pendingText.size();
+        }
+        if (len > 0) {
+            m_tokenizer.Append(m_pendingText.data(), len);
+            m_pendingText.erase(0, len);
+        }
+    }
+
+    // Once the input has ended, whatever is left is parsed, so that a chart that
+    // stops part way through a statement gets the usual error.
+    while (m_state != STATE_FINISHED && (inputEnded || m_tokenizer.IsStatementAvailable())) {
+        if (!ParseNext(err)) {
+            m_state = STATE_FAILED;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool ChartStream::ParseNext(ChartError *err)
+{
+    if (m_state == STATE_START) {
+        if (!m_chart->ParseStart(&m_tokenizer, err)) {
+            return false;
+        }
+        m_state = STATE_HEADER;
+        return true;
+    }
+
+    bool finished;
+    if (!m_chart->ParseStatement(&m_tokenizer, err, &finished)) {
+        return false;
+    }
+
+    if (m_state == STATE_HEADER && (m_chart->m_entities.size() > 0 || finished)) {
+        m_chart->LayoutHeader();
+        m_headerWidth = m_chart->m_pixelWidth;
+        m_headerNumTitleLines = m_chart->m_title.size();
+        m_state = STATE_ARCS;
+    }
+
+    if (m_state == STATE_ARCS) {
+        // The header has already been drawn, so it can't change now.
+        if (m_chart->m_pixelWidth != m_headerWidth ||
+            m_chart->m_title.size() != m_headerNumTitleLines) {
+            err->m_lineNum = m_tokenizer.m_currentLineNum;
+            err->m_column = m_tokenizer.m_currentColumn;
+            strncpy(err->m_message, "The width and title must come before the entities",
+                    sizeof(err->m_message));
+            return false;
+        }
+
+        m_chart->LayoutNewArcs();
+    }
+
+    if (finished) {
+        m_state = STATE_FINISHED;
+    }
+
+    return true;
+}
+
+
+int ChartStream::GetCompleteHeight() const
+{
+    if (m_state == STATE_FINISHED) {
+        return m_chart->GetHeight();
+    }
+    if (m_state == STATE_ARCS) {
+        return m_chart->GetCompleteHeight();
+    }
+
+    return 0;
+}
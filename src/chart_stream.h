@@ -0,0 +1,76 @@
+#pragma once
+
+#include "tokenizer.h"
+
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+class MessageSequenceChart;
+struct ChartError;
+
+
+// Parses a chart while its text is still arriving, eg. from a pipe, so that it can
+// be rendered before the input has ended. The header is laid out as soon as the
+// entities have been declared, then each arc is laid out as it is parsed.
+//
+// A thread reads the input, so Update() only blocks if it is asked to. In a
+// stream, the width and title must come before the entities.
+class ChartStream
+{
+private:
+    enum {
+        STATE_START,            // Waiting for "msc {".
+        STATE_HEADER,           // Waiting for the entities.
+        STATE_ARCS,
+        STATE_FINISHED,
+        STATE_FAILED
+    };
+
+    MessageSequenceChart *m_chart;
+    Tokenizer m_tokenizer;
+    int m_state;
+    int m_headerWidth;          // m_pixelWidth when the header was laid out.
+    int m_headerNumTitleLines;
+
+    // Shared with the reader thread and protected by m_mutex.
+    FILE *m_in;
+    std::mutex m_mutex;
+    std::condition_variable m_textArrived;
+    std::string m_pendingText;  // Text not given to the tokenizer yet. Only whole lines are.
+    bool m_inputEnded;
+
+    std::thread m_reader;
+
+private:
+    void ReaderMain();
+    bool ParseNext(ChartError *err);
+
+public:
+    ChartStream(MessageSequenceChart *chart);
+
+    // Waits for the input to end.
+    ~ChartStream();
+
+    // Starts reading the chart from in, which must stay open until the input
+    // ends. The chart must be empty.
+    void Open(FILE *in);
+
+    // Parses every statement whose text has arrived and lays out the new arcs. If
+    // wait is true and there's nothing to parse, it first waits for more text or
+    // for the input to end. Returns false if the chart has an error.
+    bool Update(bool wait, ChartError *err);
+
+    // True if Update() has text to look at.
+    bool IsTextWaiting();
+
+    bool IsHeaderComplete() const { return m_state == STATE_ARCS || m_state == STATE_FINISHED; }
+    bool IsFinished() const { return m_state == STATE_FINISHED; }
+
+    // The number of rows at the top of the chart that won't change. Once the
+    // stream has finished, this is the height of the whole chart.
+    int GetCompleteHeight() const;
+};
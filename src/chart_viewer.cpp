@@ -0,0 +1,508 @@
+#include "chart_viewer.h"
+
+// Project headers
+#include "antialiased_draw.h"
+#include "message_sequence_chart.h"
+#include "mip_pyramid.h"
+#include "polygon/polygon.h"
+#include "stats.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+#include "df_window.h"
+
+// Standard headers
+#include <string.h>
+#include <algorithm>
+
+
+static DfColour const g_placeholderColour = Colour(235, 235, 235);
+static DfColour const g_scrollBarColour = Colour(160, 160, 160);
+
+
+// Box filters src down by a factor of 1 << shift in each direction into the top
+// left of dst.
+static void DownsampleBitmap(DfBitmap *src, DfBitmap *dst, int shift)
+{
+    int n = 1 << shift;
+    int dstWidth = std::min(src->width >> shift, dst->width);
+    int dstHeight = std::min(src->height >> shift, dst->height);
+
+    for (int dy = 0; dy < dstHeight; dy++) {
+        DfColour *dstRow = dst->pixels + dy * dst->width;
+        for (int dx = 0; dx < dstWidth; dx++) {
+            unsigned r = 0, g = 0, b = 0;
+            for (int sy = 0; sy < n; sy++) {
+                DfColour *srcPix = src->pixels + (dy * n + sy) * src->width + dx * n;
+                for (int sx = 0; sx < n; sx++) {
+                    r += srcPix[sx].r;
+                    g += srcPix[sx].g;
+                    b += srcPix[sx].b;
+                }
+            }
+            dstRow[dx] = Colour(r >> (shift * 2), g >> (shift * 2), b >> (shift * 2));
+        }
+    }
+}
+
+
+// Copies the top left width x src->height pixels of src to screen at (x, y),
+// clipped to the screen.
+static void BlitBand(DfBitmap *screen, int x, int y, DfBitmap *src, int width)
+{
+    int srcX = 0;
+    if (x < 0) {
+        srcX = -x;
+        width += x;
+        x = 0;
+    }
+    width = std::min(width, (int)screen->width - x);
+    if (width <= 0) {
+        return;
+    }
+
+    for (int row = 0; row < (int)src->height; row++) {
+        int screenY = y + row;
+        if (screenY < 0 || screenY >= (int)screen->height) {
+            continue;
+        }
+        memcpy(screen->pixels + screenY * screen->width + x,
+               src->pixels + row * src->width + srcX,
+               width * sizeof(DfColour));
+    }
+}
+
+
+ChartViewer::ChartViewer(MessageSequenceChart *chart, int chartWidth)
+{
+    m_chart = chart;
+    m_chartWidth = chartWidth;
+
+    // The workers render the chart concurrently, so it must be laid out up front.
+    m_chart->Layout();
+    m_chartHeight = m_chart->GetHeight();
+
+    m_scrollY = 0;
+    m_zoomShift = 0;
+    m_frameNum = 0;
+    m_maxBands = 16;
+    m_quit = false;
+    m_paused = false;
+    m_numRendering = 0;
+    m_followEnd = false;
+    m_pyramid = NULL;
+
+    int numWorkers = std::thread::hardware_concurrency() - 1;
+    numWorkers = std::max(1, std::min(numWorkers, 4));
+    for (int i = 0; i < numWorkers; i++) {
+        m_workers.push_back(std::thread(&ChartViewer::WorkerMain, this));
+    }
+}
+
+
+ChartViewer::~ChartViewer()
+{
+    delete m_pyramid;
+
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_workAvailable.notify_all();
+    for (int i = 0; i < m_workers.size(); i++) {
+        m_workers[i].join();
+    }
+
+    for (int i = 0; i < m_bands.size(); i++) {
+        BitmapDelete(m_bands[i]->m_bmp);
+        if (m_bands[i]->m_newBmp) {
+            BitmapDelete(m_bands[i]->m_newBmp);
+        }
+        delete m_bands[i];
+    }
+    for (int i = 0; i < m_freeBitmaps.size(); i++) {
+        BitmapDelete(m_freeBitmaps[i]);
+    }
+}
+
+
+void ChartViewer::WorkerMain()
+{
+    // Each worker needs its own polygon filler and scratch bitmap.
+    AntialiasedDraw aaDraw;
+    DfBitmap *scratch = NULL;
+    aaDraw.SetTimingEnabled(g_statsEnabled);
+    aaDraw.SetLinearBlending(g_linearBlending);
+
+    std::unique_lock <std::mutex> lock(m_mutex);
+    while (1) {
+        while (!m_quit && (m_paused || m_queue.empty())) {
+            m_workAvailable.wait(lock);
+        }
+        if (m_quit) {
+            break;
+        }
+
+        ChartBand *band = m_queue.front();
+        m_queue.pop_front();
+        band->m_state = ChartBand::STATE_RENDERING;
+        m_numRendering++;
+
+        // A stale band is still on the screen, so it is rendered into another bitmap.
+        DfBitmap *target = band->m_bmp;
+        if (band->m_stale) {
+            if (m_freeBitmaps.size() > 0) {
+                target = m_freeBitmaps.back();
+                m_freeBitmaps.pop_back();
+            }
+            else {
+                target = BitmapCreate(m_chartWidth, BAND_HEIGHT);
+            }
+        }
+
+        lock.unlock();
+        RenderBand(band, target, &aaDraw, &scratch);
+        lock.lock();
+
+        if (band->m_stale) {
+            if (band->m_newBmp) {
+                m_freeBitmaps.push_back(band->m_newBmp);
+            }
+            band->m_newBmp = target;
+        }
+        band->m_state = ChartBand::STATE_READY;
+        m_numRendering--;
+        m_bandRendered.notify_all();
+    }
+
+    if (scratch) {
+        BitmapDelete(scratch);
+    }
+
+    if (g_statsEnabled) {
+        StatsAddFillerStats(aaDraw.GetFillerStats());
+    }
+}
+
+
+// Called on a worker thread without the lock held. The main thread won't touch the
+// band while it is in STATE_RENDERING.
+void ChartViewer::RenderBand(ChartBand *band, DfBitmap *target, AntialiasedDraw *aaDraw,
+                             DfBitmap **scratch)
+{
+    int chartRows = BAND_HEIGHT << band->m_zoomShift;
+    DfBitmap *bandBmp = target;
+    RenderContext ctx(aaDraw);
+
+    if (band->m_zoomShift >= LOD_ZOOM_SHIFT) {
+        BitmapClear(target, g_colourWhite);
+        m_chart->RenderZoomedOut(target, band->m_index * chartRows, band->m_zoomShift, &ctx);
+        return;
+    }
+
+    if (band->m_zoomShift > 0) {
+        // Render at full resolution then scale down.
+        if (*scratch && (*scratch)->height != chartRows) {
+            BitmapDelete(*scratch);
+            *scratch = NULL;
+        }
+        if (!*scratch) {
+            *scratch = BitmapCreate(m_chartWidth, chartRows);
+        }
+        target = *scratch;
+    }
+
+    BitmapClear(target, g_colourWhite);
+    m_chart->Render(target, band->m_index * chartRows, &ctx);
+
+    if (band->m_zoomShift > 0) {
+        DownsampleBitmap(*scratch, bandBmp, band->m_zoomShift);
+    }
+}
+
+
+// Must be called with the lock held.
+ChartBand *ChartViewer::FindBand(int index, int zoomShift)
+{
+    for (int i = 0; i < m_bands.size(); i++) {
+        ChartBand *band = m_bands[i];
+        if (band->m_index == index && band->m_zoomShift == zoomShift) {
+            return band;
+        }
+    }
+
+    return NULL;
+}
+
+
+// Returns the band at the current zoom level, creating it and queuing it for
+// rendering if it isn't in the cache. Returns NULL if the band is off the end of
+// the chart. Must be called with the lock held.
+ChartBand *ChartViewer::RequestBand(int index)
+{
+    if (index < 0 || (index * BAND_HEIGHT << m_zoomShift) >= m_chartHeight) {
+        return NULL;
+    }
+
+    ChartBand *band = FindBand(index, m_zoomShift);
+    if (!band) {
+        band = new ChartBand;
+        band->m_index = index;
+        band->m_zoomShift = m_zoomShift;
+        band->m_state = ChartBand::STATE_QUEUED;
+        band->m_stale = false;
+        band->m_newBmp = NULL;
+        if (m_freeBitmaps.size() > 0) {
+            band->m_bmp = m_freeBitmaps.back();
+            m_freeBitmaps.pop_back();
+        }
+        else {
+            band->m_bmp = BitmapCreate(m_chartWidth, BAND_HEIGHT);
+        }
+        m_bands.push_back(band);
+    }
+
+    if (band->m_state == ChartBand::STATE_QUEUED) {
+        m_queue.push_back(band);
+    }
+
+    band->m_lastUsedFrame = m_frameNum;
+    return band;
+}
+
+
+// Throws away the least recently used bands until the cache is back within its
+// limit. Bands that are being rendered or were requested this frame are kept.
+// Must be called with the lock held.
+void ChartViewer::EvictBands()
+{
+    while (m_bands.size() > m_maxBands) {
+        int victim = -1;
+        for (int i = 0; i < m_bands.size(); i++) {
+            ChartBand *band = m_bands[i];
+            if (band->m_state == ChartBand::STATE_RENDERING || band->m_lastUsedFrame == m_frameNum) {
+                continue;
+            }
+            if (victim < 0 || band->m_lastUsedFrame < m_bands[victim]->m_lastUsedFrame) {
+                victim = i;
+            }
+        }
+
+        if (victim < 0) {
+            break;
+        }
+
+        ChartBand *band = m_bands[victim];
+        m_bands.erase(m_bands.begin() + victim);
+        m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), band), m_queue.end());
+        m_freeBitmaps.push_back(band->m_bmp);
+        if (band->m_newBmp) {
+            m_freeBitmaps.push_back(band->m_newBmp);
+        }
+        delete band;
+    }
+
+    // Keep a few spare bitmaps for the next bands, but not an unbounded number.
+    while (m_freeBitmaps.size() > 4) {
+        BitmapDelete(m_freeBitmaps.back());
+        m_freeBitmaps.pop_back();
+    }
+}
+
+
+void ChartViewer::PauseRendering()
+{
+    std::unique_lock <std::mutex> lock(m_mutex);
+    m_paused = true;
+    while (m_numRendering > 0) {
+        m_bandRendered.wait(lock);
+    }
+}
+
+
+void ChartViewer::ChartChanged(int completeHeight)
+{
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+
+        // Bands that reach below the old complete height have to be rendered again.
+        for (int i = 0; i < m_bands.size(); i++) {
+            ChartBand *band = m_bands[i];
+            int bandBottom = (band->m_index + 1) * BAND_HEIGHT << band->m_zoomShift;
+            if (bandBottom > m_chartHeight && band->m_state == ChartBand::STATE_READY) {
+                band->m_state = ChartBand::STATE_QUEUED;
+                band->m_stale = true;
+            }
+        }
+
+        m_chartHeight = completeHeight;
+        m_paused = false;
+    }
+    m_workAvailable.notify_all();
+
+    if (m_followEnd) {
+        m_scrollY = m_chartHeight;
+    }
+}
+
+
+void ChartViewer::StartPyramid(long long budgetBytes)
+{
+    if (!m_pyramid) {
+        m_pyramid = new MipPyramid(m_chart, MAX_ZOOM_SHIFT, budgetBytes);
+    }
+}
+
+
+// Returns the number of chart rows that fit on the screen at the current zoom.
+int ChartViewer::GetVisibleHeight(DfBitmap *screen) const
+{
+    return screen->height << m_zoomShift;
+}
+
+
+void ChartViewer::ClampScroll(DfBitmap *screen)
+{
+    int maxScroll = std::max(0, m_chartHeight - GetVisibleHeight(screen));
+    m_scrollY = std::max(0, std::min(m_scrollY, maxScroll));
+    m_followEnd = m_scrollY == maxScroll;
+}
+
+
+void ChartViewer::Advance(DfBitmap *screen)
+{
+    int lineStep = 40 << m_zoomShift;
+    int pageStep = GetVisibleHeight(screen) - lineStep;
+
+    if (g_input.keys[KEY_UP]) {
+        m_scrollY -= lineStep;
+    }
+    if (g_input.keys[KEY_DOWN]) {
+        m_scrollY += lineStep;
+    }
+    if (g_input.keyDowns[KEY_PGUP]) {
+        m_scrollY -= pageStep;
+    }
+    if (g_input.keyDowns[KEY_PGDN]) {
+        m_scrollY += pageStep;
+    }
+    if (g_input.keyDowns[KEY_HOME]) {
+        m_scrollY = 0;
+    }
+    if (g_input.keyDowns[KEY_END]) {
+        m_scrollY = m_chartHeight;
+    }
+
+    // Mouse wheel scrolls and dragging with the left button pans.
+    m_scrollY -= g_input.mouseVelZ * lineStep * 3;
+    if (g_input.lmb) {
+        m_scrollY -= g_input.mouseVelY * (1 << m_zoomShift);
+    }
+
+    // Zoom about the middle of the window.
+    int newZoomShift = m_zoomShift;
+    if (g_input.keyDowns[KEY_MINUS] && m_zoomShift < MAX_ZOOM_SHIFT) {
+        newZoomShift++;
+    }
+    if (g_input.keyDowns[KEY_EQUALS] && m_zoomShift > 0) {
+        newZoomShift--;
+    }
+    if (newZoomShift != m_zoomShift) {
+        int centreY = m_scrollY + GetVisibleHeight(screen) / 2;
+        m_zoomShift = newZoomShift;
+        m_scrollY = centreY - GetVisibleHeight(screen) / 2;
+    }
+
+    ClampScroll(screen);
+}
+
+
+void ChartViewer::DrawScrollBar(DfBitmap *screen)
+{
+    int visibleHeight = GetVisibleHeight(screen);
+    if (m_chartHeight <= visibleHeight) {
+        return;
+    }
+
+    int trackHeight = screen->height;
+    int thumbY = (long long)m_scrollY * trackHeight / m_chartHeight;
+    int thumbHeight = (long long)visibleHeight * trackHeight / m_chartHeight;
+    thumbHeight = std::max(thumbHeight, 20);
+    RectFill(screen, screen->width - 8, thumbY, 6, thumbHeight, g_scrollBarColour);
+}
+
+
+void ChartViewer::Draw(DfBitmap *screen)
+{
+    m_frameNum++;
+    ClampScroll(screen);
+
+    int bandWidth = m_chartWidth >> m_zoomShift;
+    int x = ((int)screen->width - bandWidth) / 2;
+    int screenTop = m_scrollY >> m_zoomShift;
+    int firstBand = screenTop / BAND_HEIGHT;
+    int lastBand = (screenTop + screen->height - 1) / BAND_HEIGHT;
+    int numVisible = lastBand - firstBand + 1;
+
+    // Enough for a screen's worth of bands either side of the visible ones.
+    m_maxBands = numVisible * 3 + 2;
+
+    std::vector <ChartBand *> visible;
+    std::vector <bool> ready;
+    bool haveWork;
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+
+        // The queue is rebuilt every frame, so bands that have scrolled out of
+        // view before a worker got to them don't hold up the ones now in view.
+        // Visible bands go first, then their neighbours, nearest first, so that
+        // they are ready by the time the user scrolls to them.
+        m_queue.clear();
+        for (int i = firstBand; i <= lastBand; i++) {
+            visible.push_back(RequestBand(i));
+        }
+        for (int i = 1; i <= numVisible; i++) {
+            RequestBand(lastBand + i);
+            RequestBand(firstBand - i);
+        }
+
+        EvictBands();
+
+        for (int i = 0; i < visible.size(); i++) {
+            ChartBand *band = visible[i];
+            if (band && band->m_state == ChartBand::STATE_READY && band->m_newBmp) {
+                m_freeBitmaps.push_back(band->m_bmp);
+                band->m_bmp = band->m_newBmp;
+                band->m_newBmp = NULL;
+                band->m_stale = false;
+            }
+            ready.push_back(band && (band->m_state == ChartBand::STATE_READY || band->m_stale));
+        }
+        haveWork = !m_queue.empty();
+    }
+
+    if (haveWork) {
+        m_workAvailable.notify_all();
+    }
+
+    if (m_pyramid) {
+        m_pyramid->SetFocus(m_scrollY + GetVisibleHeight(screen) / 2);
+    }
+
+    BitmapClear(screen, g_colourWhite);
+    for (int i = 0; i < visible.size(); i++) {
+        if (!visible[i]) {
+            continue;
+        }
+
+        int y = visible[i]->m_index * BAND_HEIGHT - screenTop;
+        if (ready[i]) {
+            BlitBand(screen, x, y, visible[i]->m_bmp, bandWidth);
+        }
+        else if (!m_pyramid || !m_pyramid->BlitTile(screen, x, y, m_zoomShift, visible[i]->m_index)) {
+            RectFill(screen, x, y, bandWidth, BAND_HEIGHT, g_placeholderColour);
+        }
+    }
+
+    DrawScrollBar(screen);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "df_bitmap.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class AntialiasedDraw;
+class MessageSequenceChart;
+class MipPyramid;
+
+
+// A horizontal strip of the chart, pre-rendered at one zoom level.
+struct ChartBand
+{
+    enum {
+        STATE_QUEUED,
+        STATE_RENDERING,
+        STATE_READY
+    };
+
+    int m_index;            // Band number, counting down from the top of the chart at this zoom.
+    int m_zoomShift;
+    int m_state;
+    unsigned m_lastUsedFrame;
+    DfBitmap *m_bmp;
+
+    // Set when the chart has grown since the band was rendered. It is still drawn
+    // while it is rendered again, into m_newBmp, which the main thread swaps in.
+    bool m_stale;
+    DfBitmap *m_newBmp;
+};
+
+
+// Displays a chart that may be much taller than the window. The chart is split
+// into bands of BAND_HEIGHT screen rows. Bands around the viewport are rendered
+// by background threads and kept in a cache, so a frame only has to blit the
+// bands that are already there. Bands that aren't ready yet are drawn as grey
+// placeholders until a worker gets to them.
+class ChartViewer
+{
+public:
+    enum {
+        BAND_HEIGHT = 256,
+        MAX_ZOOM_SHIFT = 4,     // Zoomed out to 1/16th.
+        LOD_ZOOM_SHIFT = 2      // Text can't be read from here out, see RenderZoomedOut().
+    };
+
+private:
+    MessageSequenceChart *m_chart;
+    int m_chartWidth;
+    int m_chartHeight;
+
+    int m_scrollY;          // Chart Y coordinate of the top of the window.
+    int m_zoomShift;        // The chart is drawn scaled down by 1 << m_zoomShift.
+    unsigned m_frameNum;
+
+    // Everything below is shared with the worker threads and protected by m_mutex.
+    // Only the main thread adds or removes bands or changes their m_bmp, so it can
+    // read the bitmap of a ready or stale band without holding the lock.
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::vector <ChartBand *> m_bands;
+    std::deque <ChartBand *> m_queue;   // Bands waiting for a worker, most urgent first.
+    std::vector <DfBitmap *> m_freeBitmaps;
+    unsigned m_maxBands;
+    bool m_quit;
+    bool m_paused;          // Set by PauseRendering(). Workers don't start new bands.
+    int m_numRendering;     // Bands the workers are rendering right now.
+    std::condition_variable m_bandRendered;
+    bool m_followEnd;       // Scrolled to the end, so stay there if the chart grows.
+
+    std::vector <std::thread> m_workers;
+
+    MipPyramid *m_pyramid;  // NULL unless StartPyramid() has been called.
+
+private:
+    void WorkerMain();
+    void RenderBand(ChartBand *band, DfBitmap *target, AntialiasedDraw *aaDraw, DfBitmap **scratch);
+
+    ChartBand *FindBand(int index, int zoomShift);
+    ChartBand *RequestBand(int index);
+    void EvictBands();
+
+    int GetVisibleHeight(DfBitmap *screen) const;
+    void ClampScroll(DfBitmap *screen);
+    void DrawScrollBar(DfBitmap *screen);
+
+public:
+    ChartViewer(MessageSequenceChart *chart, int chartWidth);
+    ~ChartViewer();
+
+    // For a chart that is still being parsed, see ChartStream. Call
+    // PauseRendering() before changing the chart, which waits for the workers to
+    // stop rendering it, then ChartChanged() with the number of rows at the top of
+    // the chart that are complete. Bands that showed incomplete rows are redrawn.
+    void PauseRendering();
+    void ChartChanged(int completeHeight);
+
+    // Starts building a MipPyramid of the chart in the background, using at most
+    // budgetBytes of memory. Bands at a new zoom that aren't ready yet are then
+    // drawn from its tiles, rather than as placeholders. Only for a chart that is
+    // complete, as the pyramid isn't rebuilt if the chart changes.
+    void StartPyramid(long long budgetBytes);
+
+    // Handles the scrolling and zooming keys and mouse.
+    void Advance(DfBitmap *screen);
+
+    void Draw(DfBitmap *screen);
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "df_bitmap.h"
+#include "df_colour.h"
+
+
+struct PolygonTarget;
+
+
+// Puts coverage masks on a bitmap. A PolygonFiller drawing onto a
+// POLYGON_FORMAT_COVERAGE8 target only records how much of each pixel its
+// polygons cover, so a mask doesn't depend on what is under it. Layers of a
+// picture can therefore be rasterised at the same time, each into its own mask
+// with its own PolygonFiller, and composited in order on one thread afterwards.
+//
+// Blends colour over the pixels of bmp, weighted by the coverage in mask, which
+// must be in the range 0 to SUBPIXEL_COUNT. The top left corner of the mask goes
+// at (x, y), and the mask is clipped to the bitmap. The result is the same as
+// drawing the polygons in the mask onto bmp directly, as long as no two of them
+// touch the same pixel and the filler they would have been drawn with doesn't
+// have SetLinearBlending(true). Only the sRGB blend is done here, so edges
+// composited from a mask don't match linear-light edges. Uses SSE2 where the
+// compiler targets it.
+void CompositeCoverage(DfBitmap *bmp, int x, int y, PolygonTarget const &mask, DfColour colour);
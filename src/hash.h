@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+
+// Fast and simple, but not cryptographic. Good for spotting that a file has
+// changed, not for anything an attacker controls. Mostly FNV-1a, but eight bytes
+// at a time, with a shift to mix the high bits of each product back into the low
+// ones, because multiplying alone only carries changes upwards.
+
+#define HASH_INITIAL_VALUE 0xcbf29ce484222325ULL
+
+
+inline unsigned long long HashBytes(unsigned long long h, void const *data, size_t len)
+{
+    unsigned long long const prime = 0x100000001b3ULL;
+    unsigned char const *bytes = (unsigned char const *)data;
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long word;
+        memcpy(&word, bytes + i, 8);
+        h = (h ^ word) * prime;
+        h ^= h >> 29;
+    }
+
+    for (; i < len; i++) {
+        h = (h ^ bytes[i]) * prime;
+    }
+
+    return h;
+}
@@ -4,10 +4,15 @@
 // Standard headers
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Deadfrog headers
 #include "fonts/df_mono.h"
-#include "df_bmp.h"
 #include "df_font.h"
 #include "df_message_dialog.h"
 #include "df_time.h"
@@ -15,12 +20,22 @@
 
 // Project headers
 #include "antialiased_draw.h"
+#include "arc_collapse.h"
+#include "chart_snapshot.h"
+#include "chart_stream.h"
+#include "chart_viewer.h"
 #include "message_sequence_chart.h"
+#include "polygon/polygon.h"
+#include "portability.h"
+#include "render_cache.h"
+#include "stats.h"
+#include "streamed_render.h"
 #include "tokenizer.h"
 #include "vector2.h"
 
 
 #define APP_NAME "Chart Chisel"
+#define OUTPUT_BAND_HEIGHT 256
 
 
 bool g_interactiveMode = true;
@@ -49,72 +64,398 @@ void FatalError(char const *fmt, ...)
 
 void PrintUsageAndExit()
 {
-    puts("Usage: " APP_NAME " <mode> <input filename>");
+    puts("Usage: " APP_NAME " [options] <mode> <input filename>");
+    puts("       " APP_NAME " [options] check <input filename>...");
     puts("");
     puts("Creates a message sequence chart as a PNG file.");
     puts("");
-    puts("Where mode is either:");
+    puts("Where mode is one of:");
     puts("  batch       - Generates the output PNG and immediately exits.");
     puts("  interactive - Generates the output PNG and displays it.");
+    puts("  check       - Only parses the charts, without rendering anything, and");
+    puts("                prints every error found as <filename>:<line>:<column>:");
+    puts("                <message>. The exit code is 1 if there were any.");
+    puts("");
+    puts("If the input filename is '-', the chart is read from stdin and drawn as it");
+    puts("arrives. In batch mode it is written to the output a band at a time, and in");
+    puts("interactive mode it is displayed without writing any output.");
+    puts("");
+    puts("Options:");
+    puts("  --output <file>");
+    puts("               - Where to write the output. By default it is the input");
+    puts("                 filename with the extension changed. Needed in batch mode");
+    puts("                 if the input is stdin.");
+    puts("  --stats      - Prints timings and counters for each phase on exit.");
+    puts("  --stats-json - As --stats, but as JSON.");
+    puts("  --snapshot   - Saves the parsed chart next to the input file, as");
+    puts("                 <input filename>.snap, and loads that instead of parsing");
+    puts("                 the chart next time, if the chart hasn't changed.");
+    puts("  --cache-dir <dir>");
+    puts("               - Keeps rendered charts in dir and reuses them if the chart");
+    puts("                 hasn't changed.");
+    puts("  --cache-max-mb <n>");
+    puts("               - Size limit of the cache. Default 256.");
+    puts("  --collapse <n>");
+    puts("               - Replaces each run of n or more copies of the same arcs,");
+    puts("                 where only the numbers in their labels differ, by the");
+    puts("                 first copy and a \"...\" row saying how many there were.");
+    puts("  --page-height <n>");
+    puts("               - Splits the output into pages of at most n rows, each in");
+    puts("                 its own file, named like <output>_01.bmp. The numbers are");
+    puts("                 padded to the same width, so that the files sort in page");
+    puts("                 order. The entity names are repeated at the top of each");
+    puts("                 page. The render cache isn't used.");
+    puts("  --mip-cache-mb <n>");
+    puts("               - In interactive mode, builds scaled down copies of the");
+    puts("                 chart in the background, in at most n MB, so that zooming");
+    puts("                 out shows them straight away.");
+    puts("  --linear-blend");
+    puts("               - Blends the antialiased edges of arrows and ellipses in");
+    puts("                 linear light, so thin diagonal lines keep their weight.");
     exit(0);
 }
 
 
+static void ReportChartError(ChartError const &err)
+{
+    if (err.m_lineNum > 0) {
+        FatalError("Line %d, column %d\n\n%s", err.m_lineNum, err.m_column, err.m_message);
+    }
+    FatalError("%s", err.m_message);
+}
+
+
+static void CheckChartsThread(char **filenames, int numFilenames, int first, int step,
+                              std::vector <ChartError> *errors)
+{
+    for (int i = first; i < numFilenames; i += step) {
+        MessageSequenceChart msc;
+        msc.m_maxParseThreads = 1;
+        msc.Check(filenames[i], &errors[i]);
+    }
+}
+
+
+// Parses each chart and prints all of the errors in it. No font is loaded and
+// nothing is laid out, so this is quick enough to run over thousands of charts.
+// The charts are shared between one thread per core, and the errors are printed
+// in the order the charts were named. Returns the number of errors.
+static int CheckCharts(char **filenames, int numFilenames)
+{
+    std::vector <ChartError> *errors = new std::vector <ChartError> [numFilenames];
+
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency(), numFilenames));
+    std::vector <std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.push_back(std::thread(CheckChartsThread, filenames, numFilenames, i, numThreads, errors));
+    }
+    CheckChartsThread(filenames, numFilenames, 0, numThreads, errors);
+    for (int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    int numErrors = 0;
+    for (int i = 0; i < numFilenames; i++) {
+        for (int j = 0; j < errors[i].size(); j++) {
+            ChartError const &err = errors[i][j];
+            if (err.m_lineNum > 0) {
+                printf("%s:%d:%d: %s\n", filenames[i], err.m_lineNum, err.m_column, err.m_message);
+            }
+            else {
+                printf("%s: %s\n", filenames[i], err.m_message);
+            }
+        }
+        numErrors += errors[i].size();
+    }
+
+    delete[] errors;
+    return numErrors;
+}
+
+
+static void PrintStats(bool json)
+{
+    if (g_antialiasedDraw) {
+        StatsAddFillerStats(g_antialiasedDraw->GetFillerStats());
+    }
+    if (json) {
+        StatsPrintJson(stdout);
+    }
+    else {
+        StatsPrint(stdout);
+    }
+}
+
+
+// Displays the chart until the user closes the window. If stream isn't NULL, the
+// chart is still being parsed, and grows as the stream is read. If mipCacheMb
+// isn't zero, the viewer builds a MipPyramid of the chart, which must be complete.
+static void DisplayChart(MessageSequenceChart *msc, ChartStream *stream, int mipCacheMb)
+{
+    // Setup the window
+    int width, height;
+    GetDesktopRes(&width, &height);
+    CreateWin(std::min(msc->GetWidth(), width - 100), height - 100, WT_WINDOWED, APP_NAME);
+    DfBitmap *screen = g_window->bmp;
+    BitmapClear(screen, g_colourWhite);
+
+    // The viewer renders the chart in bands on background threads, so the
+    // frame rate doesn't depend on the size of the chart.
+    ChartViewer viewer(msc, msc->GetWidth());
+    if (stream) {
+        viewer.ChartChanged(stream->GetCompleteHeight());
+    }
+    if (mipCacheMb > 0) {
+        viewer.StartPyramid((long long)mipCacheMb * 1024 * 1024);
+    }
+
+    // Continue to display the window until the user presses escape or clicks the close icon
+    while (!g_window->windowClosed && !g_input.keys[KEY_ESC])
+    {
+        InputPoll();
+
+        if (stream && stream->IsTextWaiting()) {
+            viewer.PauseRendering();
+            ChartError err;
+            bool ok = stream->Update(false, &err);
+            viewer.ChartChanged(stream->GetCompleteHeight());
+            if (!ok) {
+                ReportChartError(err);
+            }
+        }
+
+        viewer.Advance(screen);
+        viewer.Draw(screen);
+        UpdateWin();
+        WaitVsync();
+    }
+}
+
+
 int main(int argc, char *argv[])
 {
 //     char *filename = "../../message_sequence_charts/hello.msc";
 //     g_interactiveMode = false;
-    char *filename = "../../message_sequence_charts/add_with_data.msc";
-    if (argc != 3) {
+    char const *filename = "../../message_sequence_charts/add_with_data.msc";
+
+    // Options come before the mode.
+    enum { STATS_OFF, STATS_TEXT, STATS_JSON } statsFormat = STATS_OFF;
+    bool useSnapshot = false;
+    char const *cacheDir = NULL;
+    int cacheMaxMb = 256;
+    char const *outputOption = NULL;
+    int pageHeight = 0;
+    int collapseRepeats = 0;
+    int mipCacheMb = 0;
+    char const *wholeChartOption = NULL;    // An option that needs the whole chart up front.
+    int argIndex = 1;
+    while (argIndex < argc && strncmp(argv[argIndex], "--", 2) == 0) {
+        bool hasValue = argIndex + 1 < argc;
+        if (stricmp(argv[argIndex], "--stats") == 0) {
+            statsFormat = STATS_TEXT;
+        }
+        else if (stricmp(argv[argIndex], "--stats-json") == 0) {
+            statsFormat = STATS_JSON;
+        }
+        else if (stricmp(argv[argIndex], "--snapshot") == 0) {
+            useSnapshot = true;
+        }
+        else if (stricmp(argv[argIndex], "--cache-dir") == 0 && hasValue) {
+            cacheDir = argv[++argIndex];
+        }
+        else if (stricmp(argv[argIndex], "--cache-max-mb") == 0 && hasValue) {
+            cacheMaxMb = atoi(argv[++argIndex]);
+        }
+        else if (stricmp(argv[argIndex], "--output") == 0 && hasValue) {
+            outputOption = argv[++argIndex];
+        }
+        else if (stricmp(argv[argIndex], "--collapse") == 0 && hasValue) {
+            collapseRepeats = atoi(argv[++argIndex]);
+            if (collapseRepeats < 2) {
+                printf("Invalid number of repeats '%s'. It must be at least 2\n", argv[argIndex]);
+                return -1;
+            }
+            wholeChartOption = "--collapse";
+        }
+        else if (stricmp(argv[argIndex], "--page-height") == 0 && hasValue) {
+            pageHeight = atoi(argv[++argIndex]);
+            if (pageHeight <= 0) {
+                printf("Invalid page height '%s'\n", argv[argIndex]);
+                return -1;
+            }
+            wholeChartOption = "--page-height";
+        }
+        else if (stricmp(argv[argIndex], "--linear-blend") == 0) {
+            g_linearBlending = true;
+        }
+        else if (stricmp(argv[argIndex], "--mip-cache-mb") == 0 && hasValue) {
+            mipCacheMb = atoi(argv[++argIndex]);
+            if (mipCacheMb <= 0) {
+                printf("Invalid cache size '%s'\n", argv[argIndex]);
+                return -1;
+            }
+            wholeChartOption = "--mip-cache-mb";
+        }
+        else {
+            printf("Unrecognized option '%s'\n", argv[argIndex]);
+            return -1;
+        }
+        argIndex++;
+    }
+
+    if (argc - argIndex < 2) {
         PrintUsageAndExit();
     }
 
-    if (stricmp(argv[1], "batch") == 0) {
+    char const *mode = argv[argIndex];
+    g_statsEnabled = statsFormat != STATS_OFF;
+    if (stricmp(mode, "check") == 0) {
         g_interactiveMode = false;
+        int numErrors = CheckCharts(argv + argIndex + 1, argc - argIndex - 1);
+        if (g_statsEnabled) {
+            PrintStats(statsFormat == STATS_JSON);
+        }
+        return numErrors > 0 ? 1 : 0;
+    }
+
+    if (argc - argIndex != 2) {
+        PrintUsageAndExit();
     }
-    else if (stricmp(argv[1], "interactive") != 0) {
-        printf("Unrecognized mode '%s'\n", argv[1]);
+
+    if (stricmp(mode, "batch") == 0) {
+        g_interactiveMode = false;
+    }
+    else if (stricmp(mode, "interactive") != 0) {
+        printf("Unrecognized mode '%s'\n", mode);
         return -1;
     }
-    filename = argv[2];
+    filename = argv[argIndex + 1];
 
     g_defaultFont = LoadFontFromMemory(deadfrog_mono_7x13, sizeof(deadfrog_mono_7x13));
     g_antialiasedDraw = new AntialiasedDraw;
+    g_antialiasedDraw->SetTimingEnabled(g_statsEnabled);
+    g_antialiasedDraw->SetLinearBlending(g_linearBlending);
+
+    bool fromStdin = strcmp(filename, "-") == 0;
+    char *outputFilename = NULL;
+    if (outputOption) {
+        outputFilename = strdup(outputOption);
+    }
+    else if (!fromStdin) {
+        outputFilename = strdup(filename);
+        int len = strlen(outputFilename);
+        memcpy(outputFilename + len - 4, ".bmp", 4);
+    }
+    else if (!g_interactiveMode) {
+        puts("--output is needed when the input is stdin");
+        return -1;
+    }
+
+    if (fromStdin && wholeChartOption) {
+        printf("%s can't be used when the input is stdin\n", wholeChartOption);
+        return -1;
+    }
 
     MessageSequenceChart msc;
-    msc.Load(filename);
 
-    DfBitmap *bmp = NULL;
-    if (g_interactiveMode) {
-        // Setup the window
-        int width, height;
-        GetDesktopRes(&width, &height);
-        CreateWin(1200, height - 100, WT_WINDOWED, APP_NAME);
-        bmp = g_window->bmp;
-        BitmapClear(bmp, g_colourWhite);
-
-        // Continue to display the window until the user presses escape or clicks the close icon
-        double lastTime = GetRealTime();
-        while (!g_window->windowClosed && !g_input.keys[KEY_ESC])
-        {
-            InputPoll();
-            BitmapClear(bmp, g_colourWhite);
-            msc.Render(bmp);
-            UpdateWin();
-            WaitVsync();
+    if (fromStdin) {
+        // The chart is rendered as it arrives, so snapshots and the cache don't apply.
+        ChartStream *stream = new ChartStream(&msc);
+        stream->Open(stdin);
+
+        if (g_interactiveMode) {
+            // The window can't be opened until the chart's width is known.
+            ChartError err;
+            while (!stream->IsHeaderComplete()) {
+                if (!stream->Update(true, &err)) {
+                    ReportChartError(err);
+                }
+            }
+            DisplayChart(&msc, stream, 0);
+        }
+        else {
+            // As below, the old output might be a hard link to a cache entry.
+            remove(outputFilename);
+
+            ChartError err;
+            if (!RenderChartStreamToBmpFile(&msc, stream, OUTPUT_BAND_HEIGHT, outputFilename, &err)) {
+                if (err.m_message[0] == '\0') {
+                    FatalError("Couldn't write output to '%s'", outputFilename);
+                }
+                ReportChartError(err);
+            }
+        }
+
+        // If the window was closed before the input ended, the stream's reader
+        // thread is still waiting for input, so the stream can't be deleted.
+        if (stream->IsFinished()) {
+            delete stream;
         }
     }
     else {
-        bmp = BitmapCreate(1300, 1600);
-        BitmapClear(bmp, g_colourWhite);
-        msc.Render(bmp);
+        // On a cache hit there's no need to parse or render the chart, unless it is
+        // going to be displayed.
+        RenderCache *cache = NULL;
+        std::string cacheKey;
+        bool cacheHit = false;
+        if (cacheDir && pageHeight == 0) {
+            cache = new RenderCache(cacheDir, (long long)cacheMaxMb * 1024 * 1024);
+            char options[64];
+            sprintf(options, "format=bmp collapse=%d linear=%d", collapseRepeats, (int)g_linearBlending);
+            if (RenderCache::MakeKey(filename, options, &cacheKey)) {
+                cacheHit = cache->Fetch(cacheKey, outputFilename);
+            }
+        }
+
+        if (!cacheHit || g_interactiveMode) {
+            std::string snapshotFilename = std::string(filename) + ".snap";
+            if (!useSnapshot || !LoadChartSnapshot(&msc, filename, snapshotFilename.c_str())) {
+                ChartError err;
+                if (!msc.Load(filename, &err)) {
+                    ReportChartError(err);
+                }
+
+                if (useSnapshot) {
+                    SaveChartSnapshot(&msc, filename, snapshotFilename.c_str());
+                }
+            }
+
+            // After the snapshot, so that it holds the whole chart.
+            if (collapseRepeats > 0) {
+                CollapseRepeatedArcs(&msc, collapseRepeats);
+            }
+            msc.Layout();
+        }
+
+        if (pageHeight > 0) {
+            if (!RenderChartPagesToBmpFiles(&msc, pageHeight, outputFilename)) {
+                FatalError("Couldn't write the pages of '%s'", outputFilename);
+            }
+        }
+        else if (!cacheHit) {
+            // The old output might be a hard link to a cache entry, so it mustn't be
+            // overwritten in place.
+            remove(outputFilename);
+
+            // Render the output a band at a time, so that a huge chart doesn't need a
+            // huge bitmap. The image is exactly the size of the chart.
+            if (!RenderChartToBmpFile(&msc, msc.GetWidth(), msc.GetHeight(), OUTPUT_BAND_HEIGHT, outputFilename)) {
+                FatalError("Couldn't write output to '%s'", outputFilename);
+            }
+
+            if (cache && !cacheKey.empty()) {
+                cache->Store(cacheKey, outputFilename);
+            }
+        }
+        delete cache;
+
+        if (g_interactiveMode) {
+            DisplayChart(&msc, NULL, mipCacheMb);
+        }
     }
 
-    char *outputFilename = strdup(filename);
-    int len = strlen(outputFilename);
-    memcpy(outputFilename + len - 4, ".bmp", 4);
-    if (!SaveBmp(bmp, outputFilename)) {
-        FatalError("Couldn't write output to '%s'", outputFilename);
+    if (g_statsEnabled) {
+        PrintStats(statsFormat == STATS_JSON);
     }
 
     return 0;
@@ -0,0 +1,123 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile()
+{
+    m_data = NULL;
+    m_size = 0;
+#ifdef _WIN32
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#endif
+}
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+
+#ifdef _WIN32
+
+bool MappedFile::Open(char const *filename)
+{
+    Close();
+
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_mapping) {
+        Close();
+        return false;
+    }
+
+    m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        Close();
+        return false;
+    }
+
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+
+void MappedFile::Close()
+{
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+    }
+
+    m_data = NULL;
+    m_size = 0;
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+}
+
+#else
+
+bool MappedFile::Open(char const *filename)
+{
+    Close();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the file is closed.
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    m_data = data;
+    m_size = st.st_size;
+    return true;
+}
+
+
+void MappedFile::Close()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+
+    m_data = NULL;
+    m_size = 0;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// A read-only memory mapping of a whole file.
+class MappedFile
+{
+private:
+    void *m_data;
+    size_t m_size;
+#ifdef _WIN32
+    void *m_file;
+    void *m_mapping;
+#endif
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Returns false if the file doesn't exist, is empty or couldn't be mapped.
+    bool Open(char const *filename);
+    void Close();
+
+    void const *GetData() const { return m_data; }
+    size_t GetSize() const { return m_size; }
+};
@@ -2,7 +2,9 @@
 
 // Project headers
 #include "antialiased_draw.h"
-#include "main.h"
+#include "mapped_file.h"
+#include "portability.h"
+#include "stats.h"
 #include "tokenizer.h"
 
 // Deadfrog headers
@@ -11,15 +13,73 @@
 
 // Standard headers
 #include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 #include <algorithm>
+#include <thread>
+
+
+// Charts with less than this much text per thread after the entity declarations
+// are parsed on one thread.
+#define MIN_PARALLEL_PARSE_BYTES (64 * 1024)
 
 
 MessageSequenceChart::MessageSequenceChart()
 {
-    m_pixelWidth = -1;
+    m_pixelWidth = 1300;    // Used if the chart doesn't specify a width. Also in Clear().
     m_scale = 1.0;
     m_yStep = 15.0f * m_scale;
     m_columnWidth = 1;
+    m_font = g_defaultFont;
+    m_maxParseThreads = 0;
+    m_stringStorage = NULL;
+    m_entitySource = NULL;
+
+    m_laidOut = false;
+    m_titleY = 0;
+    m_entityLabelY = 0;
+    m_entityLabelHeight = 0;
+    m_lifelineY = 0;
+    m_lifelineEndY = 0;
+    m_height = 0;
+    m_completeHeight = 0;
+    m_maxArcHeight = 0;
+    m_arcsInYOrder = true;
+    m_numArcsLaidOut = 0;
+    m_nextArcY = 0.0f;
+    m_prevArcYInc = 0;
+    m_prevArcY = 0;
+}
+
+
+MessageSequenceChart::~MessageSequenceChart()
+{
+    Clear();
+}
+
+
+void MessageSequenceChart::Clear()
+{
+    for (int i = 0; i < m_entities.size(); i++) {
+        delete m_entities[i];
+    }
+
+    for (int i = 0; i < m_arcs.size(); i++) {
+        delete m_arcs[i];
+    }
+
+    m_title.clear();
+    m_entities.clear();
+    m_entityIndex.clear();
+    m_arcs.clear();
+    m_strings.Clear();
+    m_textWidths.clear();
+    delete m_stringStorage;
+    m_stringStorage = NULL;
+    m_pixelWidth = 1300;
+    m_laidOut = false;
 }
 
 
@@ -32,63 +92,89 @@ static char *StringDup(char const *str)
 }
 
 
-static void ReportParseError(Tokenizer *ts, char const *expected, char const *got)
+// Always returns false, so that parse functions can do "return SetError(...)".
+// The error is placed at the most recent token from ts, if ts isn't NULL.
+static bool SetError(ChartError *err, Tokenizer *ts, char const *fmt, ...)
+{
+    err->m_lineNum = ts ? ts->m_currentLineNum : 0;
+    err->m_column = ts ? ts->m_currentColumn : 0;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(err->m_message, sizeof(err->m_message), fmt, args);
+    va_end(args);
+
+    return false;
+}
+
+
+static bool ReportParseError(Tokenizer *ts, ChartError *err, char const *expected, char const *got)
 {
-    FatalError("Line %d\n\nExpected '%s' got '%s'", ts->m_currentLineNum, expected, got);
+    return SetError(err, ts, "Expected '%s' got '%s'", expected, got);
 }
 
 
-static void TokenMustBe(Tokenizer *ts, char const *got, char const *expected)
+static bool TokenMustBe(Tokenizer *ts, ChartError *err, char const *got, char const *expected)
 {
     if (stricmp(expected, got) != 0) {
-        ReportParseError(ts, expected, got);
+        return ReportParseError(ts, err, expected, got);
     }
+
+    return true;
 }
 
 
-static bool ReadKeyValuePair(Tokenizer *ts, char **key, char **value)
+// Returns false with err->m_message empty if the next token isn't a key, which
+// isn't necessarily an error. The caller must delete[] the key. The value is in
+// the tokenizer's buffer, so it is only valid until the next GetToken(). Where
+// the key was is put in keyPos, for errors about it.
+static bool ReadKeyValuePair(Tokenizer *ts, ChartError *err, char **key, char **value,
+                             ChartError *keyPos)
 {
     char *tok = ts->GetToken();
-    if (*tok == NULL || !isalpha(tok[0])) {
+    if (*tok == '\0' || !isalpha(tok[0])) {
         return false;
     }
-    *key = StringDup(tok);
+    keyPos->m_lineNum = ts->m_currentLineNum;
+    keyPos->m_column = ts->m_currentColumn;
 
+    char *keyTok = StringDup(tok);
     tok = ts->GetToken();
-    TokenMustBe(ts, tok, "=");
+    if (!TokenMustBe(ts, err, tok, "=")) {
+        delete[] keyTok;
+        return false;
+    }
 
     tok = ts->GetToken();
     if (tok[0] == '"') {
         tok++;
         char *lastChar = tok + strlen(tok) - 1;
         if (*lastChar != '"') {
-            delete[] *key;
-            *key = NULL;
-            FatalError("Line %d\n\nUnmatched double quote.", ts->m_currentLineNum);
+            delete[] keyTok;
+            return SetError(err, ts, "Unmatched double quote.");
         }
         *lastChar = '\0';
     }
-    *value = StringDup(tok);
+
+    *key = keyTok;
+    *value = tok;
     return true;
 }
 
 
-static void SplitAtNewLines(char *str, std::vector <char *> *linesOut)
+// Modifies str.
+void MessageSequenceChart::SplitAtNewLines(char *str, std::vector <unsigned> *linesOut)
 {
-    char *start = str;
     char *end = strstr(str, "\\n");
     while (end) {
         *end = '\0';
-        char *line = StringDup(str);
-        linesOut->push_back(line);
+        linesOut->push_back(m_strings.Intern(str));
 
         str = end + 2;
         end = strstr(str, "\\n");
     }
 
-    char *line = StringDup(str);
-    linesOut->push_back(line);
-    delete[] start;
+    linesOut->push_back(m_strings.Intern(str));
 }
 
 
@@ -126,12 +212,16 @@ static bool ParseColour(char *str, DfColour *col)
 
 
 // Assumes the opening '[' has already been read. Reads until the closing ']'.
-static bool ReadParameters(Tokenizer *ts, Parameters *params)
+bool MessageSequenceChart::ReadParameters(Tokenizer *ts, ChartError *err, Parameters *params)
 {
     while (1) {
         char *key;
         char *val;
-        if (!ReadKeyValuePair(ts, &key, &val)) {
+        ChartError keyPos;
+        if (!ReadKeyValuePair(ts, err, &key, &val, &keyPos)) {
+            if (err->m_message[0] == '\0') {
+                SetError(err, ts, "Expected a parameter name");
+            }
             return false;
         }
 
@@ -142,15 +232,15 @@ static bool ReadParameters(Tokenizer *ts, Parameters *params)
         else if (stricmp(key, "textbgcolour") == 0) {
             delete[] key;
             if (!ParseColour(val, &params->m_bgColour)) {
-                FatalError("Line %d\n\nInvalid colour value", ts->m_currentLineNum);
-                return false;
+                return SetError(err, ts, "Invalid colour value");
             }
         }
         else {
-            FatalError("Line %d\n\nUnrecognized parameter '%s'",
-                ts->m_currentLineNum, key);
+            SetError(err, ts, "Unrecognized parameter '%s'", key);
+            err->m_lineNum = keyPos.m_lineNum;
+            err->m_column = keyPos.m_column;
             delete[] key;
-            delete[] val;
+            return false;
         }
 
         char *tok = ts->GetToken();
@@ -158,7 +248,7 @@ static bool ReadParameters(Tokenizer *ts, Parameters *params)
             break;
         }
         if (stricmp(tok, ",") != 0) {
-            ReportParseError(ts, ",", tok);
+            return ReportParseError(ts, err, ",", tok);
         }
     }
 
@@ -166,132 +256,456 @@ static bool ReadParameters(Tokenizer *ts, Parameters *params)
 }
 
 
-bool MessageSequenceChart::Load(char const *filename)
+bool MessageSequenceChart::Load(char const *filename, ChartError *err)
 {
+    ScopedStatTimer timer(STAT_TIMER_LOAD);
+
     Tokenizer ts;
-    if (!ts.Open(filename))
-        FatalError("Couldn't open '%s'", filename);
+    if (!ts.Open(filename)) {
+        return SetError(err, NULL, "Couldn't open '%s'", filename);
+    }
 
-    char *tok = ts.GetToken();
-    TokenMustBe(&ts, tok, "msc");
-    tok = ts.GetToken();
-    TokenMustBe(&ts, tok, "{");
+    return Parse(&ts, err, NULL);
+}
 
-    while (1) {
-        tok = ts.GetToken();
-        
-        if (stricmp(tok, "}") == 0) {
+
+bool MessageSequenceChart::LoadFromMemory(char const *text, int len, ChartError *err)
+{
+    ScopedStatTimer timer(STAT_TIMER_LOAD);
+
+    Tokenizer ts;
+    ts.OpenFromMemory(text, len);
+    return Parse(&ts, err, NULL);
+}
+
+
+bool MessageSequenceChart::Check(char const *filename, std::vector <ChartError> *errors)
+{
+    ScopedStatTimer timer(STAT_TIMER_LOAD);
+
+    ChartError err;
+    Tokenizer ts;
+    if (!ts.Open(filename)) {
+        SetError(&err, NULL, "Couldn't open '%s'", filename);
+        errors->push_back(err);
+        return false;
+    }
+
+    return Parse(&ts, &err, errors);
+}
+
+
+bool MessageSequenceChart::CheckMemory(char const *text, int len, std::vector <ChartError> *errors)
+{
+    ScopedStatTimer timer(STAT_TIMER_LOAD);
+
+    ChartError err;
+    Tokenizer ts;
+    ts.OpenFromMemory(text, len);
+    return Parse(&ts, &err, errors);
+}
+
+
+// Skips the rest of a statement that had an error, so that the parser can carry
+// on after it. The token the error was found at might be the ';' or '}' that
+// ends the statement, so it is looked at again. Returns false if the error was at
+// the end of the file.
+bool MessageSequenceChart::SkipStatement(Tokenizer *ts)
+{
+    ts->UnGetToken();
+    char const *tok = ts->GetToken();
+    if (tok[0] == '\0') {
+        return false;
+    }
+
+    while (tok[0] != '\0' && strcmp(tok, ";") != 0) {
+        if (strcmp(tok, "}") == 0) {
+            ts->UnGetToken();
             break;
         }
+        tok = ts->GetToken();
+    }
+
+    return true;
+}
+
 
-        else if (stricmp(tok, "width") == 0) {
-            tok = ts.GetToken();
-            TokenMustBe(&ts, tok, "=");
-            char const *val = ts.GetToken();
-            int intVal = strtol(val, NULL, 10);
-            if (intVal < 40 || intVal > 9000) {
-                FatalError("Line %d\n\nWidth value out of range. Should be between "
-                    "40 and 9000. Was '%s'", ts.m_currentLineNum, val);
+// If errors is NULL, stops at the first error, which is put in err. Otherwise
+// every error is added to errors, see Check().
+bool MessageSequenceChart::Parse(Tokenizer *ts, ChartError *err, std::vector <ChartError> *errors)
+{
+    if (!ParseStart(ts, err)) {
+        // Without the "msc {" it's unlikely that the rest is a chart at all.
+        if (errors) {
+            errors->push_back(*err);
+        }
+        return false;
+    }
+
+    bool ok = true;
+    bool finished = false;
+    bool parallelTried = false;
+    while (!finished) {
+        // After the entities, the rest of the chart is arcs, which don't depend on
+        // each other until they are laid out. So if there are a lot of them, they
+        // are parsed in parallel.
+        if (!parallelTried && m_entities.size() > 0) {
+            parallelTried = true;
+            int numThreads = ts->GetRemainingLength() / MIN_PARALLEL_PARSE_BYTES;
+            if (numThreads > 1) {
+                int maxThreads = m_maxParseThreads;
+                if (maxThreads <= 0) {
+                    maxThreads = std::thread::hardware_concurrency();
+                }
+                numThreads = std::min(numThreads, maxThreads);
             }
+            if (numThreads > 1 && ParseArcsInParallel(ts, err, numThreads)) {
+                break;
+            }
+        }
 
-            m_pixelWidth = intVal;
-            tok = ts.GetToken();
-            TokenMustBe(&ts, tok, ";");
+        int numArcs = m_arcs.size();
+        if (ParseStatement(ts, err, &finished)) {
+            continue;
         }
 
-        else if (stricmp(tok, "title") == 0) {
+        ok = false;
+        if (!errors) {
+            break;
+        }
+        errors->push_back(*err);
+
+        // The arc that had the error is incomplete. Its entities might be NULL.
+        while (m_arcs.size() > numArcs) {
+            delete m_arcs.back();
+            m_arcs.pop_back();
+        }
+
+        if (!SkipStatement(ts)) {
+            break;
+        }
+    }
+
+    return ok;
+}
+
+
+// A piece of the text of the arcs, and what ParseArcsInParallel() got from it.
+struct ParseChunk
+{
+    char const *m_text;
+    int m_len;
+    bool m_isLast;              // The others end at the end of a statement.
+    MessageSequenceChart m_chart;
+    ChartError m_err;
+    bool m_ok;
+    bool m_finished;            // Found the '}' that closes the chart.
+};
+
+
+static void ParseChunkMain(ParseChunk *chunk)
+{
+    Tokenizer ts;
+    ts.OpenFromMemory(chunk->m_text, chunk->m_len);
+    chunk->m_ok = true;
+    chunk->m_finished = false;
+
+    while (!chunk->m_finished) {
+        // Only the last chunk has to end with the closing '}'.
+        if (!chunk->m_isLast) {
+            if (ts.GetToken()[0] == '\0') {
+                break;
+            }
             ts.UnGetToken();
-            char *key;
-            char *val;
-            if (!ReadKeyValuePair(&ts, &key, &val)) {
-                return false;
+        }
+
+        if (!chunk->m_chart.ParseStatement(&ts, &chunk->m_err, &chunk->m_finished)) {
+            chunk->m_ok = false;
+            break;
+        }
+    }
+}
+
+
+// Returns the offset just after the first end of a statement that is on a line
+// after the one containing offset from, or len if there isn't one.
+static int FindStatementEnd(char const *text, int len, int from)
+{
+    char const *newLine = (char const *)memchr(text + from, '\n', len - from);
+    if (!newLine) {
+        return len;
+    }
+
+    StatementScanner scanner;
+    for (int i = newLine - text + 1; i < len; i++) {
+        if (scanner.IsStatementEnd(text[i], i + 1 < len ? text[i + 1] : '\0')) {
+            return i + 1;
+        }
+    }
+
+    return len;
+}
+
+
+// Parses the rest of the text in ts, which must all come after the entity
+// declarations, on numThreads threads. It is split into one chunk per thread at
+// the ends of statements, so that no statement is split. Each thread parses its
+// chunk into a chart of its own, which shares this chart's entity index. Then
+// their arcs and strings are moved into this chart in order.
+//
+// Returns false if any chunk before the end of the chart has an error, without
+// changing this chart or ts. The caller then parses the arcs again on one thread,
+// which gives exactly the same error and line number as it always has. That also
+// covers charts that are split in the wrong place, which can only happen if an
+// '=' is followed by a ';' on the next line.
+bool MessageSequenceChart::ParseArcsInParallel(Tokenizer *ts, ChartError *err, int numThreads)
+{
+    char const *text = ts->GetRemainingText();
+    int len = ts->GetRemainingLength();
+
+    std::vector <ParseChunk *> chunks;
+    int start = 0;
+    for (int i = 1; i <= numThreads && start < len; i++) {
+        int end = len;
+        if (i < numThreads) {
+            int target = (long long)len * i / numThreads;
+            end = FindStatementEnd(text, len, std::max(target, start));
+        }
+
+        ParseChunk *chunk = new ParseChunk;
+        chunk->m_text = text + start;
+        chunk->m_len = end - start;
+        chunk->m_isLast = end == len;
+        chunk->m_chart.m_entitySource = this;
+        chunk->m_chart.m_pixelWidth = 0;    // So that a width statement can be spotted.
+        chunks.push_back(chunk);
+        start = end;
+    }
+
+    std::vector <std::thread> threads;
+    for (int i = 1; i < chunks.size(); i++) {
+        threads.push_back(std::thread(ParseChunkMain, chunks[i]));
+    }
+    ParseChunkMain(chunks[0]);
+    for (int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    // Anything after the closing '}' is ignored, errors included.
+    int numUsed = 0;
+    bool ok = false;
+    while (numUsed < chunks.size() && chunks[numUsed]->m_ok) {
+        numUsed++;
+        if (chunks[numUsed - 1]->m_finished) {
+            ok = true;
+            break;
+        }
+    }
+
+    if (ok) {
+        unsigned numStrings = m_strings.GetCount();
+        size_t numArcs = m_arcs.size();
+        for (int i = 0; i < numUsed; i++) {
+            numStrings += chunks[i]->m_chart.m_strings.GetCount();
+            numArcs += chunks[i]->m_chart.m_arcs.size();
+        }
+        m_strings.Reserve(numStrings);
+        m_arcs.reserve(numArcs);
+    }
+
+    for (int i = 0; ok && i < numUsed; i++) {
+        MessageSequenceChart *chunkChart = &chunks[i]->m_chart;
+
+        // The chunk's string ids are only valid in its own pool.
+        std::vector <unsigned> ids(chunkChart->m_strings.GetCount());
+        for (unsigned j = 0; j < ids.size(); j++) {
+            ids[j] = m_strings.Intern(chunkChart->m_strings.GetString(j));
+        }
+
+        if (chunkChart->m_pixelWidth != 0) {
+            m_pixelWidth = chunkChart->m_pixelWidth;
+        }
+        for (int j = 0; j < chunkChart->m_title.size(); j++) {
+            m_title.push_back(ids[chunkChart->m_title[j]]);
+        }
+
+        for (int j = 0; j < chunkChart->m_arcs.size(); j++) {
+            Arc *a = chunkChart->m_arcs[j];
+            std::vector <unsigned> &label = a->m_params.m_label;
+            for (int k = 0; k < label.size(); k++) {
+                label[k] = ids[label[k]];
             }
-            delete[] key;
-            SplitAtNewLines(val, &m_title);
-            tok = ts.GetToken();
-            TokenMustBe(&ts, tok, ";");
-        }
-
-        else if (m_entities.size() == 0) {
-            // Must be the entities declarations
-            while (1) {
-                Entity *e = new Entity;
-                e->m_name = StringDup(tok);
-                if (stricmp(ts.GetToken(), "[") == 0) {
-                    if (!ReadParameters(&ts, &e->m_params)) {
-                        return false;
-                    }
-                }
+            m_arcs.push_back(a);
+        }
+        chunkChart->m_arcs.clear();
+    }
+
+    for (int i = 0; i < chunks.size(); i++) {
+        delete chunks[i];
+    }
+
+    return ok;
+}
+
 
-                m_entities.push_back(e);
+bool MessageSequenceChart::ParseStart(Tokenizer *ts, ChartError *err)
+{
+    err->m_lineNum = 0;
+    err->m_column = 0;
+    err->m_message[0] = '\0';
+
+    char *tok = ts->GetToken();
+    if (!TokenMustBe(ts, err, tok, "msc")) {
+        return false;
+    }
+    tok = ts->GetToken();
+    return TokenMustBe(ts, err, tok, "{");
+}
 
-                tok = ts.GetToken();
-                if (stricmp(tok, ";") == 0) {
+
+bool MessageSequenceChart::ParseStatement(Tokenizer *ts, ChartError *err, bool *finished)
+{
+    err->m_lineNum = 0;
+    err->m_column = 0;
+    err->m_message[0] = '\0';
+    *finished = false;
+
+    char *tok = ts->GetToken();
+
+    if (stricmp(tok, "}") == 0) {
+        *finished = true;
+    }
+
+    else if (*tok == '\0') {
+        return ReportParseError(ts, err, "}", "end of file");
+    }
+
+    else if (stricmp(tok, "width") == 0) {
+        tok = ts->GetToken();
+        if (!TokenMustBe(ts, err, tok, "=")) {
+            return false;
+        }
+        char const *val = ts->GetToken();
+        int intVal = strtol(val, NULL, 10);
+        if (intVal < 40 || intVal > 9000) {
+            return SetError(err, ts, "Width value out of range. "
+                "Should be between 40 and 9000. Was '%s'", val);
+        }
+
+        m_pixelWidth = intVal;
+        tok = ts->GetToken();
+        if (!TokenMustBe(ts, err, tok, ";")) {
+            return false;
+        }
+    }
+
+    else if (stricmp(tok, "title") == 0) {
+        ts->UnGetToken();
+        char *key;
+        char *val;
+        ChartError keyPos;
+        if (!ReadKeyValuePair(ts, err, &key, &val, &keyPos)) {
+            return false;
+        }
+        delete[] key;
+        SplitAtNewLines(val, &m_title);
+        tok = ts->GetToken();
+        if (!TokenMustBe(ts, err, tok, ";")) {
+            return false;
+        }
+    }
+
+    else if (m_entities.size() == 0 && !m_entitySource) {
+        // Must be the entities declarations. Those before an error are still
+        // indexed, so that Check() can carry on with the arcs.
+        bool ok = true;
+        while (1) {
+            Entity *e = new Entity;
+            e->m_name = m_strings.GetString(m_strings.Intern(tok));
+            m_entities.push_back(e);
+
+            tok = ts->GetToken();
+            if (stricmp(tok, "[") == 0) {
+                if (!ReadParameters(ts, err, &e->m_params)) {
+                    ok = false;
                     break;
                 }
+                tok = ts->GetToken();
+            }
 
-                TokenMustBe(&ts, tok, ",");
-                tok = ts.GetToken();
+            if (stricmp(tok, ";") == 0) {
+                break;
             }
+
+            if (!TokenMustBe(ts, err, tok, ",")) {
+                ok = false;
+                break;
+            }
+            tok = ts->GetToken();
         }
 
-        else {
-            // Must be an arc declaration
+        IndexEntities();
+        if (!ok) {
+            return false;
+        }
+    }
+
+    else {
+        // Must be an arc declaration. It is added to m_arcs straight away so
+        // that the destructor frees it if there's an error.
 
-            Arc *arc = new Arc;
+        Arc *arc = new Arc;
+        m_arcs.push_back(arc);
 
-            if (stricmp(tok, "|||") == 0) {
-                arc->m_type = Arc::TYPE_SPACER;
+        if (stricmp(tok, "|||") == 0) {
+            arc->m_type = Arc::TYPE_SPACER;
+        }
+        else if (stricmp(tok, "...") == 0) {
+            arc->m_type = Arc::TYPE_ELLIPSIS;
+        }
+        else if (stricmp(tok, "---") == 0) {
+            arc->m_type = Arc::TYPE_COMMENT;
+        }
+        else {
+            arc->m_entities[0] = GetEntityByName(tok);
+            if (!arc->m_entities[0]) {
+                return ReportParseError(ts, err, "entity name", tok);
             }
-            else if (stricmp(tok, "...") == 0) {
-                arc->m_type = Arc::TYPE_ELLIPSIS;
+
+            tok = ts->GetToken();
+
+            if (stricmp(tok, "=>") == 0) {
+                arc->m_type = Arc::TYPE_ARROW;
             }
-            else if (stricmp(tok, "---") == 0) {
-                arc->m_type = Arc::TYPE_COMMENT;
+            else if (stricmp(tok, "box") == 0) {
+                arc->m_type = Arc::TYPE_BOX;
             }
             else {
-                arc->m_entities[0] = GetEntityByName(tok);
-                if (!arc->m_entities[0]) {
-                    ReportParseError(&ts, "entity name", tok);
-                }
-
-                tok = ts.GetToken();
-
-                if (stricmp(tok, "=>") == 0) {
-                    arc->m_type = Arc::TYPE_ARROW;
-                }
-                else if (stricmp(tok, "box") == 0) {
-                    arc->m_type = Arc::TYPE_BOX;
-                }
-                else {
-                    ReportParseError(&ts, "<arc type>", tok);
-                }
-
-                tok = ts.GetToken();
-                arc->m_entities[1] = GetEntityByName(tok);
-                if (!arc->m_entities[1]) {
-                    FatalError("Line %d\n\nUnknown entity name '%s'", ts.m_currentLineNum, tok);
-                }
+                return ReportParseError(ts, err, "<arc type>", tok);
             }
 
-            tok = ts.GetToken();
-            if (stricmp(tok, "[") == 0) {
-                if (!ReadParameters(&ts, &arc->m_params)) {
-                    return false;
-                }
-                tok = ts.GetToken();
+            tok = ts->GetToken();
+            arc->m_entities[1] = GetEntityByName(tok);
+            if (!arc->m_entities[1]) {
+                return SetError(err, ts, "Unknown entity name '%s'", tok);
+            }
+        }
 
-                if (stricmp(tok, ",") == 0) {
-                    m_arcs.push_back(arc);
-                    arc = new Arc;
-                    arc->m_type = Arc::TYPE_UNSPACER;
-                }
-                else {
-                    TokenMustBe(&ts, ";", tok);
-                }
+        tok = ts->GetToken();
+        if (stricmp(tok, "[") == 0) {
+            if (!ReadParameters(ts, err, &arc->m_params)) {
+                return false;
             }
+            tok = ts->GetToken();
 
-            m_arcs.push_back(arc);
+            if (stricmp(tok, ",") == 0) {
+                arc = new Arc;
+                arc->m_type = Arc::TYPE_UNSPACER;
+                m_arcs.push_back(arc);
+            }
+            else if (!TokenMustBe(ts, err, tok, ";")) {
+                return false;
+            }
         }
     }
 
@@ -299,23 +713,50 @@ bool MessageSequenceChart::Load(char const *filename)
 }
 
 
-Entity *MessageSequenceChart::GetEntityByName(char const *name)
+size_t MessageSequenceChart::EntityNameHasher::operator() (char const *name) const
+{
+    // FNV-1a, of the lower case name.
+    size_t h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)tolower((unsigned char)*name)) * 16777619u;
+    }
+    return h;
+}
+
+
+bool MessageSequenceChart::EntityNameEquals::operator() (char const *a, char const *b) const
 {
+    return stricmp(a, b) == 0;
+}
+
+
+void MessageSequenceChart::IndexEntities()
+{
+    // If two entities have the same name, the first one is found.
+    m_entityIndex.clear();
     for (int i = 0; i < m_entities.size(); i++) {
-        if (stricmp(m_entities[i]->m_name, name) == 0) {
-            return m_entities[i];
-        }
+        m_entityIndex.insert(std::make_pair(m_entities[i]->m_name, m_entities[i]));
     }
+}
+
 
-    return NULL;
+Entity *MessageSequenceChart::GetEntityByName(char const *name) const
+{
+    EntityIndex const &index = m_entitySource ? m_entitySource->m_entityIndex : m_entityIndex;
+    EntityIndex::const_iterator it = index.find(name);
+    if (it == index.end()) {
+        return NULL;
+    }
+
+    return it->second;
 }
 
 
-static int GetTextRenderWidth(std::vector <char *> *linesList)
+int MessageSequenceChart::GetTextRenderWidth(std::vector <unsigned> *linesList)
 {
     int width = 0;
     for (int i = 0; i < linesList->size(); i++) {
-        int thisWidth = GetTextWidth(g_defaultFont, (*linesList)[i]);
+        int thisWidth = m_textWidths[(*linesList)[i]];
         width = std::max(thisWidth, width);
     }
 
@@ -323,10 +764,61 @@ static int GetTextRenderWidth(std::vector <char *> *linesList)
 }
 
 
-int MessageSequenceChart::RenderLineList(DfBitmap *bmp, std::vector <char *> *lines, int x, int y)
+int MessageSequenceChart::GetLineListHeight(std::vector <unsigned> *lines)
+{
+    return m_yStep * lines->size();
+}
+
+
+// Returns the amount the Y coordinate advances by after drawing the arc.
+int MessageSequenceChart::GetArcHeight(Arc *a)
+{
+    int yInc = a->m_params.m_label.size() * m_font->charHeight;
+
+    switch (a->m_type) {
+    case Arc::TYPE_ARROW:
+        yInc += 6.0f * m_scale;
+        return m_yStep * 1.5 + yInc;
+    case Arc::TYPE_BOX:
+        yInc += 4.0f * m_scale * 2.0f;
+        return m_yStep + yInc;
+    case Arc::TYPE_ELLIPSIS:
+        return m_yStep * 1.5 + yInc;
+    }
+
+    return 0;
+}
+
+
+// Returns the number of rows from the top of the arc to the bottom of the last
+// pixel it draws. This is less than GetArcHeight(), which includes the gap to the
+// next arc.
+int MessageSequenceChart::GetArcDrawnHeight(Arc *a)
+{
+    int labelHeight = a->m_params.m_label.size() * m_font->charHeight;
+
+    switch (a->m_type) {
+    case Arc::TYPE_ARROW:
+        {
+            // The arrow head is the widest part of the line. Allow an extra row for
+            // its antialiased edge.
+            float halfHeadWidth = AntialiasedDraw::GetArrowHeadWidth(1.4f * m_scale) / 2.0f;
+            return labelHeight + (int)(6.0f * m_scale) + (int)ceilf(halfHeadWidth) + 1;
+        }
+    case Arc::TYPE_BOX:
+        return labelHeight + (int)(4.0f * m_scale * 2.0f);
+    case Arc::TYPE_ELLIPSIS:
+        return GetArcHeight(a);
+    }
+
+    return 0;
+}
+
+
+int MessageSequenceChart::RenderLineList(DfBitmap *bmp, std::vector <unsigned> *lines, int x, int y)
 {
     for (int i = 0; i < lines->size(); i++) {
-        DrawTextCentre(g_defaultFont, g_colourBlack, bmp, x, y, (*lines)[i]);
+        DrawTextCentre(m_font, g_colourBlack, bmp, x, y, "%s", m_strings.GetString((*lines)[i]));
         y += m_yStep;
     }
 
@@ -334,12 +826,14 @@ int MessageSequenceChart::RenderLineList(DfBitmap *bmp, std::vector <char *> *li
 }
 
 
-int MessageSequenceChart::RenderArrow(DfBitmap *bmp, int y, Arc *a)
+void MessageSequenceChart::RenderArrow(DfBitmap *bmp, int y, Arc *a, RenderContext *ctx)
 {
+    ScopedStatTimer timer(STAT_TIMER_RENDER_ARROW);
+
     int startX = a->m_entities[0]->xPos;
     int endX = a->m_entities[1]->xPos;
     int midX = (startX + endX) / 2;
-    int yInc = a->m_params.m_label.size() * g_defaultFont->charHeight;
+    int yInc = a->m_params.m_label.size() * m_font->charHeight;
     int width = GetTextRenderWidth(&a->m_params.m_label);
     DfColour bgColour = g_colourWhite;
     RectFill(bmp, midX - width/2, y, width, yInc, bgColour);
@@ -348,79 +842,673 @@ int MessageSequenceChart::RenderArrow(DfBitmap *bmp, int y, Arc *a)
     y += yInc;
     Vector2 start(startX, y);
     Vector2 end(endX, y);
-    g_antialiasedDraw->DrawSingleArrow(bmp, start, end, 1.4f * m_scale, g_colourBlack);
-
-    return m_yStep * 1.5 + yInc;
+    ctx->m_aaDraw->DrawSingleArrow(bmp, start, end, 1.4f * m_scale, g_colourBlack);
 }
 
 
-int MessageSequenceChart::RenderBox(DfBitmap *bmp, int y, Arc *a)
+void MessageSequenceChart::RenderBox(DfBitmap *bmp, int y, Arc *a)
 {
+    ScopedStatTimer timer(STAT_TIMER_RENDER_BOX);
+
     float borderSize = 4.0f * m_scale;
     int startX = a->m_entities[0]->xPos - m_columnWidth / 2.0;
     int endX = a->m_entities[1]->xPos + m_columnWidth / 2.0;
     int midX = (startX + endX) / 2;
     int width = endX - startX;
 
-    int yInc = a->m_params.m_label.size() * g_defaultFont->charHeight;
+    int yInc = a->m_params.m_label.size() * m_font->charHeight;
     yInc += borderSize * 2.0f;
     RectFill(bmp, startX + 1, y + 1, width - 2, yInc - 2, a->m_params.m_bgColour);
     RectOutline(bmp, startX, y, width, yInc, g_colourBlack);
     RenderLineList(bmp, &a->m_params.m_label, midX, y + borderSize);
+}
+
+
+// The lifelines are already drawn, so the rows of the arc are cut out of them and
+// replaced by three dots each, to show that time passes.
+void MessageSequenceChart::RenderEllipsis(DfBitmap *bmp, int y, Arc *a)
+{
+    int height = a->m_height;
+    int dotSize = std::max((int)(2.0f * m_scale), 1);
+    for (int i = 0; i < m_entities.size(); i++) {
+        int x = m_entities[i]->xPos;
+        VLine(bmp, x, y, height, g_colourWhite);
+        for (int j = 1; j <= 3; j++) {
+            int dotY = y + height * j / 4;
+            RectFill(bmp, x - dotSize / 2, dotY - dotSize / 2, dotSize, dotSize, g_colourBlack);
+        }
+    }
 
-    return m_yStep + yInc;
+    if (a->m_params.m_label.size() > 0) {
+        int midX = m_pixelWidth * m_scale / 2;
+        if (a->m_entities[0] && a->m_entities[1]) {
+            midX = (a->m_entities[0]->xPos + a->m_entities[1]->xPos) / 2;
+        }
+        int width = GetTextRenderWidth(&a->m_params.m_label);
+        int labelHeight = a->m_params.m_label.size() * m_font->charHeight;
+        int labelY = y + (height - labelHeight) / 2;
+        RectFill(bmp, midX - width/2, labelY, width, labelHeight, g_colourWhite);
+        RenderLineList(bmp, &a->m_params.m_label, midX, labelY);
+    }
 }
 
 
-void MessageSequenceChart::Render(DfBitmap *bmp)
+void MessageSequenceChart::Layout()
 {
-    float y = 10.0f * m_scale + g_defaultFont->charHeight;
+    LayoutHeader();
+    LayoutNewArcs();
+}
 
+
+// Each distinct string is only measured once, however many labels use it.
+void MessageSequenceChart::MeasureNewStrings()
+{
+    for (unsigned i = m_textWidths.size(); i < m_strings.GetCount(); i++) {
+        m_textWidths.push_back(GetTextWidth(m_font, m_strings.GetString(i)));
+    }
+}
+
+
+void MessageSequenceChart::LayoutHeader()
+{
+    ScopedStatTimer timer(STAT_TIMER_LAYOUT);
+
+    m_textWidths.clear();
+    MeasureNewStrings();
+
+    float y = 10.0f * m_scale + m_font->charHeight;
+
+    m_titleY = y;
     if (m_title.size() > 0) {
-        y += RenderLineList(bmp, &m_title, bmp->width / 2.0, y) + 20.0f * m_scale;
+        y += GetLineListHeight(&m_title) + 20.0f * m_scale;
     }
 
     m_columnWidth = (float)m_pixelWidth * m_scale / (float)(m_entities.size() + 2);
 
-    // Draw entity labels
+    // Entity labels
+    m_entityLabelY = y;
     int maxYInc = 0;
     for (int i = 0; i < m_entities.size(); i++) {
         Entity *e = m_entities[i];
         e->xPos = m_columnWidth + i * m_columnWidth;
         int yInc = m_yStep;
         if (e->m_params.m_label.size() > 0) {
-            yInc = RenderLineList(bmp, &e->m_params.m_label, e->xPos, y);
-        }
-        else {
-            DrawTextCentre(g_defaultFont, g_colourBlack, bmp, e->xPos, y, e->m_name);
+            yInc = GetLineListHeight(&e->m_params.m_label);
         }
         maxYInc = std::max(maxYInc, yInc);
     }
+    m_entityLabelHeight = maxYInc;
     y += maxYInc + 10 * m_scale;
 
-    // Draw a vertical line for each entity
+    m_lifelineY = y;
+    y += 10 * m_scale;
+    m_lifelineEndY = y;
+
+    m_maxArcHeight = 0;
+    m_arcsInYOrder = true;
+    m_numArcsLaidOut = 0;
+    m_nextArcY = y;
+    m_prevArcYInc = 0;
+    m_prevArcY = y;
+    m_height = m_lifelineEndY + 10 * m_scale;
+    m_completeHeight = m_lifelineEndY;
+    m_laidOut = true;
+}
+
+
+void MessageSequenceChart::LayoutNewArcs()
+{
+    ScopedStatTimer timer(STAT_TIMER_LAYOUT);
+
+    MeasureNewStrings();
+
+    // Arc types that draw nothing still move Y on by the height of the previous
+    // arc, and an unspacer moves it back up a row.
+    for (; m_numArcsLaidOut < m_arcs.size(); m_numArcsLaidOut++) {
+        Arc *a = m_arcs[m_numArcsLaidOut];
+        a->m_height = 0;
+        a->m_yPos = m_nextArcY;
+
+        switch (a->m_type) {
+        case Arc::TYPE_ARROW:
+        case Arc::TYPE_BOX:
+        case Arc::TYPE_ELLIPSIS:
+            m_prevArcYInc = GetArcHeight(a);
+            a->m_height = m_prevArcYInc;
+            m_maxArcHeight = std::max(m_maxArcHeight, m_prevArcYInc);
+            m_lifelineEndY = std::max(m_lifelineEndY, a->m_yPos + GetArcDrawnHeight(a));
+            break;
+        case Arc::TYPE_UNSPACER:
+            m_nextArcY -= m_prevArcYInc * 2.0f;
+            break;
+        }
+
+        m_nextArcY += m_prevArcYInc;
+
+        // Arcs that draw nothing are placed where the next arc starts, which keeps
+        // the positions in order when an unspacer puts two arcs on one row.
+        if (a->m_height == 0) {
+            a->m_yPos = m_nextArcY;
+        }
+
+        if (a->m_yPos < m_prevArcY) {
+            m_arcsInYOrder = false;
+        }
+        m_prevArcY = a->m_yPos;
+    }
+
+    m_height = m_lifelineEndY + 10 * m_scale;
+
+    // The next arc starts at m_nextArcY, unless the last one was an unspacer, and
+    // rows below m_lifelineEndY don't have their lifelines yet.
+    if (m_arcs.empty() || m_arcs.back()->m_type != Arc::TYPE_UNSPACER) {
+        m_completeHeight = std::min((int)m_nextArcY, m_lifelineEndY);
+    }
+}
+
+
+void MessageSequenceChart::DiscardArcsAbove(int y)
+{
+    int numAbove = 0;
+    while (numAbove < m_numArcsLaidOut) {
+        Arc *a = m_arcs[numAbove];
+        if (a->m_yPos + a->m_height > y) {
+            break;
+        }
+        delete a;
+        numAbove++;
+    }
+
+    m_arcs.erase(m_arcs.begin(), m_arcs.begin() + numAbove);
+    m_numArcsLaidOut -= numAbove;
+}
+
+
+// Returns the index of the first arc that could overlap chart Y coordinate top.
+int MessageSequenceChart::FindFirstVisibleArc(int top)
+{
+    if (!m_arcsInYOrder) {
+        return 0;
+    }
+
+    // No arc is taller than m_maxArcHeight, so any arc that starts further above top
+    // than that is out of view.
+    int lo = 0;
+    int hi = m_arcs.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m_arcs[mid]->m_yPos + m_maxArcHeight <= top) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+void MessageSequenceChart::RenderEntityLabels(DfBitmap *bmp, int y)
+{
     for (int i = 0; i < m_entities.size(); i++) {
         Entity *e = m_entities[i];
-        VLine(bmp, e->xPos, y, bmp->height - y, g_colourBlack);
+        if (e->m_params.m_label.size() > 0) {
+            RenderLineList(bmp, &e->m_params.m_label, e->xPos, y);
+        }
+        else {
+            DrawTextCentre(m_font, g_colourBlack, bmp, e->xPos, y, "%s", e->m_name);
+        }
     }
-    y += 10 * m_scale;
+}
 
-    int yInc = 0;
-    for (int i = 0; i < m_arcs.size(); i++) {
+
+// Draws the lifelines and arcs that are between chart Y coordinates top and
+// bottom, when bmp's top row is at chart Y coordinate scrollY.
+void MessageSequenceChart::RenderBody(DfBitmap *bmp, int scrollY, int top, int bottom,
+                                      RenderContext *ctx)
+{
+    // Draw a vertical line for each entity, down to the last arc
+    int lifelineTop = std::max(std::max(m_lifelineY, top) - scrollY, 0);
+    int lifelineBottom = std::min(std::min(m_lifelineEndY, bottom) - scrollY, (int)bmp->height);
+    if (lifelineTop < lifelineBottom) {
+        for (int i = 0; i < m_entities.size(); i++) {
+            Entity *e = m_entities[i];
+            VLine(bmp, e->xPos, lifelineTop, lifelineBottom - lifelineTop, g_colourBlack);
+        }
+    }
+
+    for (int i = FindFirstVisibleArc(top); i < m_arcs.size(); i++) {
         Arc *a = m_arcs[i];
 
+        if (a->m_yPos >= bottom) {
+            if (m_arcsInYOrder) {
+                break;
+            }
+            continue;
+        }
+
+        if (a->m_height == 0 || a->m_yPos + a->m_height <= top) {
+            continue;
+        }
+
+        StatsCount(STAT_COUNTER_ARCS_RENDERED);
+        int y = a->m_yPos - scrollY;
         switch (a->m_type) {
         case Arc::TYPE_ARROW:
-            yInc = RenderArrow(bmp, y, a);
+            RenderArrow(bmp, y, a, ctx);
             break;
         case Arc::TYPE_BOX:
-            yInc = RenderBox(bmp, y, a);
+            RenderBox(bmp, y, a);
             break;
-        case Arc::TYPE_UNSPACER:
-            y -= yInc * 2.0f;
+        case Arc::TYPE_ELLIPSIS:
+            RenderEllipsis(bmp, y, a);
             break;
         }
+    }
+}
+
+
+void MessageSequenceChart::Render(DfBitmap *bmp, int scrollY, RenderContext *ctx)
+{
+    ScopedStatTimer timer(STAT_TIMER_RENDER);
+
+    if (!m_laidOut) {
+        Layout();
+    }
+
+    RenderContext defaultCtx(g_antialiasedDraw);
+    if (!ctx) {
+        ctx = &defaultCtx;
+    }
+
+    // The title and entity labels are all above the lifelines.
+    if (scrollY < m_lifelineY) {
+        if (m_title.size() > 0) {
+            RenderLineList(bmp, &m_title, bmp->width / 2.0, m_titleY - scrollY);
+        }
+        RenderEntityLabels(bmp, m_entityLabelY - scrollY);
+    }
+
+    RenderBody(bmp, scrollY, scrollY, scrollY + (int)bmp->height, ctx);
+}
+
+
+// The density map counts ink in 1 / (1 << INK_SHIFT)'ths of a chart pixel.
+#define INK_SHIFT 4
+
+// Roughly the fraction of a line of text's box that the glyphs cover.
+static int const TEXT_INK = 3;
+// The arrow shafts are 1.4 pixels thick.
+static int const ARROW_INK = 22;
+static int const SOLID_INK = 1 << INK_SHIFT;
+
+static DfColour const g_lodTextColour = Colour(190, 190, 190);
+
+
+// The state of one call to RenderZoomedOut(). The To...() functions convert
+// chart coordinates to bitmap ones.
+struct MessageSequenceChart::ZoomedOutView
+{
+    DfBitmap *m_bmp;
+    int m_scrollY;
+    int m_shift;
+    bool m_dense;                       // The arc being drawn goes in the density map.
+    std::vector <unsigned> *m_density;  // One per pixel of the chart's part of m_bmp.
+    int m_densityWidth;
+    bool m_densityUsed;                 // m_density has been cleared and added to.
+
+    int ToX(int x) const { return x >> m_shift; }
+    int ToY(int y) const { return (y - m_scrollY) >> m_shift; }
+    int ToLen(int len) const { return std::max(len >> m_shift, 1); }
+};
+
+
+// Adds the ink of a rectangle in chart coordinates, inkPerPixel for each chart
+// pixel it covers, to the pixels of the density map it falls in. Only the rows
+// are split exactly; each column is treated as fully covered.
+void MessageSequenceChart::AddInk(ZoomedOutView *view, int x, int y, int width, int height,
+                                  int inkPerPixel)
+{
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    DfBitmap *bmp = view->m_bmp;
+    if (!view->m_densityUsed) {
+        view->m_density->assign(view->m_densityWidth * bmp->height, 0);
+        view->m_densityUsed = true;
+    }
+
+    int shift = view->m_shift;
+    int n = 1 << shift;
+    y -= view->m_scrollY;
+    int firstCol = std::max(x >> shift, 0);
+    int lastCol = std::min((x + width - 1) >> shift, view->m_densityWidth - 1);
+    int firstRow = std::max(y >> shift, 0);
+    int lastRow = std::min((y + height - 1) >> shift, (int)bmp->height - 1);
+    for (int row = firstRow; row <= lastRow; row++) {
+        int rowsCovered = std::min(y + height, (row + 1) * n) - std::max(y, row * n);
+        unsigned ink = rowsCovered * n * inkPerPixel;
+        unsigned *dst = &(*view->m_density)[row * view->m_densityWidth];
+        for (int col = firstCol; col <= lastCol; col++) {
+            dst[col] += ink;
+        }
+    }
+}
+
+
+// Darkens each pixel by the fraction of the chart pixels under it that are inked.
+// Multiplying keeps the colour of any box underneath.
+static void ApplyDensityMap(DfBitmap *bmp, std::vector <unsigned> const &density, int width,
+                            int shift)
+{
+    int fullShift = INK_SHIFT + shift * 2;
+    unsigned full = 1 << fullShift;
+    for (int y = 0; y < bmp->height; y++) {
+        unsigned const *ink = &density[y * width];
+        DfColour *row = bmp->pixels + y * bmp->width;
+        for (int x = 0; x < width; x++) {
+            if (ink[x] == 0) {
+                continue;
+            }
+
+            unsigned keep = full - std::min(ink[x], full);
+            row[x].r = (row[x].r * keep) >> fullShift;
+            row[x].g = (row[x].g * keep) >> fullShift;
+            row[x].b = (row[x].b * keep) >> fullShift;
+        }
+    }
+}
+
+
+// Glyphs fill roughly the middle two thirds of a line, so that is where the bar goes.
+void MessageSequenceChart::RenderLodLabel(ZoomedOutView *view, std::vector <unsigned> *lines,
+                                          int midX, int y)
+{
+    int barHeight = m_font->charHeight * 2 / 3;
+    for (int i = 0; i < lines->size(); i++) {
+        int width = m_textWidths[(*lines)[i]];
+        int x = midX - width / 2;
+        int barY = y + i * m_yStep + m_font->charHeight / 6;
+        if (view->m_dense) {
+            AddInk(view, x, barY, width, barHeight, TEXT_INK);
+        }
+        else {
+            RectFill(view->m_bmp, view->ToX(x), view->ToY(barY), view->ToLen(width),
+                     view->ToLen(barHeight), g_lodTextColour);
+        }
+    }
+}
 
-        y += yInc;
+
+void MessageSequenceChart::RenderLodArc(ZoomedOutView *view, Arc *a)
+{
+    DfBitmap *bmp = view->m_bmp;
+    int y = a->m_yPos;
+    int labelHeight = a->m_params.m_label.size() * m_font->charHeight;
+    view->m_dense = (a->m_height >> view->m_shift) < LOD_MIN_ARC_ROWS;
+
+    switch (a->m_type) {
+    case Arc::TYPE_ARROW:
+        {
+            int startX = std::min(a->m_entities[0]->xPos, a->m_entities[1]->xPos);
+            int endX = std::max(a->m_entities[0]->xPos, a->m_entities[1]->xPos);
+            RenderLodLabel(view, &a->m_params.m_label, (startX + endX) / 2, y);
+            int shaftY = y + labelHeight + (int)(6.0f * m_scale);
+            if (view->m_dense) {
+                AddInk(view, startX, shaftY, endX - startX + 1, 1, ARROW_INK);
+            }
+            else {
+                HLine(bmp, view->ToX(startX), view->ToY(shaftY),
+                      view->ToX(endX) - view->ToX(startX) + 1, g_colourBlack);
+            }
+        }
+        break;
+
+    case Arc::TYPE_BOX:
+        {
+            // The fill is drawn even when dense, so that the box keeps its colour.
+            int startX = a->m_entities[0]->xPos - m_columnWidth / 2.0;
+            int endX = a->m_entities[1]->xPos + m_columnWidth / 2.0;
+            int height = labelHeight + (int)(4.0f * m_scale * 2.0f);
+            int x = view->ToX(startX);
+            int width = view->ToX(endX) - x;
+            int boxY = view->ToY(y);
+            int boxHeight = std::max(view->ToY(y + height) - boxY, 1);
+            RectFill(bmp, x, boxY, width, boxHeight, a->m_params.m_bgColour);
+            if (view->m_dense) {
+                AddInk(view, startX, y, endX - startX, 1, SOLID_INK);
+                AddInk(view, startX, y + height - 1, endX - startX, 1, SOLID_INK);
+            }
+            else {
+                RectOutline(bmp, x, boxY, width, boxHeight, g_colourBlack);
+            }
+            RenderLodLabel(view, &a->m_params.m_label, (startX + endX) / 2, y + 4.0f * m_scale);
+        }
+        break;
+
+    case Arc::TYPE_ELLIPSIS:
+        {
+            int gapY = view->ToY(y);
+            int gapHeight = view->ToLen(a->m_height);
+            for (int i = 0; i < m_entities.size(); i++) {
+                int x = view->ToX(m_entities[i]->xPos);
+                VLine(bmp, x, gapY, gapHeight, g_colourWhite);
+                if (!view->m_dense) {
+                    for (int j = 1; j <= 3; j++) {
+                        PutPix(bmp, x, gapY + gapHeight * j / 4, g_colourBlack);
+                    }
+                }
+            }
+
+            int midX = m_pixelWidth * m_scale / 2;
+            if (a->m_entities[0] && a->m_entities[1]) {
+                midX = (a->m_entities[0]->xPos + a->m_entities[1]->xPos) / 2;
+            }
+            RenderLodLabel(view, &a->m_params.m_label, midX, y + (a->m_height - labelHeight) / 2);
+        }
+        break;
+    }
+}
+
+
+void MessageSequenceChart::RenderZoomedOut(DfBitmap *bmp, int scrollY, int zoomShift,
+                                           RenderContext *ctx)
+{
+    ScopedStatTimer timer(STAT_TIMER_RENDER_ZOOMED_OUT);
+
+    if (!m_laidOut) {
+        Layout();
+    }
+
+    RenderContext defaultCtx(g_antialiasedDraw);
+    if (!ctx) {
+        ctx = &defaultCtx;
+    }
+
+    ZoomedOutView view;
+    view.m_bmp = bmp;
+    view.m_scrollY = scrollY;
+    view.m_shift = zoomShift;
+    view.m_dense = false;
+    view.m_density = &ctx->m_density;
+    view.m_densityWidth = std::min((GetWidth() >> zoomShift) + 1, (int)bmp->width);
+    view.m_densityUsed = false;
+
+    int top = scrollY;
+    int bottom = scrollY + ((int)bmp->height << zoomShift);
+
+    if (top < m_lifelineY) {
+        if (m_title.size() > 0) {
+            RenderLodLabel(&view, &m_title, m_pixelWidth * m_scale / 2, m_titleY);
+        }
+        for (int i = 0; i < m_entities.size(); i++) {
+            Entity *e = m_entities[i];
+            if (e->m_params.m_label.size() > 0) {
+                RenderLodLabel(&view, &e->m_params.m_label, e->xPos, m_entityLabelY);
+            }
+            else {
+                int width = GetTextWidth(m_font, e->m_name);
+                int barHeight = m_font->charHeight * 2 / 3;
+                RectFill(bmp, view.ToX(e->xPos - width / 2),
+                         view.ToY(m_entityLabelY + m_font->charHeight / 6),
+                         view.ToLen(width), view.ToLen(barHeight), g_lodTextColour);
+            }
+        }
+    }
+
+    // A lifeline is a 1 pixel line at any zoom, so black would make it look
+    // 1 << zoomShift times heavier. It gets the grey that scaling down would give.
+    int lifelineGrey = 255 - (255 >> zoomShift);
+    DfColour lifelineColour = Colour(lifelineGrey, lifelineGrey, lifelineGrey);
+    int lifelineTop = std::max(view.ToY(std::max(m_lifelineY, top)), 0);
+    int lifelineBottom = std::min(view.ToY(std::min(m_lifelineEndY, bottom)), (int)bmp->height);
+    if (lifelineTop < lifelineBottom) {
+        for (int i = 0; i < m_entities.size(); i++) {
+            VLine(bmp, view.ToX(m_entities[i]->xPos), lifelineTop, lifelineBottom - lifelineTop,
+                  lifelineColour);
+        }
+    }
+
+    for (int i = FindFirstVisibleArc(top); i < m_arcs.size(); i++) {
+        Arc *a = m_arcs[i];
+
+        if (a->m_yPos >= bottom) {
+            if (m_arcsInYOrder) {
+                break;
+            }
+            continue;
+        }
+
+        if (a->m_height == 0 || a->m_yPos + a->m_height <= top) {
+            continue;
+        }
+
+        StatsCount(STAT_COUNTER_ARCS_RENDERED);
+        RenderLodArc(&view, a);
+    }
+
+    if (view.m_densityUsed) {
+        ApplyDensityMap(bmp, ctx->m_density, view.m_densityWidth, zoomShift);
+    }
+}
+
+
+// The title isn't repeated on later pages, so their entity labels go where the
+// title would have been.
+int MessageSequenceChart::GetPageHeaderHeight() const
+{
+    return m_lifelineY - (m_entityLabelY - m_titleY);
+}
+
+
+static bool IsArcAbove(Arc const *a, Arc const *b)
+{
+    return a->m_yPos < b->m_yPos;
+}
+
+
+void MessageSequenceChart::GetPages(int pageHeight, std::vector <ChartPage> *pages)
+{
+    if (!m_laidOut) {
+        Layout();
+    }
+
+    pages->clear();
+
+    // Only the arcs that draw something matter, in order down the chart.
+    std::vector <Arc *> arcs;
+    for (int i = 0; i < m_arcs.size(); i++) {
+        if (m_arcs[i]->m_height > 0) {
+            arcs.push_back(m_arcs[i]);
+        }
+    }
+    if (!m_arcsInYOrder) {
+        std::stable_sort(arcs.begin(), arcs.end(), IsArcAbove);
+    }
+
+    int bottomMargin = 10 * m_scale;    // As at the bottom of the chart.
+    ChartPage page;
+    page.m_top = 0;
+    int pageEnd = pageHeight;           // Where the page would end if it were full.
+    int drawnBottom = m_lifelineY;      // Below the last row drawn on the page so far.
+    int arcsBottom = m_lifelineY;       // Below every arc so far, including the gaps after them.
+    bool pageHasArcs = false;
+    int breakIndex = -1;                // The last arc on the page that a new page could start at.
+    int breakDrawnBottom = 0;           // drawnBottom as it was above that arc.
+    for (int i = 0; i < arcs.size(); i++) {
+        // A new page can only start at an arc that no earlier arc overlaps. When two
+        // arcs share a row, the shorter one doesn't cover the gap after the taller.
+        bool canBreak = pageHasArcs && arcs[i]->m_yPos >= arcsBottom;
+
+        if (pageHasArcs && arcs[i]->m_yPos + GetArcDrawnHeight(arcs[i]) + bottomMargin > pageEnd) {
+            if (!canBreak && breakIndex >= 0) {
+                // The arc shares a row with the arcs above it, so the page ends
+                // above the whole group instead, and the group goes on the next
+                // page.
+                i = breakIndex;
+                drawnBottom = breakDrawnBottom;
+                canBreak = true;
+            }
+
+            if (canBreak) {
+                page.m_bottom = std::min(arcs[i]->m_yPos, std::max(pageEnd, drawnBottom + bottomMargin));
+                pages->push_back(page);
+
+                page.m_top = arcs[i]->m_yPos;
+                pageEnd = page.m_top + pageHeight - GetPageHeaderHeight();
+                drawnBottom = page.m_top;
+                arcsBottom = page.m_top;
+                breakIndex = -1;
+                canBreak = false;
+            }
+        }
+
+        if (canBreak) {
+            breakIndex = i;
+            breakDrawnBottom = drawnBottom;
+        }
+
+        Arc *a = arcs[i];
+        pageHasArcs = true;
+        drawnBottom = std::max(drawnBottom, a->m_yPos + GetArcDrawnHeight(a));
+        arcsBottom = std::max(arcsBottom, a->m_yPos + a->m_height);
+    }
+
+    page.m_bottom = m_height;
+    pages->push_back(page);
+}
+
+
+int MessageSequenceChart::GetPageHeight(ChartPage const &page) const
+{
+    if (page.m_top == 0) {
+        return page.m_bottom;
+    }
+
+    return GetPageHeaderHeight() + page.m_bottom - page.m_top;
+}
+
+
+void MessageSequenceChart::RenderPage(DfBitmap *bmp, ChartPage const &page, RenderContext *ctx)
+{
+    ScopedStatTimer timer(STAT_TIMER_RENDER);
+
+    RenderContext defaultCtx(g_antialiasedDraw);
+    if (!ctx) {
+        ctx = &defaultCtx;
+    }
+
+    if (page.m_top == 0) {
+        if (m_title.size() > 0) {
+            RenderLineList(bmp, &m_title, bmp->width / 2.0, m_titleY);
+        }
+        RenderEntityLabels(bmp, m_entityLabelY);
+        RenderBody(bmp, 0, 0, page.m_bottom, ctx);
+    }
+    else {
+        RenderEntityLabels(bmp, m_titleY);
+        RenderBody(bmp, page.m_top - GetPageHeaderHeight(), page.m_top, page.m_bottom, ctx);
     }
 }
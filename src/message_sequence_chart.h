@@ -1,14 +1,31 @@
 #pragma once
 
 #include "df_bitmap.h"
+#include "string_pool.h"
 
 #include <stdlib.h>
+#include <unordered_map>
 #include <vector>
 
 
+// Increase this whenever a change alters the images the renderer produces, so
+// that RenderCache doesn't return images from an older version.
+#define CHART_RENDER_VERSION 2
+
+// RenderZoomedOut() adds arcs that are fewer rows tall than this at its zoom to
+// the density map, rather than drawing them.
+#define LOD_MIN_ARC_ROWS 4
+
+
+class AntialiasedDraw;
+class MappedFile;
+class Tokenizer;
+struct DfFont;
+
+
 struct Parameters
 {
-    std::vector <char *> m_label;   // One entry per line of text.
+    std::vector <unsigned> m_label; // One string pool id per line of text.
     DfColour m_bgColour;
 
     Parameters() {
@@ -18,7 +35,7 @@ struct Parameters
 
 
 struct Entity {
-    char *m_name;
+    char const *m_name;             // In the chart's string pool.
     Parameters m_params;
     int xPos;
 };
@@ -29,7 +46,7 @@ struct Arc {
         TYPE_UNKNOWN,
         TYPE_ARROW,
         TYPE_BOX,
-        TYPE_ELLIPSIS,  // We render this arc as vertical "..."s.
+        TYPE_ELLIPSIS,  // We render this arc as vertical "..."s on the lifelines, with its label between its entities, or in the middle if it has none.
         TYPE_SPACER,
         TYPE_UNSPACER,  // We move the render nothing and move Y coordinate up one row when we encounter this type. It is used to put more than one arc on a single row.
         TYPE_COMMENT
@@ -39,9 +56,54 @@ struct Arc {
     int m_type;
     Parameters m_params;
 
+    // Set by MessageSequenceChart::Layout().
+    int m_yPos;     // Chart Y coordinate of the top of the arc.
+    int m_height;   // Vertical space the arc occupies. Zero for arcs that draw nothing.
+
     Arc() {
         m_entities[0] = m_entities[1] = NULL;
         m_type = TYPE_UNKNOWN;
+        m_yPos = 0;
+        m_height = 0;
+    }
+};
+
+
+// Describes why a chart couldn't be loaded.
+struct ChartError
+{
+    int m_lineNum;          // Zero if the error isn't about a particular line.
+    int m_column;           // Of the token the error was found at. Zero if m_lineNum is.
+    char m_message[256];
+
+    ChartError() {
+        m_lineNum = 0;
+        m_column = 0;
+        m_message[0] = '\0';
+    }
+};
+
+
+// The rows of a chart that are drawn on one page, when it is split up by
+// MessageSequenceChart::GetPages(). Pages after the first also start with a copy
+// of the entity labels.
+struct ChartPage
+{
+    int m_top;              // Chart Y coordinates.
+    int m_bottom;
+};
+
+
+// The things Render() needs that can't be shared between threads. Render() doesn't
+// modify the chart, so once Layout() has been called several threads can render
+// the same chart at once, each with its own RenderContext.
+struct RenderContext
+{
+    AntialiasedDraw *m_aaDraw;
+    std::vector <unsigned> m_density;   // Used by RenderZoomedOut().
+
+    RenderContext(AntialiasedDraw *aaDraw) {
+        m_aaDraw = aaDraw;
     }
 };
 
@@ -49,25 +111,171 @@ struct Arc {
 class MessageSequenceChart
 {
 public:
-    std::vector <char *> m_title;
+    StringPool m_strings;           // Every name and label.
+    std::vector <unsigned> m_title;
     std::vector <Entity *> m_entities;
     std::vector <Arc *> m_arcs;
     int m_pixelWidth;
     float m_scale;
     float m_columnWidth;
+    DfFont *m_font;         // Defaults to g_defaultFont. Layout() depends on it.
+
+    // The most threads Load() and LoadFromMemory() use to parse the arcs of a large
+    // chart. Zero, the default, means one per core.
+    int m_maxParseThreads;
+
+    // If not NULL, the strings in m_strings point into this. See LoadChartSnapshot().
+    MappedFile *m_stringStorage;
 
 private:
+    // Case insensitive, keyed on the entity names.
+    struct EntityNameHasher {
+        size_t operator() (char const *name) const;
+    };
+    struct EntityNameEquals {
+        bool operator() (char const *a, char const *b) const;
+    };
+    typedef std::unordered_map <char const *, Entity *, EntityNameHasher, EntityNameEquals> EntityIndex;
+
+    EntityIndex m_entityIndex;
+
+    struct ZoomedOutView;
+
+    // If not NULL, the entities are looked up in this chart instead. Each thread
+    // of a parallel parse has its own chart, which shares the real chart's index.
+    MessageSequenceChart const *m_entitySource;
+
     float m_yStep;
 
+    // Results of Layout(). All Y coordinates are relative to the top of the chart.
+    bool m_laidOut;
+    int m_titleY;
+    int m_entityLabelY;
+    int m_entityLabelHeight;
+    int m_lifelineY;
+    int m_lifelineEndY;     // Bottom of the lowest thing any arc draws.
+    int m_height;           // Height of the whole chart, including the bottom margin.
+    int m_completeHeight;   // See GetCompleteHeight().
+    int m_maxArcHeight;
+    bool m_arcsInYOrder;    // True if m_yPos never decreases along m_arcs.
+    std::vector <int> m_textWidths;     // Width of each string in m_strings, by id.
+
+    // Where LayoutNewArcs() got to.
+    int m_numArcsLaidOut;
+    float m_nextArcY;
+    int m_prevArcYInc;      // How far the last arc that drew something moved Y on.
+    int m_prevArcY;
+
 private:
-    int RenderLineList(DfBitmap *bmp, std::vector <char *> *lines, int x, int y);
-    int RenderArrow(DfBitmap *bmp, int y, Arc *a);
-    int RenderBox(DfBitmap *bmp, int y, Arc *a);
+    void SplitAtNewLines(char *str, std::vector <unsigned> *linesOut);
+    bool ReadParameters(Tokenizer *ts, ChartError *err, Parameters *params);
+    bool Parse(Tokenizer *ts, ChartError *err, std::vector <ChartError> *errors);
+    bool SkipStatement(Tokenizer *ts);
+    bool ParseArcsInParallel(Tokenizer *ts, ChartError *err, int numThreads);
+    void MeasureNewStrings();
+
+    int GetTextRenderWidth(std::vector <unsigned> *lines);
+    int GetLineListHeight(std::vector <unsigned> *lines);
+    int GetArcHeight(Arc *a);
+    int GetArcDrawnHeight(Arc *a);
+    int FindFirstVisibleArc(int top);
+    int GetPageHeaderHeight() const;
+
+    int RenderLineList(DfBitmap *bmp, std::vector <unsigned> *lines, int x, int y);
+    void RenderArrow(DfBitmap *bmp, int y, Arc *a, RenderContext *ctx);
+    void RenderBox(DfBitmap *bmp, int y, Arc *a);
+    void RenderEllipsis(DfBitmap *bmp, int y, Arc *a);
+    void RenderEntityLabels(DfBitmap *bmp, int y);
+    void RenderBody(DfBitmap *bmp, int scrollY, int top, int bottom, RenderContext *ctx);
+
+    void AddInk(ZoomedOutView *view, int x, int y, int width, int height, int inkPerPixel);
+    void RenderLodLabel(ZoomedOutView *view, std::vector <unsigned> *lines, int midX, int y);
+    void RenderLodArc(ZoomedOutView *view, Arc *a);
 
 public:
     MessageSequenceChart();
-    bool Load(char const *filename);
-    Entity *GetEntityByName(char const *name);
+    ~MessageSequenceChart();
+
+    // Frees everything that was loaded, so that another chart can be loaded.
+    void Clear();
+
+    // Parse a chart from a file or from text in memory. Only one chart can be
+    // loaded into each MessageSequenceChart. On failure they return false and
+    // describe the problem in err.
+    bool Load(char const *filename, ChartError *err);
+    bool LoadFromMemory(char const *text, int len, ChartError *err);
+
+    // As Load() and LoadFromMemory(), but after an error the parser skips to the
+    // end of the statement and carries on, so that every error in the chart is
+    // found. They are added to errors in the order they were found, and the
+    // result is true if there were none. The statements with errors are left out
+    // of the chart. Nothing is laid out or rendered, so no font is needed.
+    bool Check(char const *filename, std::vector <ChartError> *errors);
+    bool CheckMemory(char const *text, int len, std::vector <ChartError> *errors);
+
+    // Parse a chart a statement at a time, for when its text is still arriving.
+    // See ChartStream. ParseStart() reads the "msc {" at the start of the chart.
+    // Then each call to ParseStatement() reads one statement, until it sets
+    // *finished at the closing '}'.
+    bool ParseStart(Tokenizer *ts, ChartError *err);
+    bool ParseStatement(Tokenizer *ts, ChartError *err, bool *finished);
+
+    // Looks entities up by name, ignoring case. The parser calls IndexEntities()
+    // when it has read the entities. If they are added some other way, it must be
+    // called before GetEntityByName().
+    void IndexEntities();
+    Entity *GetEntityByName(char const *name) const;
+
+    // Works out the position of everything in the chart. Render() does this itself
+    // if needed, but it must be called first if several threads are going to render
+    // the same chart.
+    void Layout();
+
+    // Layout() in two parts, for a chart that is still being parsed. LayoutHeader()
+    // positions the title and entities, so it can be called as soon as the entities
+    // have been declared. After that, LayoutNewArcs() positions the arcs that have
+    // been added since it was last called.
+    void LayoutHeader();
+    void LayoutNewArcs();
+
+    // Deletes the arcs that are entirely above chart Y coordinate y, to save
+    // memory when those rows have been rendered and won't be rendered again.
+    void DiscardArcsAbove(int y);
+
+    // The exact size of bitmap needed to hold the whole chart. Only valid after
+    // Layout().
+    int GetWidth() const { return (int)(m_pixelWidth * m_scale + 0.5f); }
+    int GetHeight() const { return m_height; }
+
+    // The number of rows at the top of the chart that can't change if more arcs are
+    // added. They can be rendered before the rest of the chart has been parsed.
+    int GetCompleteHeight() const { return m_completeHeight; }
+
+    // Draws the part of the chart that is visible in bmp, when bmp's top row is at
+    // chart Y coordinate scrollY. Arcs outside that range are skipped entirely, so
+    // the cost depends on the size of bmp rather than the length of the chart.
+    // If ctx is NULL, g_antialiasedDraw is used.
+    void Render(DfBitmap *bmp, int scrollY = 0, RenderContext *ctx = NULL);
+
+    // As Render(), but draws the chart scaled down by 1 << zoomShift, for views
+    // zoomed out too far for the text to be read. Detail that couldn't be seen
+    // isn't drawn: labels become grey bars and arrows become 1 pixel lines without
+    // heads. Arcs fewer than LOD_MIN_ARC_ROWS rows tall are added to a density map
+    // instead, which shades each pixel by how much of the chart under it would have
+    // been inked. Nothing is antialiased, so this is far quicker than rendering at
+    // full size and scaling down. scrollY is a chart Y coordinate.
+    void RenderZoomedOut(DfBitmap *bmp, int scrollY, int zoomShift, RenderContext *ctx = NULL);
+
+    // Splits the chart into pages of at most pageHeight rows, for charts too long
+    // to view as one image. Pages only break between arcs, and never between arcs
+    // that share a row, so an arc or row that is too tall to fit on a page gets a
+    // page of its own that is taller than pageHeight.
+    void GetPages(int pageHeight, std::vector <ChartPage> *pages);
+
+    // The height of bitmap that RenderPage() needs for the page.
+    int GetPageHeight(ChartPage const &page) const;
 
-    void Render(DfBitmap *bmp);
+    // Draws a page from GetPages() into bmp, which must be GetWidth() wide. Like
+    // Render(), several threads can draw pages of the same chart at once.
+    void RenderPage(DfBitmap *bmp, ChartPage const &page, RenderContext *ctx = NULL);
 };
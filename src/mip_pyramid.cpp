@@ -0,0 +1,286 @@
+#include "mip_pyramid.h"
+
+// Project headers
+#include "antialiased_draw.h"
+#include "message_sequence_chart.h"
+#include "polygon/polygon.h"
+#include "stats.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <string.h>
+#include <algorithm>
+
+
+// Box filters src down by half in each direction, into the rows of dst starting
+// at dstY. dst must be half as wide as src.
+static void HalveInto(DfBitmap *src, DfBitmap *dst, int dstY)
+{
+    int numRows = std::min((int)src->height / 2, (int)dst->height - dstY);
+    for (int dy = 0; dy < numRows; dy++) {
+        DfColour *srcRow0 = src->pixels + dy * 2 * src->width;
+        DfColour *srcRow1 = srcRow0 + src->width;
+        DfColour *dstRow = dst->pixels + (dstY + dy) * dst->width;
+        for (int dx = 0; dx < dst->width; dx++) {
+            DfColour *a = srcRow0 + dx * 2;
+            DfColour *b = srcRow1 + dx * 2;
+            dstRow[dx] = Colour((a[0].r + a[1].r + b[0].r + b[1].r + 2) >> 2,
+                                (a[0].g + a[1].g + b[0].g + b[1].g + 2) >> 2,
+                                (a[0].b + a[1].b + b[0].b + b[1].b + 2) >> 2);
+        }
+    }
+}
+
+
+MipPyramid::MipPyramid(MessageSequenceChart *chart, int maxLevel, long long budgetBytes)
+{
+    m_chart = chart;
+    m_chartWidth = chart->GetWidth();
+    m_chartHeight = chart->GetHeight();
+    m_maxLevel = maxLevel;
+    m_budgetBytes = budgetBytes;
+    m_bytesUsed = 0;
+    m_useCount = 0;
+    m_focusTile = 0;
+    m_focusMoved = true;
+    m_quit = false;
+
+    m_builder = std::thread(&MipPyramid::BuilderMain, this);
+}
+
+
+MipPyramid::~MipPyramid()
+{
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_focusChanged.notify_all();
+    m_builder.join();
+
+    for (int i = 0; i < m_tiles.size(); i++) {
+        BitmapDelete(m_tiles[i]->m_bmp);
+        delete m_tiles[i];
+    }
+}
+
+
+void MipPyramid::BuilderMain()
+{
+    // The builder needs its own polygon filler.
+    AntialiasedDraw aaDraw;
+    aaDraw.SetTimingEnabled(g_statsEnabled);
+    aaDraw.SetLinearBlending(g_linearBlending);
+    RenderContext ctx(&aaDraw);
+
+    std::unique_lock <std::mutex> lock(m_mutex);
+    while (1) {
+        while (!m_quit && !m_focusMoved) {
+            m_focusChanged.wait(lock);
+        }
+        if (m_quit) {
+            break;
+        }
+
+        // Tiles used after passStart are the ones around this focus.
+        m_focusMoved = false;
+        int focusTile = m_focusTile;
+        unsigned passStart = m_useCount;
+
+        lock.unlock();
+        BuildAround(focusTile, passStart, &ctx);
+        lock.lock();
+    }
+    lock.unlock();
+
+    if (g_statsEnabled) {
+        StatsAddFillerStats(aaDraw.GetFillerStats());
+    }
+}
+
+
+// Builds the tiles of every level from 1 up, nearest the focus first. A step away
+// from the focus covers twice as many rows at each level up, so the coarse levels
+// spread furthest, which suits them, as they are for looking at more of the chart.
+// Returns false if it had to stop before building everything.
+bool MipPyramid::BuildAround(int focusTile, unsigned passStart, RenderContext *ctx)
+{
+    int numLevel0Tiles = (m_chartHeight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    for (int distance = 0; ; distance++) {
+        bool inRange = false;
+        for (int level = m_maxLevel; level >= 1; level--) {
+            int numTiles = ((numLevel0Tiles - 1) >> level) + 1;
+            int centre = focusTile >> level;
+            for (int side = -1; side <= 1; side += 2) {
+                int index = centre + side * distance;
+                if (index < 0 || index >= numTiles || (distance == 0 && side > 0)) {
+                    continue;
+                }
+
+                inRange = true;
+                if (!BuildTile(level, index, passStart, ctx)) {
+                    return false;
+                }
+            }
+        }
+
+        if (!inRange) {
+            return true;
+        }
+    }
+}
+
+
+// Returns the tile, building it and the tiles of lower levels that it needs if it
+// isn't there already. Returns NULL if the builder should stop, because the focus
+// has moved or because the budget is full.
+MipTile *MipPyramid::BuildTile(int level, int index, unsigned passStart, RenderContext *ctx)
+{
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+        if (m_quit || m_focusMoved) {
+            return NULL;
+        }
+
+        MipTile *tile = FindTile(level, index);
+        if (tile) {
+            tile->m_lastUsed = ++m_useCount;
+            return tile;
+        }
+    }
+
+    DfBitmap *bmp = BitmapCreate(m_chartWidth >> level, TILE_HEIGHT);
+    BitmapClear(bmp, g_colourWhite);
+    if (level == 0) {
+        m_chart->Render(bmp, index * TILE_HEIGHT, ctx);
+    }
+    else {
+        // Each half is filtered as soon as its tile is built, because building the
+        // other one might free it.
+        for (int half = 0; half < 2; half++) {
+            int childIndex = index * 2 + half;
+            if ((childIndex * TILE_HEIGHT << (level - 1)) >= m_chartHeight) {
+                break;
+            }
+
+            MipTile *child = BuildTile(level - 1, childIndex, passStart, ctx);
+            if (!child) {
+                BitmapDelete(bmp);
+                return NULL;
+            }
+            HalveInto(child->m_bmp, bmp, half * TILE_HEIGHT / 2);
+        }
+    }
+
+    MipTile *tile = new MipTile;
+    tile->m_level = level;
+    tile->m_index = index;
+    tile->m_bmp = bmp;
+    if (!AddTile(tile, passStart)) {
+        BitmapDelete(bmp);
+        delete tile;
+        return NULL;
+    }
+
+    return tile;
+}
+
+
+// Must be called with the lock held.
+MipTile *MipPyramid::FindTile(int level, int index)
+{
+    for (int i = 0; i < m_tiles.size(); i++) {
+        MipTile *tile = m_tiles[i];
+        if (tile->m_level == level && tile->m_index == index) {
+            return tile;
+        }
+    }
+
+    return NULL;
+}
+
+
+// Frees the least recently used tiles until the new one fits in the budget, then
+// adds it. Tiles used since passStart are around the focus, so they are kept,
+// except for those of level 0, which are only a step towards the others. Returns
+// false, without adding the tile, if it doesn't fit.
+bool MipPyramid::AddTile(MipTile *tile, unsigned passStart)
+{
+    long long bytes = (long long)tile->m_bmp->width * tile->m_bmp->height * sizeof(DfColour);
+
+    std::lock_guard <std::mutex> lock(m_mutex);
+    while (m_bytesUsed + bytes > m_budgetBytes) {
+        int victim = -1;
+        for (int i = 0; i < m_tiles.size(); i++) {
+            MipTile *t = m_tiles[i];
+            if (t->m_level > 0 && t->m_lastUsed > passStart) {
+                continue;
+            }
+            if (victim < 0 || t->m_lastUsed < m_tiles[victim]->m_lastUsed) {
+                victim = i;
+            }
+        }
+
+        if (victim < 0) {
+            return false;
+        }
+
+        MipTile *t = m_tiles[victim];
+        m_tiles.erase(m_tiles.begin() + victim);
+        m_bytesUsed -= (long long)t->m_bmp->width * t->m_bmp->height * sizeof(DfColour);
+        BitmapDelete(t->m_bmp);
+        delete t;
+    }
+
+    tile->m_lastUsed = ++m_useCount;
+    m_tiles.push_back(tile);
+    m_bytesUsed += bytes;
+    return true;
+}
+
+
+void MipPyramid::SetFocus(int y)
+{
+    int focusTile = std::max(y, 0) / TILE_HEIGHT;
+    {
+        std::lock_guard <std::mutex> lock(m_mutex);
+        if (focusTile == m_focusTile) {
+            return;
+        }
+        m_focusTile = focusTile;
+        m_focusMoved = true;
+    }
+    m_focusChanged.notify_all();
+}
+
+
+bool MipPyramid::BlitTile(DfBitmap *bmp, int x, int y, int level, int index)
+{
+    std::lock_guard <std::mutex> lock(m_mutex);
+    MipTile *tile = FindTile(level, index);
+    if (!tile) {
+        return false;
+    }
+    tile->m_lastUsed = ++m_useCount;
+
+    DfBitmap *src = tile->m_bmp;
+    int srcX = std::max(-x, 0);
+    int dstX = std::max(x, 0);
+    int width = std::min((int)src->width - srcX, (int)bmp->width - dstX);
+    if (width <= 0) {
+        return true;
+    }
+
+    for (int row = 0; row < (int)src->height; row++) {
+        int dstY = y + row;
+        if (dstY < 0 || dstY >= (int)bmp->height) {
+            continue;
+        }
+        memcpy(bmp->pixels + dstY * bmp->width + dstX, src->pixels + row * src->width + srcX,
+               width * sizeof(DfColour));
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "df_bitmap.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class MessageSequenceChart;
+struct RenderContext;
+
+
+struct MipTile
+{
+    int m_level;
+    int m_index;            // Tile number, counting down from the top of the chart at this level.
+    unsigned m_lastUsed;
+    DfBitmap *m_bmp;        // Chart width >> m_level pixels wide.
+};
+
+
+// Scaled down copies of a chart, for the viewer to show as soon as it zooms out,
+// while it renders the exact bands at the new zoom. Level 0 is the chart at full
+// size, cut into tiles of TILE_HEIGHT rows, the same as ChartViewer::BAND_HEIGHT,
+// so a tile of level n covers the same rows as a band at zoom shift n. Each tile
+// of level n is a 2x box filter of two tiles of level n - 1, so only level 0 is
+// ever rendered.
+//
+// A background thread builds the tiles of every level around the focus, the part
+// of the chart being looked at, working outwards from it. The least recently used
+// tiles are freed to keep their memory within the budget, and the thread stops
+// when the budget is full of tiles it has built or used around the current focus.
+//
+// The chart must be laid out before the pyramid is created and mustn't change
+// while it exists.
+class MipPyramid
+{
+public:
+    enum { TILE_HEIGHT = 256 };
+
+private:
+    MessageSequenceChart *m_chart;
+    int m_chartWidth;
+    int m_chartHeight;
+    int m_maxLevel;
+    long long m_budgetBytes;
+
+    // Everything below is shared with the builder thread and protected by m_mutex.
+    // Only the builder adds or frees tiles, so it can read the bitmap of a tile
+    // without holding the lock.
+    std::mutex m_mutex;
+    std::condition_variable m_focusChanged;
+    std::vector <MipTile *> m_tiles;
+    long long m_bytesUsed;
+    unsigned m_useCount;    // Incremented each time a tile is used, to stamp m_lastUsed.
+    int m_focusTile;        // The level 0 tile at the focus.
+    bool m_focusMoved;
+    bool m_quit;
+
+    std::thread m_builder;
+
+private:
+    void BuilderMain();
+    bool BuildAround(int focusTile, unsigned passStart, RenderContext *ctx);
+    MipTile *BuildTile(int level, int index, unsigned passStart, RenderContext *ctx);
+
+    MipTile *FindTile(int level, int index);
+    bool AddTile(MipTile *tile, unsigned passStart);
+
+public:
+    // Levels 0 to maxLevel are built, in no more than budgetBytes of bitmaps.
+    MipPyramid(MessageSequenceChart *chart, int maxLevel, long long budgetBytes);
+    ~MipPyramid();
+
+    // Tells the builder which part of the chart is being looked at. y is a chart Y
+    // coordinate.
+    void SetFocus(int y);
+
+    // Copies a tile to bmp, with its top left corner at (x, y), if it has been
+    // built. Returns false if it hasn't.
+    bool BlitTile(DfBitmap *bmp, int x, int y, int level, int index);
+};
@@ -0,0 +1,327 @@
+#include "png_writer.h"
+
+// Project headers
+#include "stats.h"
+
+// Standard headers
+#include <string.h>
+
+
+// Deflate's length and distance codes. Each code covers the values from its base
+// up to the next code's base, using the given number of extra bits.
+static int const g_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static int const g_lengthExtraBits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static int const g_distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static int const g_distExtraBits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+enum {
+    MAX_MATCH_LEN = 258,
+    MAX_MATCH_DISTANCE = 32768,
+    ADLER_MOD = 65521
+};
+
+
+// Built before main() runs, so that encoders on different threads can share it.
+struct CrcTable
+{
+    unsigned m_table[256];
+
+    CrcTable() {
+        for (unsigned i = 0; i < 256; i++) {
+            unsigned c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            m_table[i] = c;
+        }
+    }
+};
+
+static CrcTable const g_crcTable;
+
+
+static unsigned Crc32(unsigned char const *data, unsigned len)
+{
+    unsigned c = 0xffffffff;
+    for (unsigned i = 0; i < len; i++) {
+        c = g_crcTable.m_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+
+static void WriteU32BigEndian(unsigned char *buf, unsigned val)
+{
+    buf[0] = val >> 24;
+    buf[1] = (val >> 16) & 0xff;
+    buf[2] = (val >> 8) & 0xff;
+    buf[3] = val & 0xff;
+}
+
+
+static void AppendU32BigEndian(std::vector <unsigned char> *out, unsigned val)
+{
+    unsigned char buf[4];
+    WriteU32BigEndian(buf, val);
+    out->insert(out->end(), buf, buf + 4);
+}
+
+
+static void AppendChunk(std::vector <unsigned char> *out, char const *type,
+                        unsigned char const *data, unsigned len)
+{
+    AppendU32BigEndian(out, len);
+    unsigned start = out->size();
+    out->insert(out->end(), type, type + 4);
+    out->insert(out->end(), data, data + len);
+    AppendU32BigEndian(out, Crc32(&(*out)[start], len + 4));
+}
+
+
+PngWriter::PngWriter()
+{
+    m_out = NULL;
+    m_width = 0;
+    m_height = 0;
+    m_rowsWritten = 0;
+    m_idatStart = 0;
+    m_row = NULL;
+    m_prevRow = NULL;
+    m_rowBytes = 0;
+    m_bitBuf = 0;
+    m_numBits = 0;
+    m_adlerA = 1;
+    m_adlerB = 0;
+}
+
+
+PngWriter::~PngWriter()
+{
+    delete[] m_row;
+    delete[] m_prevRow;
+}
+
+
+void PngWriter::Open(std::vector <unsigned char> *out, int width, int height)
+{
+    m_out = out;
+    m_width = width;
+    m_height = height;
+    m_rowsWritten = 0;
+    m_rowBytes = 1 + width * 3;
+    delete[] m_row;
+    delete[] m_prevRow;
+    m_row = new unsigned char[m_rowBytes];
+    m_prevRow = new unsigned char[m_rowBytes];
+    m_bitBuf = 0;
+    m_numBits = 0;
+    m_adlerA = 1;
+    m_adlerB = 0;
+
+    static unsigned char const signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    out->insert(out->end(), signature, signature + sizeof(signature));
+
+    unsigned char ihdr[13];
+    WriteU32BigEndian(ihdr, width);
+    WriteU32BigEndian(ihdr + 4, height);
+    ihdr[8] = 8;        // Bits per channel
+    ihdr[9] = 2;        // RGB
+    ihdr[10] = 0;       // Deflate
+    ihdr[11] = 0;       // Adaptive filtering
+    ihdr[12] = 0;       // Not interlaced
+    AppendChunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+    // The IDAT chunk is written straight into out as the rows arrive. Its length
+    // and CRC are filled in by Close().
+    m_idatStart = out->size();
+    AppendU32BigEndian(out, 0);
+    out->insert(out->end(), "IDAT", "IDAT" + 4);
+
+    // zlib header for deflate with a 32K window and no preset dictionary, then
+    // the header of the one and only block: final, fixed Huffman codes.
+    out->push_back(0x78);
+    out->push_back(0x01);
+    PutBits(1, 1);
+    PutBits(1, 2);
+}
+
+
+void PngWriter::PutBits(unsigned bits, int numBits)
+{
+    m_bitBuf |= bits << m_numBits;
+    m_numBits += numBits;
+    while (m_numBits >= 8) {
+        m_out->push_back(m_bitBuf & 0xff);
+        m_bitBuf >>= 8;
+        m_numBits -= 8;
+    }
+}
+
+
+// Huffman codes are stored most significant bit first, unlike everything else.
+void PngWriter::PutCode(unsigned code, int numBits)
+{
+    unsigned reversed = 0;
+    for (int i = 0; i < numBits; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    PutBits(reversed, numBits);
+}
+
+
+void PngWriter::PutLiteral(int literal)
+{
+    if (literal < 144) {
+        PutCode(0x30 + literal, 8);
+    }
+    else if (literal < 256) {
+        PutCode(0x190 + literal - 144, 9);
+    }
+    else if (literal < 280) {
+        PutCode(literal - 256, 7);
+    }
+    else {
+        PutCode(0xc0 + literal - 280, 8);
+    }
+}
+
+
+// len must be between 3 and MAX_MATCH_LEN.
+void PngWriter::PutMatch(int len, int distance)
+{
+    int i = 28;
+    while (g_lengthBase[i] > len) {
+        i--;
+    }
+    PutLiteral(257 + i);
+    PutBits(len - g_lengthBase[i], g_lengthExtraBits[i]);
+
+    i = 29;
+    while (g_distBase[i] > distance) {
+        i--;
+    }
+    PutCode(i, 5);
+    PutBits(distance - g_distBase[i], g_distExtraBits[i]);
+}
+
+
+// As PutMatch() but len can be anything from 3 up.
+void PngWriter::PutRepeat(int len, int distance)
+{
+    while (len > 0) {
+        int chunk = len;
+        if (chunk > MAX_MATCH_LEN) {
+            // Don't leave a remainder too short to be a match.
+            chunk = len - MAX_MATCH_LEN >= 3 ? MAX_MATCH_LEN : len - 3;
+        }
+        PutMatch(chunk, distance);
+        len -= chunk;
+    }
+}
+
+
+void PngWriter::CompressRow()
+{
+    unsigned char const *row = m_row;
+    int n = m_rowBytes;
+
+    // Adler-32. The sums can't overflow in a row of less than 5552 bytes, but
+    // rows can be longer than that.
+    for (int i = 0; i < n; i++) {
+        m_adlerA += row[i];
+        m_adlerB += m_adlerA;
+        if ((i & 4095) == 4095) {
+            m_adlerA %= ADLER_MOD;
+            m_adlerB %= ADLER_MOD;
+        }
+    }
+    m_adlerA %= ADLER_MOD;
+    m_adlerB %= ADLER_MOD;
+
+    if (m_rowsWritten > 0 && n <= MAX_MATCH_DISTANCE && memcmp(row, m_prevRow, n) == 0) {
+        PutRepeat(n, n);
+        return;
+    }
+
+    int i = 0;
+    while (i < n) {
+        PutLiteral(row[i]);
+        int runLen = 0;
+        while (i + 1 + runLen < n && row[i + 1 + runLen] == row[i]) {
+            runLen++;
+        }
+        i++;
+
+        if (runLen >= 3) {
+            PutRepeat(runLen, 1);
+            i += runLen;
+        }
+    }
+}
+
+
+void PngWriter::WriteRows(DfBitmap *bmp, int numRows)
+{
+    ScopedStatTimer timer(STAT_TIMER_ENCODE);
+
+    if (numRows > m_height - m_rowsWritten) {
+        numRows = m_height - m_rowsWritten;
+    }
+
+    unsigned startSize = m_out->size();
+    for (int y = 0; y < numRows; y++) {
+        DfColour *src = bmp->pixels + y * bmp->width;
+        unsigned char *dst = m_row;
+        *dst++ = 1;     // The "Sub" filter: each byte is stored minus the one to its left.
+        unsigned char prevR = 0, prevG = 0, prevB = 0;
+        for (int x = 0; x < m_width; x++) {
+            dst[0] = src[x].r - prevR;
+            dst[1] = src[x].g - prevG;
+            dst[2] = src[x].b - prevB;
+            prevR = src[x].r;
+            prevG = src[x].g;
+            prevB = src[x].b;
+            dst += 3;
+        }
+
+        CompressRow();
+        m_rowsWritten++;
+
+        unsigned char *tmp = m_prevRow;
+        m_prevRow = m_row;
+        m_row = tmp;
+    }
+
+    StatsCount(STAT_COUNTER_BYTES_ENCODED, (long long)(m_out->size() - startSize));
+}
+
+
+bool PngWriter::Close()
+{
+    PutLiteral(256);    // End of block
+    if (m_numBits > 0) {
+        PutBits(0, 8 - m_numBits);
+    }
+    AppendU32BigEndian(m_out, (m_adlerB << 16) | m_adlerA);
+
+    std::vector <unsigned char> &out = *m_out;
+    unsigned dataLen = out.size() - m_idatStart - 8;
+    WriteU32BigEndian(&out[m_idatStart], dataLen);
+    AppendU32BigEndian(m_out, Crc32(&out[m_idatStart + 4], dataLen + 4));
+
+    AppendChunk(m_out, "IEND", NULL, 0);
+
+    return m_rowsWritten == m_height;
+}
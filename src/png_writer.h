@@ -0,0 +1,52 @@
+#pragma once
+
+#include "df_bitmap.h"
+
+#include <vector>
+
+
+// Encodes a 24-bit PNG into memory a few rows at a time. There's no zlib, so the
+// deflate stream is a single block of fixed Huffman codes, with only two kinds of
+// match: runs of the same byte and rows that are the same as the row above. Each
+// row is stored with the PNG "Sub" filter, which turns runs of the same colour into
+// runs of zeros. That is most of a chart, so the result is usually several times
+// smaller than a BMP, though a long way from what zlib would manage.
+class PngWriter
+{
+private:
+    std::vector <unsigned char> *m_out;
+    int m_width;
+    int m_height;
+    int m_rowsWritten;
+    unsigned m_idatStart;       // Offset in *m_out of the IDAT chunk.
+
+    unsigned char *m_row;       // Filter type byte then the filtered pixels.
+    unsigned char *m_prevRow;
+    unsigned m_rowBytes;
+
+    unsigned m_bitBuf;          // Bits not yet written to m_out, LSB first.
+    int m_numBits;
+    unsigned m_adlerA;          // Adler-32 of the uncompressed data.
+    unsigned m_adlerB;
+
+    void PutBits(unsigned bits, int numBits);
+    void PutCode(unsigned code, int numBits);
+    void PutLiteral(int literal);
+    void PutMatch(int len, int distance);
+    void PutRepeat(int len, int distance);
+    void CompressRow();
+
+public:
+    PngWriter();
+    ~PngWriter();
+
+    // The encoded image is appended to out.
+    void Open(std::vector <unsigned char> *out, int width, int height);
+
+    // Writes the first numRows rows of bmp, which must be at least as wide as the
+    // image. Rows beyond the height given to Open() are ignored.
+    void WriteRows(DfBitmap *bmp, int numRows);
+
+    // Returns false if fewer rows were written than the height given to Open().
+    bool Close();
+};
@@ -12,6 +12,7 @@
 #define NUMBER_FORMATS_H_INCLUDED
 
 #include <float.h>
+#include <math.h>
 
 // Defines for the rational number format.
 #define RATIONAL float
@@ -32,10 +33,16 @@
 #define FIXED_TO_INT(a) ((a) >> FIXED_POINT_SHIFT) 
 
 // Define for 64-bit integer number format
-#define INTEGER64 __int64
+#define INTEGER64 long long
 
 
+// The asm conversions are x87 code in MSVC's inline asm syntax, so they are only
+// available in 32-bit MSVC builds. Elsewhere floor() is used, which compiles to a
+// single instruction on aarch64, and on x86-64 with SSE4.1 (-msse4.1 or a -march
+// that includes it).
+#if defined(_MSC_VER) && defined(_M_IX86)
 #define USE_ASM_OPTIMIZATIONS
+#endif
 
 // Converts rational to int using direct asm.
 /*! Typical conversions using _ftol are slow on Pentium 4, as _ftol sets the control
@@ -55,7 +62,7 @@ inline int rationalToIntRoundDown(RATIONAL a)
     }
     return i;
 #else
-    return ((int)((a) + INT_TO_RATIONAL(1)) - 1);
+    return (int)floorf(a);
 #endif
 }
 
@@ -74,7 +81,9 @@ inline int rationalToFixed(RATIONAL a)
     }
     return i;
 #else
-    return FLOAT_TO_FIXED(a);
+    // Scale in double, as the x87 version does, so that the result is rounded down
+    // rather than towards zero.
+    return (int)floor((double)a * (double)(1 << FIXED_POINT_SHIFT));
 #endif
 }
 
@@ -9,10 +9,14 @@
 
 
 #include "polygon.h"
+#include <limits.h>
+#include <math.h>
 #include <memory.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include "df_bitmap.h"
+#include "df_time.h"
 #include "clip_rectangle.h"
 #include "coverage_table.h"
 #include "number_formats.h"
@@ -26,20 +30,236 @@
 #define SLOPE_FIX_SCANLINES (1 << (SLOPE_FIX_SHIFT - SUBPIXEL_SHIFT))
 #define SLOPE_FIX_SCANLINE_MASK (SLOPE_FIX_SCANLINES - 1)
 
+// Linear light values are 16 bit. They are converted back to sRGB by looking up
+// their top LINEAR_TO_SRGB_BITS bits, which is enough to round trip every 8-bit
+// sRGB value.
+#define LINEAR_TO_SRGB_BITS 12
+#define LINEAR_BLEND_SHIFT (SUBPIXEL_SHIFT + 16 - LINEAR_TO_SRGB_BITS)
 
-// A optimized representation of a polygon edge.
-class PolygonScanEdge
+
+// The tables that PolygonFiller::SetLinearBlending() uses to convert between sRGB
+// and linear light.
+class LinearLightTables
+{
+public:
+    unsigned short m_toLinear[256];
+    unsigned char m_toSrgb[1 << LINEAR_TO_SRGB_BITS];
+
+    LinearLightTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            double c = i / 255.0;
+            double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            m_toLinear[i] = (unsigned short)(linear * 65535.0 + 0.5);
+        }
+
+        // Each entry covers a range of linear values. Use the middle of it.
+        int count = 1 << LINEAR_TO_SRGB_BITS;
+        for (int i = 0; i < count; i++)
+        {
+            double linear = (i + 0.5) / count;
+            double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+            m_toSrgb[i] = (unsigned char)(c * 255.0 + 0.5);
+        }
+    }
+};
+
+
+// Built before main() starts, so fillers on any thread can use them without locking.
+static const LinearLightTables g_linearLight;
+
+
+// An optimized representation of a set of polygon edges. The edges are stored as
+// a structure of arrays and are referred to by index rather than by pointer. That
+// means the storage can be grown with realloc without fixing up any links, and
+// that loops over the edges can step the x values of several edges at once.
+class PolygonScanEdges
 {
 public:
-    int m_lastLine;
-    int m_firstLine;
-    FIXED_POINT m_x;
-    FIXED_POINT m_slope;
-    FIXED_POINT m_slopeFix;
-    class PolygonScanEdge *m_nextEdge;
+    int *m_lastLine;
+    int *m_firstLine;
+    FIXED_POINT *m_x;
+    FIXED_POINT *m_slope;
+    FIXED_POINT *m_slopeFix;
+    int *m_nextEdge;    // Index of the next edge that starts on the same line, or -1.
+    unsigned int m_capacity;
+    bool m_inArena;     // True if the arrays point into memory owned by the caller.
+
+    enum { ARRAY_COUNT = 6 };
+
+    PolygonScanEdges()
+    {
+        m_lastLine = NULL;
+        m_firstLine = NULL;
+        m_x = NULL;
+        m_slope = NULL;
+        m_slopeFix = NULL;
+        m_nextEdge = NULL;
+        m_capacity = 0;
+        m_inArena = false;
+    }
+
+    ~PolygonScanEdges()
+    {
+        FreeArrays();
+    }
+
+    // Grows or shrinks the storage, preserving the existing edges. Returns false
+    // if the memory couldn't be allocated, in which case the capacity is unchanged.
+    // If the storage was in an arena it moves to the heap.
+    bool Resize(unsigned int capacity);
+
+    // Points the arrays at caller owned memory of at least GetArenaBytes(capacity)
+    // bytes. The memory should be 16 byte aligned. Any stored edges are discarded.
+    void UseArena(void *memory, unsigned int capacity);
+
+    // Each array in an arena is padded to a multiple of 16 bytes so that they all
+    // stay aligned for SIMD access.
+    static unsigned int GetArenaStride(unsigned int capacity)
+    {
+        return (capacity + 3) & ~3;
+    }
+
+    static unsigned int GetArenaBytes(unsigned int capacity)
+    {
+        return ARRAY_COUNT * GetArenaStride(capacity) * sizeof(int);
+    }
+
+    void Swap(PolygonScanEdges &other)
+    {
+        std::swap(m_lastLine, other.m_lastLine);
+        std::swap(m_firstLine, other.m_firstLine);
+        std::swap(m_x, other.m_x);
+        std::swap(m_slope, other.m_slope);
+        std::swap(m_slopeFix, other.m_slopeFix);
+        std::swap(m_nextEdge, other.m_nextEdge);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_inArena, other.m_inArena);
+    }
+
+    void FreeArrays()
+    {
+        if (!m_inArena)
+        {
+            free(m_lastLine);
+            free(m_firstLine);
+            free(m_x);
+            free(m_slope);
+            free(m_slopeFix);
+            free(m_nextEdge);
+        }
+
+        m_lastLine = NULL;
+        m_firstLine = NULL;
+        m_x = NULL;
+        m_slope = NULL;
+        m_slopeFix = NULL;
+        m_nextEdge = NULL;
+        m_capacity = 0;
+        m_inArena = false;
+    }
+
+    // Stores an edge that doesn't change x from one scanline to the next.
+    inline void SetVertical(int i, int firstLine, int lastLine, RATIONAL x)
+    {
+        m_firstLine[i] = firstLine;
+        m_lastLine[i] = lastLine;
+        m_x[i] = rationalToFixed(x);
+        m_slope[i] = INT_TO_FIXED(0);
+        m_slopeFix[i] = INT_TO_FIXED(0);
+    }
+
+    // Stores a sloped edge. startX is the position where the edge crosses firstLine.
+    inline void SetSloped(int i, int firstLine, int lastLine, RATIONAL startX, RATIONAL slope)
+    {
+        m_firstLine[i] = firstLine;
+        m_lastLine[i] = lastLine;
+        m_x[i] = rationalToFixed(startX);
+        m_slope[i] = rationalToFixed(slope);
+
+        if (lastLine - firstLine >= SLOPE_FIX_STEP)
+        {
+            m_slopeFix[i] = rationalToFixed(slope * SLOPE_FIX_STEP) -
+                            (m_slope[i] << SLOPE_FIX_SHIFT);
+        }
+        else
+        {
+            m_slopeFix[i] = INT_TO_FIXED(0);
+        }
+    }
 };
 
 
+template <class T>
+static bool ReallocArray(T **array, unsigned int count)
+{
+    T *newArray = (T *)realloc(*array, count * sizeof(T));
+    if (newArray == NULL)
+        return false;
+    *array = newArray;
+    return true;
+}
+
+
+bool PolygonScanEdges::Resize(unsigned int capacity)
+{
+    if (m_inArena)
+    {
+        // The arena can't be realloc'ed, so copy the edges out to new heap storage.
+        // The arena itself belongs to the caller and is simply left behind.
+        PolygonScanEdges heapEdges;
+        if (!heapEdges.Resize(capacity))
+            return false;
+
+        unsigned int count = std::min(capacity, m_capacity);
+        memcpy(heapEdges.m_lastLine, m_lastLine, count * sizeof(int));
+        memcpy(heapEdges.m_firstLine, m_firstLine, count * sizeof(int));
+        memcpy(heapEdges.m_x, m_x, count * sizeof(FIXED_POINT));
+        memcpy(heapEdges.m_slope, m_slope, count * sizeof(FIXED_POINT));
+        memcpy(heapEdges.m_slopeFix, m_slopeFix, count * sizeof(FIXED_POINT));
+        memcpy(heapEdges.m_nextEdge, m_nextEdge, count * sizeof(int));
+
+        Swap(heapEdges);
+        return true;
+    }
+
+    if (!ReallocArray(&m_lastLine, capacity) ||
+        !ReallocArray(&m_firstLine, capacity) ||
+        !ReallocArray(&m_x, capacity) ||
+        !ReallocArray(&m_slope, capacity) ||
+        !ReallocArray(&m_slopeFix, capacity) ||
+        !ReallocArray(&m_nextEdge, capacity))
+    {
+        // Some of the arrays may already have been resized, but they all hold
+        // at least the smaller of the old and new capacities.
+        if (capacity < m_capacity)
+            m_capacity = capacity;
+        return false;
+    }
+
+    m_capacity = capacity;
+    return true;
+}
+
+
+void PolygonScanEdges::UseArena(void *memory, unsigned int capacity)
+{
+    FreeArrays();
+
+    unsigned int stride = GetArenaStride(capacity);
+    int *base = (int *)memory;
+    m_lastLine = base;
+    m_firstLine = base + stride;
+    m_x = base + stride * 2;
+    m_slope = base + stride * 3;
+    m_slopeFix = base + stride * 4;
+    m_nextEdge = base + stride * 5;
+    m_capacity = capacity;
+    m_inArena = true;
+}
+
+
 enum POLYGON_CLIP_FLAGS
 {
     POLYGON_CLIP_NONE = 0x00,
@@ -100,7 +320,7 @@ inline int PolygonData::GetClipFlags(const Vector2d &point, const ClipRectangle
 
 
 // Calculates the edges of the polygon with transformation and clipping to edges array.
-int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipRectangle) const
+int PolygonData::GetScanEdges(PolygonScanEdges *edges, int firstEdge, const ClipRectangle &clipRectangle) const
 {
     for (int n = 0; n < m_vertexCount; n++)
     {
@@ -115,10 +335,14 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
         m_vertexData[n].m_clipFlags = GetClipFlags(m_vertexData[n].m_position, clipRectangle);
 
         // Calculate line of the vertex. If the vertex is clipped by top or bottom, the line
-        // is determined by the clip rectangle.
+        // is determined by the clip rectangle. Edges start on the line after their top
+        // vertex, so a vertex clipped at the top goes on the line above the clip
+        // rectangle. That way the first subpixel line inside the rectangle is sampled,
+        // just as it would be if there were no clipping, and a polygon drawn in bands
+        // doesn't show a seam where the bands meet.
         if (m_vertexData[n].m_clipFlags & POLYGON_CLIP_TOP)
         {
-            m_vertexData[n].m_line = clipRectangle.GetMinYi();
+            m_vertexData[n].m_line = clipRectangle.GetMinYi() - 1;
         }
         else if (m_vertexData[n].m_clipFlags & POLYGON_CLIP_BOTTOM)
         {
@@ -138,7 +362,7 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
     // copy the first vertex to
     // Process 1 time, next is n
 
-    int edgeCount = 0;
+    int edgeCount = firstEdge;
     for (int n = 0; n < m_vertexCount; n++)
     {
         int clipSum = m_vertexData[n].m_clipFlags | m_vertexData[n + 1].m_clipFlags;
@@ -165,23 +389,13 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
             if (clipUnion & POLYGON_CLIP_RIGHT)
             {
                 // Both clip to right, edge is a vertical line on the right side
-                edges[edgeCount].m_firstLine = firstLine;
-                edges[edgeCount].m_lastLine = lastLine;
-                edges[edgeCount].m_x = rationalToFixed(clipRectangle.GetMaxXf());
-                edges[edgeCount].m_slope = INT_TO_FIXED(0);
-                edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-
+                edges->SetVertical(edgeCount, firstLine, lastLine, clipRectangle.GetMaxXf());
                 edgeCount++;
             }
             else if (clipUnion & POLYGON_CLIP_LEFT)
             {
                 // Both clip to left, edge is a vertical line on the left side
-                edges[edgeCount].m_firstLine = firstLine;
-                edges[edgeCount].m_lastLine = lastLine;
-                edges[edgeCount].m_x = rationalToFixed(clipRectangle.GetMinXf());
-                edges[edgeCount].m_slope = INT_TO_FIXED(0);
-                edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-
+                edges->SetVertical(edgeCount, firstLine, lastLine, clipRectangle.GetMinXf());
                 edgeCount++;
             }
             else if ((clipSum & (POLYGON_CLIP_RIGHT | POLYGON_CLIP_LEFT)) == 0)
@@ -198,21 +412,7 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
                 RATIONAL startx = m_vertexData[startIndex].m_position.x +
                                   ((RATIONAL)firstLine - m_vertexData[startIndex].m_position.y) * slope;
 
-                edges[edgeCount].m_firstLine = firstLine;
-                edges[edgeCount].m_lastLine = lastLine;
-                edges[edgeCount].m_x = rationalToFixed(startx);
-                edges[edgeCount].m_slope = rationalToFixed(slope);
-
-                if (lastLine - firstLine >= SLOPE_FIX_STEP)
-                {
-                    edges[edgeCount].m_slopeFix = rationalToFixed(slope * SLOPE_FIX_STEP) -
-                                                (edges[edgeCount].m_slope << SLOPE_FIX_SHIFT);
-                }
-                else
-                {
-                    edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-                }
-
+                edges->SetSloped(edgeCount, firstLine, lastLine, startx, slope);
                 edgeCount++;
             }
             else
@@ -265,7 +465,7 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
                             if (clipVertices[p].m_position.y < clipRectangle.GetMinYf())
                             {
                                 clipVertices[p].m_clipFlags = POLYGON_CLIP_TOP;
-                                clipVertices[p].m_line = clipRectangle.GetMinYi();
+                                clipVertices[p].m_line = clipRectangle.GetMinYi() - 1;
                             }
                             else if (clipVertices[p].m_position.y > clipRectangle.GetMaxYf())
                             {
@@ -317,21 +517,7 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
                         RATIONAL startx = m_vertexData[startIndex].m_position.x +
                                           ((RATIONAL)firstClipLine - m_vertexData[startIndex].m_position.y) * slope;
 
-                        edges[edgeCount].m_x = rationalToFixed(startx);
-                        edges[edgeCount].m_slope = rationalToFixed(slope);
-                        edges[edgeCount].m_firstLine = firstClipLine;
-                        edges[edgeCount].m_lastLine = clipVertices[1].m_line;
-
-                        if (edges[edgeCount].m_lastLine - edges[edgeCount].m_firstLine >= SLOPE_FIX_STEP)
-                        {
-                            edges[edgeCount].m_slopeFix = rationalToFixed(slope * SLOPE_FIX_STEP) -
-                                                        (edges[edgeCount].m_slope << SLOPE_FIX_SHIFT);
-                        }
-                        else
-                        {
-                            edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-                        }
-
+                        edges->SetSloped(edgeCount, firstClipLine, clipVertices[1].m_line, startx, slope);
                         edgeCount++;
                     }
                 }
@@ -358,33 +544,20 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
                 // Check that the line is different for the vertices.
                 if (m_vertexData[startIndex].m_line != clipVertices[topClipIndex].m_line)
                 {
-                    edges[edgeCount].m_firstLine = firstLine;
-                    edges[edgeCount].m_lastLine = clipVertices[topClipIndex].m_line;
+                    int lastClipLine = clipVertices[topClipIndex].m_line;
 
                     // If startIndex is clipped, the edge is a vertical one.
                     if (m_vertexData[startIndex].m_clipFlags & (POLYGON_CLIP_LEFT | POLYGON_CLIP_RIGHT))
                     {
-                        edges[edgeCount].m_x = rationalToFixed(clipVertices[topClipIndex].m_position.x);
-                        edges[edgeCount].m_slope = INT_TO_FIXED(0);
-                        edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
+                        edges->SetVertical(edgeCount, firstLine, lastClipLine,
+                                           clipVertices[topClipIndex].m_position.x);
                     }
                     else
                     {
                         RATIONAL startx = m_vertexData[startIndex].m_position.x +
                                           ((RATIONAL)firstLine - m_vertexData[startIndex].m_position.y) * slope;
 
-                        edges[edgeCount].m_x = rationalToFixed(startx);
-                        edges[edgeCount].m_slope = rationalToFixed(slope);
-
-                        if (edges[edgeCount].m_lastLine - edges[edgeCount].m_firstLine >= SLOPE_FIX_STEP)
-                        {
-                            edges[edgeCount].m_slopeFix = rationalToFixed(slope * SLOPE_FIX_STEP) -
-                                                        (edges[edgeCount].m_slope << SLOPE_FIX_SHIFT);
-                        }
-                        else
-                        {
-                            edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-                        }
+                        edges->SetSloped(edgeCount, firstLine, lastClipLine, startx, slope);
                     }
 
                     edgeCount++;
@@ -395,33 +568,18 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
                 {
                     int firstClipLine = clipVertices[bottomClipIndex].m_line + 1;
 
-                    edges[edgeCount].m_firstLine = firstClipLine;
-                    edges[edgeCount].m_lastLine = lastLine;
-
                     // If endIndex is clipped, the edge is a vertical one.
                     if (m_vertexData[endIndex].m_clipFlags & (POLYGON_CLIP_LEFT | POLYGON_CLIP_RIGHT))
                     {
-                        edges[edgeCount].m_x = rationalToFixed(clipVertices[bottomClipIndex].m_position.x);
-                        edges[edgeCount].m_slope = INT_TO_FIXED(0);
-                        edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
+                        edges->SetVertical(edgeCount, firstClipLine, lastLine,
+                                           clipVertices[bottomClipIndex].m_position.x);
                     }
                     else
                     {
                         RATIONAL startx = m_vertexData[startIndex].m_position.x +
                                           ((RATIONAL)firstClipLine - m_vertexData[startIndex].m_position.y) * slope;
 
-                        edges[edgeCount].m_x = rationalToFixed(startx);
-                        edges[edgeCount].m_slope = rationalToFixed(slope);
-
-                        if (edges[edgeCount].m_lastLine - edges[edgeCount].m_firstLine >= SLOPE_FIX_STEP)
-                        {
-                            edges[edgeCount].m_slopeFix = rationalToFixed(slope * SLOPE_FIX_STEP) -
-                                                        (edges[edgeCount].m_slope << SLOPE_FIX_SHIFT);
-                        }
-                        else
-                        {
-                            edges[edgeCount].m_slopeFix = INT_TO_FIXED(0);
-                        }
+                        edges->SetSloped(edgeCount, firstClipLine, lastLine, startx, slope);
                     }
 
                     edgeCount++;
@@ -431,21 +589,370 @@ int PolygonData::GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipR
         }
     }
 
-    return edgeCount;
+    return edgeCount - firstEdge;
+}
+
+
+
+// ****************************************************************************
+// PolygonScratch
+// ****************************************************************************
+
+PolygonScratch::PolygonScratch()
+{
+    m_maskBuffer = NULL;
+    m_edgeTable = NULL;
+    m_width = 0;
+    m_height = 0;
+    m_resizeCount = 0;
+}
+
+
+PolygonScratch::~PolygonScratch()
+{
+    delete[] m_maskBuffer;
+    delete[] m_edgeTable;
+}
+
+
+bool PolygonScratch::Reserve(unsigned int width, unsigned int height)
+{
+    if (width > m_width)
+    {
+        // The buffer used for filling needs to be three pixels wider than the bitmap.
+        // This is because of three reasons: first, the buffer used for filling needs
+        // to be one pixel wider because the end flag that turns the fill off is the
+        // first pixel after the actually drawn edge. Second, the edge tracking needs
+        // to add the maximum sample offset (i.e. 1) to the end of the edge. This
+        // requires one pixel more in the buffer to avoid reading of data from the
+        // left edge. Third, the rendering is stopped with an edge marker that is placed
+        // after the data, thus requiring one pixel more for the maximum case.
+        unsigned int bufferWidth = width + 3;
+
+        SUBPIXEL_DATA *maskBuffer = new SUBPIXEL_DATA[bufferWidth];
+        if (maskBuffer == NULL)
+            return false;
+        memset(maskBuffer, 0, bufferWidth * sizeof(SUBPIXEL_DATA));
+
+        delete[] m_maskBuffer;
+        m_maskBuffer = maskBuffer;
+        m_width = width;
+        m_resizeCount++;
+    }
+
+    if (height > m_height)
+    {
+        int *edgeTable = new int[height];
+        if (edgeTable == NULL)
+            return false;
+
+        // Empty lines are marked with -1, so this sets every byte to 0xff.
+        memset(edgeTable, 0xff, height * sizeof(int));
+
+        delete[] m_edgeTable;
+        m_edgeTable = edgeTable;
+        m_height = height;
+        m_resizeCount++;
+    }
+
+    return true;
+}
+
+
+
+// ****************************************************************************
+// PolygonTarget
+// ****************************************************************************
+
+PolygonTarget::PolygonTarget()
+{
+    m_pixels = NULL;
+    m_width = 0;
+    m_height = 0;
+    m_pitch = 0;
+    m_format = POLYGON_FORMAT_BGRA32;
+    m_palette = NULL;
+    m_paletteSize = 0;
+}
+
+
+PolygonTarget::PolygonTarget(DfBitmap *bmp)
+{
+    m_pixels = bmp->pixels;
+    m_width = bmp->width;
+    m_height = bmp->height;
+    m_pitch = bmp->width;
+    m_format = POLYGON_FORMAT_BGRA32;
+    m_palette = NULL;
+    m_paletteSize = 0;
+}
+
+
+PolygonTarget::PolygonTarget(void *pixels, unsigned int width, unsigned int height, unsigned int pitch,
+                             PolygonPixelFormat format)
+{
+    m_pixels = pixels;
+    m_width = width;
+    m_height = height;
+    m_pitch = pitch;
+    m_format = format;
+    m_palette = NULL;
+    m_paletteSize = 0;
 }
 
 
 
+// ****************************************************************************
+// Pixel writers
+// ****************************************************************************
+
+// Fill() hands each pixel that a polygon covers to a writer. Put() writes a fully
+// covered pixel and Blend() a partly covered one, where alpha is from 1 to
+// SUBPIXEL_COUNT - 1. There is a writer for each pixel format, with the blend mode
+// as a template parameter, so the tests of the mode are resolved by the compiler
+// and every combination gets a loop of its own.
+
+static inline unsigned char AddSaturate(unsigned int a, unsigned int b)
+{
+    unsigned int sum = a + b;
+    return sum > 255 ? 255 : sum;
+}
+
+
+template <int BLEND>
+class Bgra32Writer
+{
+public:
+    typedef DfColour Pixel;
+
+    DfColour m_colour;
+    unsigned long m_cs1;
+    unsigned long m_cs2;
+
+    Bgra32Writer(DfColour colour, PolygonTarget const &target)
+    {
+        m_colour = colour;
+        m_cs1 = colour.c & 0xff00ff;
+        m_cs2 = (colour.c >> 8) & 0xff00ff;
+    }
+
+    inline void Put(DfColour *p)
+    {
+        if (BLEND == POLYGON_BLEND_ADD)
+            Blend(p, SUBPIXEL_COUNT);
+        else
+            *p = m_colour;
+    }
+
+    inline void Blend(DfColour *p, unsigned long alpha)
+    {
+        if (BLEND == POLYGON_BLEND_OVER)
+        {
+            BlendCoverage(p, m_cs1, m_cs2, alpha);
+        }
+        else if (BLEND == POLYGON_BLEND_REPLACE)
+        {
+            *p = m_colour;
+            p->a = (m_colour.a * alpha) >> SUBPIXEL_SHIFT;
+        }
+        else
+        {
+            p->r = AddSaturate(p->r, (m_colour.r * alpha) >> SUBPIXEL_SHIFT);
+            p->g = AddSaturate(p->g, (m_colour.g * alpha) >> SUBPIXEL_SHIFT);
+            p->b = AddSaturate(p->b, (m_colour.b * alpha) >> SUBPIXEL_SHIFT);
+            p->a = AddSaturate(p->a, (m_colour.a * alpha) >> SUBPIXEL_SHIFT);
+        }
+    }
+};
+
+
+// Blends over in linear light. See PolygonFiller::SetLinearBlending().
+class LinearBgra32Writer
+{
+public:
+    typedef DfColour Pixel;
+
+    DfColour m_colour;
+    unsigned long m_linearR;
+    unsigned long m_linearG;
+    unsigned long m_linearB;
+
+    LinearBgra32Writer(DfColour colour, PolygonTarget const &target)
+    {
+        m_colour = colour;
+        m_linearR = g_linearLight.m_toLinear[colour.r];
+        m_linearG = g_linearLight.m_toLinear[colour.g];
+        m_linearB = g_linearLight.m_toLinear[colour.b];
+    }
+
+    inline void Put(DfColour *p)
+    {
+        *p = m_colour;
+    }
+
+    // Alpha is not a colour, so it is blended as it is.
+    inline void Blend(DfColour *p, unsigned long alpha)
+    {
+        unsigned char const *toSrgb = g_linearLight.m_toSrgb;
+        unsigned short const *toLinear = g_linearLight.m_toLinear;
+        unsigned long invAlpha = SUBPIXEL_COUNT - alpha;
+
+        p->r = toSrgb[(toLinear[p->r] * invAlpha + m_linearR * alpha) >> LINEAR_BLEND_SHIFT];
+        p->g = toSrgb[(toLinear[p->g] * invAlpha + m_linearG * alpha) >> LINEAR_BLEND_SHIFT];
+        p->b = toSrgb[(toLinear[p->b] * invAlpha + m_linearB * alpha) >> LINEAR_BLEND_SHIFT];
+        p->a = (p->a * invAlpha + m_colour.a * alpha) >> SUBPIXEL_SHIFT;
+    }
+};
+
+
+template <int BLEND>
+class Gray8Writer
+{
+public:
+    typedef unsigned char Pixel;
+
+    unsigned int m_value;
+
+    Gray8Writer(DfColour colour, PolygonTarget const &target)
+    {
+        // Rec. 601 luma, in 8.8 fixed point.
+        m_value = (colour.r * 77 + colour.g * 150 + colour.b * 29 + 128) >> 8;
+    }
+
+    inline void Put(unsigned char *p)
+    {
+        if (BLEND == POLYGON_BLEND_ADD)
+            *p = AddSaturate(*p, m_value);
+        else
+            *p = m_value;
+    }
+
+    inline void Blend(unsigned char *p, unsigned long alpha)
+    {
+        if (BLEND == POLYGON_BLEND_OVER)
+            *p = (*p * (SUBPIXEL_COUNT - alpha) + m_value * alpha) >> SUBPIXEL_SHIFT;
+        else if (BLEND == POLYGON_BLEND_REPLACE)
+            *p = (m_value * alpha) >> SUBPIXEL_SHIFT;
+        else
+            *p = AddSaturate(*p, (m_value * alpha) >> SUBPIXEL_SHIFT);
+    }
+};
+
+
+// Ignores the colour and writes the coverage itself.
+template <int BLEND>
+class Coverage8Writer
+{
+public:
+    typedef unsigned char Pixel;
+
+    Coverage8Writer(DfColour colour, PolygonTarget const &target)
+    {
+    }
+
+    inline void Put(unsigned char *p)
+    {
+        if (BLEND == POLYGON_BLEND_ADD)
+            Blend(p, SUBPIXEL_COUNT);
+        else
+            *p = SUBPIXEL_COUNT;
+    }
+
+    inline void Blend(unsigned char *p, unsigned long alpha)
+    {
+        if (BLEND == POLYGON_BLEND_OVER)
+            *p += ((SUBPIXEL_COUNT - *p) * alpha) >> SUBPIXEL_SHIFT;
+        else if (BLEND == POLYGON_BLEND_REPLACE)
+            *p = alpha;
+        else
+            *p = std::min(*p + alpha, (unsigned long)SUBPIXEL_COUNT);
+    }
+};
+
+
+// Returns the index of the palette entry nearest to c.
+static unsigned char NearestPaletteIndex(DfColour const *palette, unsigned int size, DfColour c)
+{
+    unsigned int best = 0;
+    int bestDistance = INT_MAX;
+    for (unsigned int i = 0; i < size && i < 256; i++)
+    {
+        int dr = palette[i].r - c.r;
+        int dg = palette[i].g - c.g;
+        int db = palette[i].b - c.b;
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance)
+        {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+
+    return best;
+}
+
+
+template <int BLEND>
+class Indexed8Writer
+{
+public:
+    typedef unsigned char Pixel;
+
+    unsigned char m_index;
+    unsigned char m_maxIndex;
+
+    Indexed8Writer(DfColour colour, PolygonTarget const &target)
+    {
+        m_index = NearestPaletteIndex(target.m_palette, target.m_paletteSize, colour);
+        m_maxIndex = target.m_paletteSize == 0 ? 255 : std::min(target.m_paletteSize, 256u) - 1;
+    }
+
+    inline void Put(unsigned char *p)
+    {
+        if (BLEND == POLYGON_BLEND_ADD)
+        {
+            if (*p < m_maxIndex)
+                (*p)++;
+        }
+        else
+        {
+            *p = m_index;
+        }
+    }
+
+    inline void Blend(unsigned char *p, unsigned long alpha)
+    {
+        if (alpha >= SUBPIXEL_COUNT / 2)
+            Put(p);
+    }
+};
+
+
+
 // ****************************************************************************
 // PolygonFiller
 // ****************************************************************************
 
-PolygonFiller::PolygonFiller()
+PolygonFiller::PolygonFiller(PolygonScratch *scratch)
 {
-    m_edgeCount = 60;
-    m_edgeStorage = new PolygonScanEdge[m_edgeCount];
+    m_edgeStorage = new PolygonScanEdges;
+    m_activeEdges = new PolygonScanEdges;
+    m_edgeStorage->Resize(DEFAULT_EDGE_CAPACITY);
+    m_activeEdges->Resize(DEFAULT_EDGE_CAPACITY);
+    m_activeEdgeCount = 0;
     m_currentEdge = 0;
 
+    m_edgeArena = NULL;
+    m_edgeArenaCapacity = 0;
+    m_edgeRetentionLimit = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_timingEnabled = false;
+    m_linearBlending = false;
+
+    m_blendMode = POLYGON_BLEND_OVER;
+    m_clipEnabled = false;
+    m_ownsScratch = scratch == NULL;
+    m_scratch = m_ownsScratch ? new PolygonScratch : scratch;
     m_maskBuffer = NULL;
     m_edgeTable = NULL;
 }
@@ -453,67 +960,258 @@ PolygonFiller::PolygonFiller()
 
 PolygonFiller::~PolygonFiller()
 {
-    UnregisterBitmap();
-    delete[] m_edgeStorage;
+    if (m_ownsScratch)
+        delete m_scratch;
+    delete m_edgeStorage;
+    delete m_activeEdges;
+}
+
+
+void PolygonFiller::SetClipRect(int x, int y, int width, int height)
+{
+    m_clipEnabled = true;
+    m_clipX = x;
+    m_clipY = y;
+    m_clipWidth = width;
+    m_clipHeight = height;
+}
+
+
+void PolygonFiller::ClearClipRect()
+{
+    m_clipEnabled = false;
+}
+
+
+// Returns the number of edges that can be stored. The storage and the active edge
+// table normally have the same capacity, but may not if a resize failed half way.
+inline unsigned int PolygonFiller::GetEdgeCapacity() const
+{
+    return std::min(m_edgeStorage->m_capacity, m_activeEdges->m_capacity);
+}
+
+
+bool PolygonFiller::ReserveEdges(unsigned int edgeCount)
+{
+    if (edgeCount <= GetEdgeCapacity())
+        return true;
+
+    return ResizeEdgeStorage(edgeCount);
+}
+
+
+void PolygonFiller::SetEdgeRetentionLimit(unsigned int edgeCount)
+{
+    m_edgeRetentionLimit = edgeCount;
+    ApplyEdgeRetentionLimit();
+}
+
+
+unsigned int PolygonFiller::GetEdgeArenaBytes(unsigned int edgeCount)
+{
+    // Room for the edge storage and the active edge table, plus slack for aligning
+    // the start of the block.
+    return PolygonScanEdges::GetArenaBytes(edgeCount) * 2 + 15;
+}
+
+
+void PolygonFiller::SetEdgeArena(void *memory, unsigned int bytes)
+{
+    m_edgeArena = NULL;
+    m_edgeArenaCapacity = 0;
+
+    if (memory)
+    {
+        char *aligned = (char *)(((size_t)memory + 15) & ~(size_t)15);
+        unsigned int slack = aligned - (char *)memory;
+        if (bytes > slack)
+        {
+            unsigned int perEdge = PolygonScanEdges::ARRAY_COUNT * sizeof(int) * 2;
+            unsigned int capacity = ((bytes - slack) / perEdge) & ~3;
+            if (capacity > 0)
+            {
+                m_edgeArena = aligned;
+                m_edgeArenaCapacity = capacity;
+            }
+        }
+    }
+
+    if (m_edgeArena && m_edgeArenaCapacity >= GetEdgeCapacity())
+    {
+        UseEdgeArena();
+    }
+    else if (m_edgeStorage->m_inArena)
+    {
+        // The old arena is going away. Move to the heap while it is still valid.
+        unsigned int capacity = std::max(GetEdgeCapacity(), (unsigned int)DEFAULT_EDGE_CAPACITY);
+        if (!m_edgeStorage->Resize(capacity) || !m_activeEdges->Resize(capacity))
+        {
+            m_edgeStorage->FreeArrays();
+            m_activeEdges->FreeArrays();
+        }
+    }
+}
+
+
+PolygonFillerStats PolygonFiller::GetStats() const
+{
+    PolygonFillerStats stats = m_stats;
+    stats.m_edgeCapacity = GetEdgeCapacity();
+    stats.m_usingArena = m_edgeStorage->m_inArena;
+    stats.m_scratchResizes = m_scratch->m_resizeCount;
+    return stats;
+}
+
+
+void PolygonFiller::SetTimingEnabled(bool enabled)
+{
+    m_timingEnabled = enabled;
+}
+
+
+void PolygonFiller::SetLinearBlending(bool enabled)
+{
+    m_linearBlending = enabled;
+}
+
+
+// Splits the arena between the edge storage and the active edge table. Any edges
+// currently stored are discarded, so this must only be called between polygons.
+void PolygonFiller::UseEdgeArena()
+{
+    unsigned int half = PolygonScanEdges::GetArenaBytes(m_edgeArenaCapacity);
+    m_edgeStorage->UseArena(m_edgeArena, m_edgeArenaCapacity);
+    m_activeEdges->UseArena((char *)m_edgeArena + half, m_edgeArenaCapacity);
+}
+
+
+// Gives back any edge storage beyond the retention limit. A limit of zero means
+// the storage is kept at its high water mark.
+void PolygonFiller::ApplyEdgeRetentionLimit()
+{
+    if (m_edgeRetentionLimit == 0 || GetEdgeCapacity() <= m_edgeRetentionLimit)
+        return;
+
+    if (m_edgeArena && m_edgeArenaCapacity >= m_edgeRetentionLimit)
+    {
+        UseEdgeArena();
+    }
+    else
+    {
+        // Shrinking can't really fail, and if it does we just keep the bigger block.
+        m_edgeStorage->Resize(m_edgeRetentionLimit);
+        m_activeEdges->Resize(m_edgeRetentionLimit);
+    }
 }
 
 
 void PolygonFiller::DrawPoly(DfBitmap *bmp, const PolygonData *poly, DfColour colour)
 {
-    if (bmp != m_bitmap)
+    DrawPoly(PolygonTarget(bmp), poly, colour);
+}
+
+
+void PolygonFiller::DrawPoly(PolygonTarget const &target, const PolygonData *poly, DfColour colour,
+                             PolygonBlendMode blend)
+{
+    if (!SetTarget(target))
+        return;
+    m_blendMode = blend;
+
+    if (!m_timingEnabled)
     {
-        UnregisterBitmap();
-        RegisterBitmap(bmp);
+        DrawPolyInternal(poly, colour);
+        return;
     }
 
+    double startTime = GetRealTime();
+    DrawPolyInternal(poly, colour);
+    m_stats.m_drawPolySeconds += GetRealTime() - startTime;
+}
+
+
+void PolygonFiller::DrawPolyInternal(const PolygonData *poly, DfColour colour)
+{
+    m_stats.m_polygons++;
+
     // Sets the round down mode in case it has been modified.
     setRoundDownMode();
 
     m_verticalExtents.reset();
     m_currentEdge = 0;
 
-    ClipRectangle clipRect(0, 0, m_bitmap->width, m_bitmap->height, SUBPIXEL_COUNT);
+    int clipX1 = 0;
+    int clipY1 = 0;
+    int clipX2 = m_target.m_width;
+    int clipY2 = m_target.m_height;
+    if (m_clipEnabled)
+    {
+        clipX1 = std::max(clipX1, m_clipX);
+        clipY1 = std::max(clipY1, m_clipY);
+        clipX2 = std::min(clipX2, m_clipX + m_clipWidth);
+        clipY2 = std::min(clipY2, m_clipY + m_clipHeight);
+        if (clipX1 >= clipX2 || clipY1 >= clipY2)
+            return;
+    }
+
+    ClipRectangle clipRect(clipX1, clipY1, clipX2 - clipX1, clipY2 - clipY1, SUBPIXEL_COUNT);
 
     bool success = true;
 
-    int count = poly->m_vertexCount;
     // The maximum amount of edges is 3 x the vertices.
-    int freeCount = GetFreeEdgeCount() - count * 3;
-    if (freeCount < 0 && !ResizeEdgeStorage(-freeCount))
+    unsigned int required = m_currentEdge + poly->m_vertexCount * 3 + 1;
+    if (required > m_stats.m_peakEdges)
+        m_stats.m_peakEdges = required;
+
+    if (required > GetEdgeCapacity() && !ResizeEdgeStorage(required))
     {
         success = false;
+        m_stats.m_droppedPolys++;
     }
     else
     {
-        PolygonScanEdge *edges = &m_edgeStorage[m_currentEdge];
-        int edgeCount = poly->GetScanEdges(edges, clipRect);
+        int edgeCount = poly->GetScanEdges(m_edgeStorage, m_currentEdge, clipRect);
+        int const *firstLines = m_edgeStorage->m_firstLine;
+        int const *lastLines = m_edgeStorage->m_lastLine;
+        int *nextEdges = m_edgeStorage->m_nextEdge;
 
-        for (int p = 0; p < edgeCount; p++)
+        for (int p = m_currentEdge; p < m_currentEdge + edgeCount; p++)
         {
-            int firstLine = edges[p].m_firstLine >> SUBPIXEL_SHIFT;
-            int lastLine = edges[p].m_lastLine >> SUBPIXEL_SHIFT;
+            int firstLine = firstLines[p] >> SUBPIXEL_SHIFT;
+            int lastLine = lastLines[p] >> SUBPIXEL_SHIFT;
 
-            edges[p].m_nextEdge = m_edgeTable[firstLine];
-            m_edgeTable[firstLine] = &edges[p];
+            nextEdges[p] = m_edgeTable[firstLine];
+            m_edgeTable[firstLine] = p;
 
             m_verticalExtents.mark(firstLine,lastLine);
         }
 
         m_currentEdge += edgeCount;
+        m_stats.m_edges += edgeCount;
     }
 
+    // If the edge storage couldn't grow, nothing was added to the edge table, so
+    // there is nothing to clean up.
     if (success)
-        Fill(colour);
-    else
     {
-        for (unsigned y = 0; y < m_bitmap->height; y++)
-            m_edgeTable[y] = NULL;
+        if (m_timingEnabled)
+        {
+            double startTime = GetRealTime();
+            Fill(colour);
+            m_stats.m_fillSeconds += GetRealTime() - startTime;
+        }
+        else
+        {
+            Fill(colour);
+        }
     }
+
+    ApplyEdgeRetentionLimit();
 }
 
 
 // Renders the edges from the current vertical index using even-odd fill.
-inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanExtents &edgeExtents, int currentLine)
+inline void PolygonFiller::RenderEdges(SpanExtents &edgeExtents, int currentLine)
 {
     static const FIXED_POINT offsets[SUBPIXEL_COUNT] = SUBPIXEL_OFFSETS_FIXED;
 
@@ -525,25 +1223,31 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
     // to the next scanline. Add those that continue to the next scanline to the active
     // edge table. Clear the edge table.
 
-    PolygonScanEdge *prevEdge = NULL;
-    PolygonScanEdge *currentEdge = activeEdgeTable;
+    int *aetLastLine = m_activeEdges->m_lastLine;
+    FIXED_POINT *aetX = m_activeEdges->m_x;
+    FIXED_POINT *aetSlope = m_activeEdges->m_slope;
+    FIXED_POINT *aetSlopeFix = m_activeEdges->m_slopeFix;
 
-    while (currentEdge)
+    // The AET is kept dense. Edges that survive this scanline are compacted down to
+    // the front of the arrays as we go.
+    unsigned int keptCount = 0;
+
+    for (unsigned int i = 0; i < m_activeEdgeCount; i++)
     {
         // The plotting of all edges in the AET starts from the top of the scanline.
         // The plotting is divided to two stages: those that end on this scanline and
         // those that span over the full scanline.
 
-        int lastLine = currentEdge->m_lastLine >> SUBPIXEL_SHIFT;
+        int lastLine = aetLastLine[i] >> SUBPIXEL_SHIFT;
+        FIXED_POINT x = aetX[i];
+        FIXED_POINT slope = aetSlope[i];
+
+        // First x value rounded down.
+        int xs = FIXED_TO_INT(x);
 
         if (lastLine == currentLine)
         {
-            FIXED_POINT x = currentEdge->m_x;
-            FIXED_POINT slope = currentEdge->m_slope;
-
-            // First x value rounded down.
-            int xs = FIXED_TO_INT(x);
-            int ye = currentEdge->m_lastLine & (SUBPIXEL_COUNT - 1);
+            int ye = aetLastLine[i] & (SUBPIXEL_COUNT - 1);
 
             SUBPIXEL_DATA mask = 1;
             int ySub;
@@ -561,20 +1265,10 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
             // Mark the span.
             edgeExtents.markWithSort(xs,xe);
 
-            // Remove the edge from the active edge table
-            currentEdge = currentEdge->m_nextEdge;
-            if (prevEdge)
-                prevEdge->m_nextEdge = currentEdge;
-            else
-                activeEdgeTable = currentEdge;
+            // The edge is removed from the AET by not keeping it.
         }
         else
         {
-            FIXED_POINT x = currentEdge->m_x;
-            FIXED_POINT slope = currentEdge->m_slope;
-
-            // First x value rounded down.
-            int xs = FIXED_TO_INT(x);
             int xe;
 
             EVENODD_LINE_UNROLL_INIT();
@@ -594,25 +1288,40 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
             // Mark the span.
             edgeExtents.markWithSort(xs,xe);
 
-            // Update the edge
-            if ((currentLine & SLOPE_FIX_SCANLINE_MASK) == 0)
-                currentEdge->m_x = x + currentEdge->m_slopeFix;
-            else
-                currentEdge->m_x = x;
-
-            // Proceed forward in the AET.
-            prevEdge = currentEdge;
-            currentEdge = currentEdge->m_nextEdge;
+            // Keep the edge. Its x value is stepped to the next scanline below.
+            aetLastLine[keptCount] = aetLastLine[i];
+            aetX[keptCount] = aetX[i];
+            aetSlope[keptCount] = slope;
+            aetSlopeFix[keptCount] = aetSlopeFix[i];
+            keptCount++;
         }
     }
 
+    // Update the edges that continue onto the next scanline. This is done as a
+    // separate pass over the dense arrays so that the compiler can step several
+    // edges per SIMD instruction.
+    if ((currentLine & SLOPE_FIX_SCANLINE_MASK) == 0)
+    {
+        for (unsigned int i = 0; i < keptCount; i++)
+            aetX[i] += aetSlope[i] * SUBPIXEL_COUNT + aetSlopeFix[i];
+    }
+    else
+    {
+        for (unsigned int i = 0; i < keptCount; i++)
+            aetX[i] += aetSlope[i] * SUBPIXEL_COUNT;
+    }
+
     // Fetch edges from the edge table.
-    currentEdge = m_edgeTable[currentLine];
+    int currentEdge = m_edgeTable[currentLine];
 
-    if (currentEdge)
+    if (currentEdge >= 0)
     {
         // Clear the edge table for this line.
-        m_edgeTable[currentLine] = NULL;
+        m_edgeTable[currentLine] = -1;
+
+        int const *firstLines = m_edgeStorage->m_firstLine;
+        int const *lastLines = m_edgeStorage->m_lastLine;
+        int const *nextEdges = m_edgeStorage->m_nextEdge;
 
         do
         {
@@ -621,18 +1330,18 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
             // to two cases: either the scanning starts and stops within this scanline, or
             // it continues to the next as well.
 
-            int lastLine = currentEdge->m_lastLine >> SUBPIXEL_SHIFT;
+            int lastLine = lastLines[currentEdge] >> SUBPIXEL_SHIFT;
+            FIXED_POINT x = m_edgeStorage->m_x[currentEdge];
+            FIXED_POINT slope = m_edgeStorage->m_slope[currentEdge];
 
-            if (lastLine == currentLine)
-            {
-                FIXED_POINT x = currentEdge->m_x;
-                FIXED_POINT slope = currentEdge->m_slope;
+            // First x value rounded down.
+            int xs = FIXED_TO_INT(x);
 
-                // First x value rounded down.
-                int xs = FIXED_TO_INT(x);
+            int ys = firstLines[currentEdge] & (SUBPIXEL_COUNT - 1);
 
-                int ys = currentEdge->m_firstLine & (SUBPIXEL_COUNT - 1);
-                int ye = currentEdge->m_lastLine & (SUBPIXEL_COUNT - 1);
+            if (lastLine == currentLine)
+            {
+                int ye = lastLines[currentEdge] & (SUBPIXEL_COUNT - 1);
 
                 SUBPIXEL_DATA mask = 1 << ys;
                 int ySub;
@@ -654,14 +1363,6 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
             }
             else
             {
-                FIXED_POINT x = currentEdge->m_x;
-                FIXED_POINT slope = currentEdge->m_slope;
-
-                // First x value rounded down.
-                int xs = FIXED_TO_INT(x);
-
-                int ys = currentEdge->m_firstLine & (SUBPIXEL_COUNT - 1);
-
                 SUBPIXEL_DATA mask = 1 << ys;
                 int ySub;
                 for (ySub = ys; ySub < SUBPIXEL_COUNT; ySub++)
@@ -678,48 +1379,95 @@ inline void PolygonFiller::RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanE
                 // Mark the span.
                 edgeExtents.markWithSort(xs,xe);
 
-                // Update the edge
-                currentEdge->m_x = x;
-
                 // Add the edge to AET
-                if (prevEdge)
-                    prevEdge->m_nextEdge = currentEdge;
-                else
-                    activeEdgeTable = currentEdge;
-
-                prevEdge = currentEdge;
+                aetLastLine[keptCount] = lastLines[currentEdge];
+                aetX[keptCount] = x;
+                aetSlope[keptCount] = slope;
+                aetSlopeFix[keptCount] = m_edgeStorage->m_slopeFix[currentEdge];
+                keptCount++;
             }
 
-            currentEdge = currentEdge->m_nextEdge;
+            currentEdge = nextEdges[currentEdge];
         }
-        while (currentEdge);
+        while (currentEdge >= 0);
     }
 
-    if (prevEdge)
-        prevEdge->m_nextEdge = NULL;
+    m_activeEdgeCount = keptCount;
 }
 
 
-// Renders the mask to the canvas with even-odd fill.
+// Picks the pixel writer for the target format and blend mode. The choice is
+// made once per polygon, so there are no tests of either in the inner loop.
 void PolygonFiller::Fill(DfColour colour)
 {
+    switch (m_target.m_format)
+    {
+    case POLYGON_FORMAT_BGRA32:
+        if (m_blendMode == POLYGON_BLEND_OVER && m_linearBlending)
+            FillWith<LinearBgra32Writer>(colour);
+        else if (m_blendMode == POLYGON_BLEND_OVER)
+            FillWith<Bgra32Writer<POLYGON_BLEND_OVER> >(colour);
+        else if (m_blendMode == POLYGON_BLEND_REPLACE)
+            FillWith<Bgra32Writer<POLYGON_BLEND_REPLACE> >(colour);
+        else
+            FillWith<Bgra32Writer<POLYGON_BLEND_ADD> >(colour);
+        break;
+
+    case POLYGON_FORMAT_INDEXED8:
+        if (m_blendMode == POLYGON_BLEND_OVER)
+            FillWith<Indexed8Writer<POLYGON_BLEND_OVER> >(colour);
+        else if (m_blendMode == POLYGON_BLEND_REPLACE)
+            FillWith<Indexed8Writer<POLYGON_BLEND_REPLACE> >(colour);
+        else
+            FillWith<Indexed8Writer<POLYGON_BLEND_ADD> >(colour);
+        break;
+
+    case POLYGON_FORMAT_GRAY8:
+        if (m_blendMode == POLYGON_BLEND_OVER)
+            FillWith<Gray8Writer<POLYGON_BLEND_OVER> >(colour);
+        else if (m_blendMode == POLYGON_BLEND_REPLACE)
+            FillWith<Gray8Writer<POLYGON_BLEND_REPLACE> >(colour);
+        else
+            FillWith<Gray8Writer<POLYGON_BLEND_ADD> >(colour);
+        break;
+
+    case POLYGON_FORMAT_COVERAGE8:
+        if (m_blendMode == POLYGON_BLEND_OVER)
+            FillWith<Coverage8Writer<POLYGON_BLEND_OVER> >(colour);
+        else if (m_blendMode == POLYGON_BLEND_REPLACE)
+            FillWith<Coverage8Writer<POLYGON_BLEND_REPLACE> >(colour);
+        else
+            FillWith<Coverage8Writer<POLYGON_BLEND_ADD> >(colour);
+        break;
+    }
+}
+
+
+// Renders the mask to the canvas with even-odd fill.
+template <class Writer>
+void PolygonFiller::FillWith(DfColour colour)
+{
+    typedef typename Writer::Pixel Pixel;
+
+    Writer writer(colour, m_target);
+
     int minY = m_verticalExtents.m_minimum;
     int maxY = m_verticalExtents.m_maximum;
 
-    unsigned long cs1 = colour.c & 0xff00ff;
-    unsigned long cs2 = (colour.c >> 8) & 0xff00ff;
-
-    unsigned int pitch = m_bitmap->width;
-    DfColour *target = &m_bitmap->pixels[minY * pitch];
+    unsigned int pitch = m_target.m_pitch;
+    Pixel *target = (Pixel *)m_target.m_pixels + minY * pitch;
 
-    PolygonScanEdge *activeEdges = NULL;
+    m_activeEdgeCount = 0;
     SpanExtents edgeExtents;
 
+    if (maxY >= minY)
+        m_stats.m_scanlines += maxY - minY + 1;
+
     for (int y = minY; y <= maxY; y++)
     {
         edgeExtents.reset();
 
-        RenderEdges(activeEdges, edgeExtents, y);
+        RenderEdges(edgeExtents, y);
 
         int minX = edgeExtents.m_minimum;
         // Offset values are not taken into account when calculating the extents, so add
@@ -729,7 +1477,7 @@ void PolygonFiller::Fill(DfColour colour)
 
         if (minX < maxX)
         {
-            DfColour *tp = &target[minX];
+            Pixel *tp = &target[minX];
             SUBPIXEL_DATA *mb = &m_maskBuffer[minX];
             SUBPIXEL_DATA *end = &m_maskBuffer[maxX + 1];
 
@@ -765,39 +1513,31 @@ void PolygonFiller::Fill(DfColour colour)
                 else if (mask == SUBPIXEL_FULL_COVERAGE)
                 {
                     // Mask has full coverage, fill with aColor until mask changes.
+                    Pixel *runStart = tp;
                     SUBPIXEL_DATA temp;
                     do
                     {
-                        *tp++ = colour;
+                        writer.Put(tp++);
                         temp = *mb++;
                     }
                     while (temp == 0); // && mb <= end);
                     mb[-1] = 0;
                     mask ^= temp;
+                    m_stats.m_pixelsFilled += tp - runStart;
                 }
                 else
                 {
                     // Mask is semitransparent.
+                    Pixel *runStart = tp;
                     do
                     {
-                        unsigned long alpha = SUBPIXEL_COVERAGE(mask);
-
-                        // alpha is in range of 0 to SUBPIXEL_COUNT
-                        unsigned long invAlpha = SUBPIXEL_COUNT - alpha;
-
-                        unsigned long ct1 = (tp->c & 0xff00ff) * invAlpha;
-                        unsigned long ct2 = ((tp->c >> 8) & 0xff00ff) * invAlpha;
-
-                        ct1 = ((ct1 + cs1 * alpha) >> SUBPIXEL_SHIFT) & 0xff00ff;
-                        ct2 = ((ct2 + cs2 * alpha) << (8 - SUBPIXEL_SHIFT)) & 0xff00ff00;
-
-                        tp->c = ct1 + ct2;
-                        tp++;
+                        writer.Blend(tp++, SUBPIXEL_COVERAGE(mask));
 
                         mask ^= *mb;
                         *mb++ = 0;
                     }
                     while (!(mask == 0 || mask == SUBPIXEL_FULL_COVERAGE)); // && mb <= end);
+                    m_stats.m_pixelsBlended += tp - runStart;
                 }
             }
         }
@@ -807,68 +1547,48 @@ void PolygonFiller::Fill(DfColour colour)
 }
 
 
-bool PolygonFiller::ResizeEdgeStorage(int increment)
+bool PolygonFiller::ResizeEdgeStorage(unsigned int required)
 {
-    unsigned int newCount = m_edgeCount + increment;
-
-    PolygonScanEdge *newStorage = new PolygonScanEdge[newCount];
-    if (newStorage == NULL)
-        return false;
-
-    // Some pointer arithmetic to keep the linked lists in sync.
-    // Make this 64-bit just for future compatibility
-    INTEGER64 diff = (INTEGER64)newStorage - (INTEGER64)m_edgeStorage;
+    // Grow geometrically so that a run of ever larger polygons causes a logarithmic
+    // number of reallocations rather than one per polygon.
+    unsigned int newCount = std::max(required, GetEdgeCapacity() * 2);
 
-    for (unsigned n = 0; n < m_bitmap->height; n++)
+    if (!SetEdgeCapacity(newCount))
     {
-        if (m_edgeTable[n] != NULL)
-            m_edgeTable[n] = (PolygonScanEdge *)((INTEGER64)m_edgeTable[n] + diff);
+        // Couldn't get the extra headroom. Try for just what is needed.
+        if (newCount == required || !SetEdgeCapacity(required))
+            return false;
     }
 
-    // Copy edge storage...
-    memcpy(newStorage,m_edgeStorage,sizeof(PolygonScanEdge)*m_edgeCount);
-
-    // ...and fix the pointers.
-    for (unsigned n = 0; n < m_edgeCount; n++)
-    {
-        PolygonScanEdge *edge = &newStorage[n];
-        if (edge->m_nextEdge != NULL)
-            edge->m_nextEdge = (PolygonScanEdge *)((INTEGER64)edge->m_nextEdge + diff);
-    }
-
-    delete [] m_edgeStorage;
-    m_edgeStorage = newStorage;
-    m_edgeCount = newCount;
-
+    m_stats.m_edgeResizes++;
     return true;
 }
 
 
-void PolygonFiller::UnregisterBitmap()
+// Sets the capacity of both the edge storage and the active edge table. Edges
+// refer to each other by index, so this is just a realloc.
+bool PolygonFiller::SetEdgeCapacity(unsigned int count)
 {
-    delete[] m_maskBuffer;
-    delete[] m_edgeTable;
-    m_bitmap = NULL;
+    if (m_edgeArena && count <= m_edgeArenaCapacity)
+    {
+        UseEdgeArena();
+        return true;
+    }
+
+    return m_edgeStorage->Resize(count) && m_activeEdges->Resize(count);
 }
 
 
-void PolygonFiller::RegisterBitmap(DfBitmap *bmp)
+// Points the filler at the pixels to draw on. The scratch buffers only need to
+// change if the target is bigger than any seen before.
+bool PolygonFiller::SetTarget(PolygonTarget const &target)
 {
-    // The buffer used for filling needs to be three pixels wider than the bitmap.
-    // This is because of three reasons: first, the buffer used for filling needs
-    // to be one pixel wider because the end flag that turns the fill off is the
-    // first pixel after the actually drawn edge. Second, the edge tracking needs
-    // to add the maximum sample offset (i.e. 1) to the end of the edge. This
-    // requires one pixel more in the buffer to avoid reading of data from the
-    // left edge. Third, the rendering is stopped with an edge marker that is placed
-    // after the data, thus requiring one pixel more for the maximum case.
-    unsigned int bufferWidth = bmp->width + 3;
-
-    m_maskBuffer = new SUBPIXEL_DATA[bufferWidth];
-    memset(m_maskBuffer, 0, bufferWidth * sizeof(SUBPIXEL_DATA));
+    if (!m_scratch->Reserve(target.m_width, target.m_height))
+        return false;
 
-    m_edgeTable = new PolygonScanEdge*[bmp->height];
-    memset(m_edgeTable, 0, bmp->height * sizeof(PolygonScanEdge *));
+    m_target = target;
+    m_maskBuffer = m_scratch->m_maskBuffer;
+    m_edgeTable = m_scratch->m_edgeTable;
 
-    m_bitmap = bmp;
+    return true;
 }
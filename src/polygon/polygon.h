@@ -19,7 +19,7 @@
 
 
 class ClipRectangle;
-class PolygonScanEdge;
+class PolygonScanEdges;
 class VertexData;
 
 
@@ -33,13 +33,14 @@ public:
     PolygonData(int vertexCount);
     ~PolygonData();
 
-    // Calculates the edges of the polygon with transformation and clipping to aEdges array.
+    // Calculates the edges of the polygon with transformation and clipping and stores
+    // them in edges, starting at index firstEdge.
     // Note that this may return up to three times the amount of edges that the polygon has vertices,
     // in the unlucky case where both left and right side get clipped for all edges.
-    // \param aEdges the array for result edges. This should be able to contain 2*aVertexCount edges.
-    // \param aClipRectangle the clip rectangle.
+    // \param edges the storage for result edges. This should have room for 3*m_vertexCount edges after firstEdge.
+    // \param clipRectangle the clip rectangle.
     // \return the amount of edges in the result.
-    int GetScanEdges(PolygonScanEdge *edges, const ClipRectangle &clipRectangle) const;
+    int GetScanEdges(PolygonScanEdges *edges, int firstEdge, const ClipRectangle &clipRectangle) const;
 
 public:
     int m_vertexCount;
@@ -53,43 +54,233 @@ protected:
 };
 
 
+// The per-bitmap scratch buffers that a PolygonFiller needs: a coverage mask for
+// one row and a table of the edges that start on each row. They are sized to the
+// largest bitmap seen so far, so drawing to a different bitmap (eg. a layer or
+// another chart) only reallocates if it is bigger than anything before. Every
+// polygon leaves the buffers clear, so switching bitmaps needs no clearing and
+// several fillers on the same thread can share one PolygonScratch.
+class PolygonScratch
+{
+public:
+    PolygonScratch();
+    ~PolygonScratch();
+
+    // Makes sure the buffers can handle a bitmap of the given size. Returns false if
+    // the memory couldn't be allocated.
+    bool Reserve(unsigned int width, unsigned int height);
+
+    SUBPIXEL_DATA *m_maskBuffer;
+    int *m_edgeTable;               // Index of the first edge that starts on each line, or -1.
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_resizeCount;     // Number of times either buffer had to grow.
+};
+
+
+// Counters describing how a PolygonFiller has used its edge storage. The peak is
+// useful for sizing the storage up front with ReserveEdges() or SetEdgeArena().
+struct PolygonFillerStats
+{
+    unsigned int m_edgeResizes;     // Number of times the edge storage had to grow.
+    unsigned int m_peakEdges;       // Most edges that a single polygon needed room for.
+    unsigned int m_edgeCapacity;    // Number of edges the storage can currently hold.
+    unsigned int m_droppedPolys;    // Polygons not drawn because the storage couldn't grow.
+    unsigned int m_scratchResizes;  // Times the mask buffer or edge table had to grow.
+    bool m_usingArena;              // True if the edges are in caller supplied memory.
+
+    // Work done. These are always counted, per polygon, scanline or run of pixels,
+    // never per pixel. A filler that lives as long as the viewer can fill more than
+    // 2^32 pixels, so they are 64 bits.
+    unsigned long long m_polygons;
+    unsigned long long m_edges;             // Edges after clipping.
+    unsigned long long m_scanlines;
+    unsigned long long m_pixelsFilled;      // Pixels with full coverage.
+    unsigned long long m_pixelsBlended;     // Pixels with partial coverage.
+
+    // Only measured if SetTimingEnabled(true) was called.
+    double m_drawPolySeconds;       // Includes m_fillSeconds.
+    double m_fillSeconds;
+};
+
+
+// The pixel formats that a PolygonFiller can draw on.
+enum PolygonPixelFormat
+{
+    POLYGON_FORMAT_BGRA32,      // DfColour, as in a DfBitmap.
+    POLYGON_FORMAT_INDEXED8,    // One byte per pixel, an index into PolygonTarget::m_palette.
+    POLYGON_FORMAT_GRAY8,       // One byte per pixel, an intensity from 0 to 255.
+    POLYGON_FORMAT_COVERAGE8    // One byte per pixel, the coverage from 0 to SUBPIXEL_COUNT.
+};
+
+
+// How a PolygonFiller combines the polygon colour with the pixels it covers. For
+// partly covered pixels the colour is weighted by the coverage first.
+//
+// Indexed pixels can't be blended, so for POLYGON_FORMAT_INDEXED8 the over and
+// replace modes write the palette entry nearest the colour to pixels that are at
+// least half covered. The add mode instead increments the index of those pixels,
+// up to the last entry of the palette, which counts how many polygons overlap
+// each pixel if the palette is a ramp.
+//
+// POLYGON_FORMAT_COVERAGE8 ignores the colour. Its pixels are like an alpha
+// channel on their own: over combines the coverage of the polygon with what is
+// there as alpha compositing would, replace writes it, and add sums it, up to
+// SUBPIXEL_COUNT. See CompositeCoverage() for putting the result on a bitmap.
+enum PolygonBlendMode
+{
+    POLYGON_BLEND_OVER,         // Blend the colour over the pixel.
+    POLYGON_BLEND_REPLACE,      // Write the colour, ignoring the pixel. Coverage goes into alpha,
+                                // or into the intensity of a POLYGON_FORMAT_GRAY8 pixel.
+    POLYGON_BLEND_ADD           // Add the colour to the pixel, saturating at 255.
+};
+
+
+// The POLYGON_BLEND_OVER blend of a partly covered DfColour pixel, shared with
+// CompositeCoverage() so that the two give exactly the same pixels. alpha is in
+// the range 0 to SUBPIXEL_COUNT. Two channels are blended at a time, so the colour
+// is passed split into its red and blue, colour.c & 0xff00ff, and its alpha and
+// green, (colour.c >> 8) & 0xff00ff, which the caller works out once.
+inline void BlendCoverage(DfColour *p, unsigned long colourRB, unsigned long colourAG,
+                          unsigned long alpha)
+{
+    unsigned long invAlpha = SUBPIXEL_COUNT - alpha;
+
+    unsigned long ct1 = (p->c & 0xff00ff) * invAlpha;
+    unsigned long ct2 = ((p->c >> 8) & 0xff00ff) * invAlpha;
+
+    ct1 = ((ct1 + colourRB * alpha) >> SUBPIXEL_SHIFT) & 0xff00ff;
+    ct2 = ((ct2 + colourAG * alpha) << (8 - SUBPIXEL_SHIFT)) & 0xff00ff00;
+
+    p->c = ct1 + ct2;
+}
+
+
+// Describes a block of pixels that a PolygonFiller can draw on.
+struct PolygonTarget
+{
+    void *m_pixels;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_pitch;               // Pixels from the start of one row to the next.
+    PolygonPixelFormat m_format;
+    DfColour const *m_palette;          // Only for POLYGON_FORMAT_INDEXED8.
+    unsigned int m_paletteSize;
+
+    PolygonTarget();
+    PolygonTarget(DfBitmap *bmp);
+    PolygonTarget(void *pixels, unsigned int width, unsigned int height, unsigned int pitch,
+                  PolygonPixelFormat format);
+};
+
+
 // A class used to render a polygon onto a bitmap.
 class PolygonFiller
 {
 public:
-    PolygonFiller();
+    enum { DEFAULT_EDGE_CAPACITY = 60 };
+
+    // If scratch is NULL the filler creates its own. Otherwise the caller owns it
+    // and must keep it alive for as long as the filler.
+    PolygonFiller(PolygonScratch *scratch = NULL);
     ~PolygonFiller();
 
     void DrawPoly(DfBitmap *bmp, const PolygonData *polyData, DfColour colour);
 
+    // As above, but onto pixels of any PolygonPixelFormat, with any PolygonBlendMode.
+    // Each combination has its own specialised inner loop. SetLinearBlending() only
+    // affects POLYGON_FORMAT_BGRA32 with POLYGON_BLEND_OVER.
+    void DrawPoly(PolygonTarget const &target, const PolygonData *polyData, DfColour colour,
+                  PolygonBlendMode blend = POLYGON_BLEND_OVER);
+
+    // Restricts drawing to a rectangle of the target bitmap. Polygons are clipped
+    // to the intersection of this rectangle and the bitmap, so edges outside it
+    // never reach the edge table.
+    void SetClipRect(int x, int y, int width, int height);
+    void ClearClipRect();
+
+    // Makes sure the edge storage can hold edgeCount edges, so that no resizing
+    // happens while drawing. A polygon with n vertices needs room for up to 3n + 1.
+    bool ReserveEdges(unsigned int edgeCount);
+
+    // By default the edge storage stays at its high water mark. A non-zero limit
+    // makes the filler give back anything above that many edges after each polygon.
+    void SetEdgeRetentionLimit(unsigned int edgeCount);
+
+    // Makes the filler take its edge storage from memory owned by the caller rather
+    // than from the heap. The memory must stay valid until the filler is destroyed or
+    // SetEdgeArena(NULL, 0) is called. A polygon that needs more edges than fit in
+    // the arena moves the storage to the heap.
+    void SetEdgeArena(void *memory, unsigned int bytes);
+
+    // Returns the size of arena needed to hold edgeCount edges.
+    static unsigned int GetEdgeArenaBytes(unsigned int edgeCount);
+
+    PolygonFillerStats GetStats() const;
+
+    // Times DrawPoly() and Fill() into the stats. This costs two calls to
+    // GetRealTime() per polygon, so it is off by default.
+    void SetTimingEnabled(bool enabled);
+
+    // Blends the partly covered pixels at the edges of polygons in linear light,
+    // rather than on the sRGB values. The edges of thin and diagonal lines then
+    // keep the weight of the line, instead of looking thin and blotchy. It costs a
+    // few table lookups per edge pixel, so it is off by default.
+    void SetLinearBlending(bool enabled);
+
 protected:
     // Renders the edges from the current vertical index using even-odd fill.
-    inline void RenderEdges(PolygonScanEdge * &activeEdgeTable, SpanExtents &edgeExtents, int currentLine);
+    inline void RenderEdges(SpanExtents &edgeExtents, int currentLine);
+
+    void DrawPolyInternal(const PolygonData *polyData, DfColour colour);
 
-    // Renders the mask to the canvas with even-odd fill.
+    // Renders the mask to the canvas with even-odd fill, using the pixel writer
+    // for the target format and blend mode.
     void Fill(DfColour colour);
+    template <class Writer> void FillWith(DfColour colour);
 
-    // Resizes the edge storage.
-    bool ResizeEdgeStorage(int increment);
+    // Grows the edge storage so that it can hold at least required edges.
+    bool ResizeEdgeStorage(unsigned int required);
+    bool SetEdgeCapacity(unsigned int count);
+    inline unsigned int GetEdgeCapacity() const;
 
-    // Returns the amount of free edges in the edge storage.
-    inline int GetFreeEdgeCount()
-    {
-        return m_edgeCount - m_currentEdge - 1;
-    }
+    void UseEdgeArena();
+    void ApplyEdgeRetentionLimit();
 
-    void RegisterBitmap(DfBitmap *bmp);
-    void UnregisterBitmap();
+    bool SetTarget(PolygonTarget const &target);
 
-    DfBitmap *m_bitmap;   // Bitmap that we have registered
+    PolygonTarget m_target;         // Pixels that the current polygon is being drawn on
+    PolygonBlendMode m_blendMode;
 
+    bool m_clipEnabled;
+    int m_clipX;
+    int m_clipY;
+    int m_clipWidth;
+    int m_clipHeight;
+
+    PolygonScratch *m_scratch;
+    bool m_ownsScratch;
+
+    // Copies of the pointers in m_scratch, which may change if another filler sharing
+    // the scratch grows it.
     SUBPIXEL_DATA *m_maskBuffer;
+    int *m_edgeTable;
+
     SpanExtents m_verticalExtents;
 
-    PolygonScanEdge **m_edgeTable;
-    PolygonScanEdge *m_edgeStorage;
-    unsigned int m_edgeCount;
+    PolygonScanEdges *m_edgeStorage;
     unsigned int m_currentEdge;
+
+    PolygonScanEdges *m_activeEdges;    // Dense list of the edges that cross the current line.
+    unsigned int m_activeEdgeCount;
+
+    void *m_edgeArena;                  // Caller supplied memory for edges, or NULL.
+    unsigned int m_edgeArenaCapacity;   // Number of edges that fit in the arena.
+    unsigned int m_edgeRetentionLimit;
+
+    PolygonFillerStats m_stats;
+    bool m_timingEnabled;
+    bool m_linearBlending;
 };
 
 
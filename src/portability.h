@@ -0,0 +1,11 @@
+#pragma once
+
+
+// Shims for the MSVC-isms in the code base, so that it also builds with GCC and
+// Clang.
+
+#ifndef _MSC_VER
+#include <strings.h>
+#define stricmp strcasecmp
+#define strnicmp strncasecmp
+#endif
@@ -0,0 +1,344 @@
+#include "render_cache.h"
+
+// Project headers
+#include "hash.h"
+#include "message_sequence_chart.h"
+#include "stats.h"
+#include "tokenizer.h"
+
+// Standard headers
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+
+static bool CopyFileContents(char const *srcFilename, char const *dstFilename)
+{
+    FILE *in = fopen(srcFilename, "rb");
+    if (!in) {
+        return false;
+    }
+
+    FILE *out = fopen(dstFilename, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+
+    bool ok = true;
+    static int const BUF_SIZE = 65536;
+    char *buf = new char[BUF_SIZE];
+    while (1) {
+        size_t n = fread(buf, 1, BUF_SIZE, in);
+        if (n == 0) {
+            ok = !ferror(in);
+            break;
+        }
+        if (fwrite(buf, 1, n, out) != n) {
+            ok = false;
+            break;
+        }
+    }
+    delete[] buf;
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        remove(dstFilename);
+    }
+
+    return ok;
+}
+
+
+static bool MakeHardLink(char const *existingFilename, char const *newFilename)
+{
+#ifdef _WIN32
+    return CreateHardLinkA(newFilename, existingFilename, NULL) != 0;
+#else
+    return link(existingFilename, newFilename) == 0;
+#endif
+}
+
+
+static void TouchFile(char const *filename)
+{
+#ifdef _WIN32
+    _utime(filename, NULL);
+#else
+    utime(filename, NULL);
+#endif
+}
+
+
+static bool IsEntryName(char const *name)
+{
+    int len = strlen(name);
+    if (len != 16) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char)name[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct CacheEntry
+{
+    std::string m_filename;
+    long long m_size;
+    long long m_lastUsed;   // In 100ns units on Windows and ns elsewhere.
+};
+
+
+// Whole seconds would make most of the entries of a busy cache the same age, and
+// then which of them went first would be down to the order they were listed in.
+// Ties, which are rare at this resolution, go by name.
+static bool IsOlder(CacheEntry const &a, CacheEntry const &b)
+{
+    if (a.m_lastUsed != b.m_lastUsed) {
+        return a.m_lastUsed < b.m_lastUsed;
+    }
+    return a.m_filename < b.m_filename;
+}
+
+
+// Lists the cache entries in dir, ignoring any other files.
+static void ListEntries(std::string const &dir, std::vector <CacheEntry> *entries)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "/*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsEntryName(data.cFileName)) {
+            CacheEntry e;
+            e.m_filename = dir + "/" + data.cFileName;
+            e.m_size = ((long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+            e.m_lastUsed = ((long long)data.ftLastWriteTime.dwHighDateTime << 32) |
+                           data.ftLastWriteTime.dwLowDateTime;
+            entries->push_back(e);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    while (dirent *de = readdir(d)) {
+        if (!IsEntryName(de->d_name)) {
+            continue;
+        }
+
+        CacheEntry e;
+        e.m_filename = dir + "/" + de->d_name;
+        struct stat st;
+        if (stat(e.m_filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        e.m_size = st.st_size;
+        e.m_lastUsed = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        entries->push_back(e);
+    }
+    closedir(d);
+#endif
+}
+
+
+RenderCache::RenderCache(char const *dir, long long maxBytes)
+{
+    m_dir = dir;
+    m_maxBytes = maxBytes;
+
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+}
+
+
+bool RenderCache::MakeKey(char const *chartFilename, char const *options, std::string *key)
+{
+    Tokenizer ts;
+    if (!ts.Open(chartFilename)) {
+        return false;
+    }
+
+    char version[32];
+    sprintf(version, "%d", CHART_RENDER_VERSION);
+
+    // Each string is hashed with its terminator, so that "ab" "c" and "a" "bc"
+    // give different hashes.
+    unsigned long long h = HASH_INITIAL_VALUE;
+    h = HashBytes(h, version, strlen(version) + 1);
+    h = HashBytes(h, options, strlen(options) + 1);
+    while (1) {
+        char const *tok = ts.GetToken();
+        if (*tok == '\0') {
+            break;
+        }
+        h = HashBytes(h, tok, strlen(tok) + 1);
+    }
+
+    char buf[17];
+    sprintf(buf, "%08x%08x", (unsigned)(h >> 32), (unsigned)h);
+    *key = buf;
+    return true;
+}
+
+
+std::string RenderCache::GetEntryFilename(std::string const &key) const
+{
+    return m_dir + "/" + key;
+}
+
+
+// Not a valid entry name, so ListEntries() ignores it.
+std::string RenderCache::GetTotalBytesFilename() const
+{
+    return m_dir + "/total_bytes";
+}
+
+
+bool RenderCache::ReadTotalBytes(long long *totalBytes) const
+{
+    FILE *f = fopen(GetTotalBytesFilename().c_str(), "r");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = fscanf(f, "%lld", totalBytes) == 1 && *totalBytes >= 0;
+    fclose(f);
+    return ok;
+}
+
+
+void RenderCache::WriteTotalBytes(long long totalBytes) const
+{
+    FILE *f = fopen(GetTotalBytesFilename().c_str(), "w");
+    if (!f) {
+        return;
+    }
+
+    fprintf(f, "%lld\n", totalBytes);
+    fclose(f);
+}
+
+
+bool RenderCache::Fetch(std::string const &key, char const *outputFilename)
+{
+    std::string entryFilename = GetEntryFilename(key);
+
+    struct stat st;
+    if (stat(entryFilename.c_str(), &st) != 0) {
+        StatsCount(STAT_COUNTER_CACHE_MISSES);
+        return false;
+    }
+
+    remove(outputFilename);
+    if (!MakeHardLink(entryFilename.c_str(), outputFilename) &&
+        !CopyFileContents(entryFilename.c_str(), outputFilename)) {
+        StatsCount(STAT_COUNTER_CACHE_MISSES);
+        return false;
+    }
+
+    TouchFile(entryFilename.c_str());
+    StatsCount(STAT_COUNTER_CACHE_HITS);
+    return true;
+}
+
+
+void RenderCache::Store(std::string const &key, char const *outputFilename)
+{
+    // Copy to a temporary name and then rename, so that another process never
+    // sees a partly written entry.
+    std::string entryFilename = GetEntryFilename(key);
+    char suffix[32];
+#ifdef _WIN32
+    sprintf(suffix, ".tmp%d", _getpid());
+#else
+    sprintf(suffix, ".tmp%d", (int)getpid());
+#endif
+    std::string tmpFilename = entryFilename + suffix;
+
+    if (!CopyFileContents(outputFilename, tmpFilename.c_str())) {
+        return;
+    }
+
+    // An entry with the same key is replaced, so its size comes off the total.
+    struct stat st;
+    long long oldSize = stat(entryFilename.c_str(), &st) == 0 ? st.st_size : 0;
+
+    if (rename(tmpFilename.c_str(), entryFilename.c_str()) != 0) {
+        // Windows won't rename over an existing file.
+        remove(entryFilename.c_str());
+        if (rename(tmpFilename.c_str(), entryFilename.c_str()) != 0) {
+            remove(tmpFilename.c_str());
+            return;
+        }
+    }
+
+    long long totalBytes;
+    if (stat(entryFilename.c_str(), &st) != 0 || !ReadTotalBytes(&totalBytes)) {
+        Trim(entryFilename);
+        return;
+    }
+
+    totalBytes += st.st_size - oldSize;
+    if (totalBytes > m_maxBytes) {
+        Trim(entryFilename);
+    }
+    else {
+        WriteTotalBytes(totalBytes);
+    }
+}
+
+
+// keepFilename is left alone, so that a store is never undone by its own trim.
+void RenderCache::Trim(std::string const &keepFilename)
+{
+    std::vector <CacheEntry> entries;
+    ListEntries(m_dir, &entries);
+
+    long long totalBytes = 0;
+    for (int i = 0; i < entries.size(); i++) {
+        totalBytes += entries[i].m_size;
+    }
+
+    std::sort(entries.begin(), entries.end(), IsOlder);
+    for (int i = 0; i < entries.size() && totalBytes > m_maxBytes; i++) {
+        if (entries[i].m_filename == keepFilename) {
+            continue;
+        }
+        if (remove(entries[i].m_filename.c_str()) == 0) {
+            totalBytes -= entries[i].m_size;
+            StatsCount(STAT_COUNTER_CACHE_EVICTIONS);
+        }
+    }
+
+    WriteTotalBytes(totalBytes);
+}
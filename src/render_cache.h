@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+
+
+// An on-disk cache of rendered charts, so that a chart that hasn't changed since
+// it was last rendered doesn't have to be parsed or rendered again. Entries are
+// named after a hash of the chart's tokens and the render options. Because it
+// hashes tokens rather than bytes, changes to white space and comments don't
+// cause a miss.
+//
+// A hit is written to the output file as a hard link to the cache entry if the
+// file system allows it, and as a copy if not. So anything that writes the output
+// file must delete it first rather than overwrite it in place.
+//
+// The cache is kept under its size limit by deleting the least recently used
+// entries. A hit updates the modification time of the entry, which is what
+// "used" means. The entry that has just been stored is never deleted, even if it
+// is bigger than the limit on its own. Listing the entries is slow when there are
+// many, so the total size of the entries is kept in a file called total_bytes,
+// and the cache is only trimmed when that says the limit has been passed.
+//
+// The total isn't locked, so processes that store at the same time can lose each
+// other's updates to it. The limit is therefore approximate: the cache can grow
+// past it until a store sees that it has, and then the trim, which lists every
+// entry, corrects the total.
+class RenderCache
+{
+private:
+    std::string m_dir;
+    long long m_maxBytes;
+
+    std::string GetEntryFilename(std::string const &key) const;
+    std::string GetTotalBytesFilename() const;
+    bool ReadTotalBytes(long long *totalBytes) const;
+    void WriteTotalBytes(long long totalBytes) const;
+    void Trim(std::string const &keepFilename);
+
+public:
+    RenderCache(char const *dir, long long maxBytes);
+
+    // Returns false if the chart file couldn't be read. options should describe
+    // everything other than the chart that affects the output, eg. the file format.
+    static bool MakeKey(char const *chartFilename, char const *options, std::string *key);
+
+    // On a hit, writes the cached output to outputFilename and returns true.
+    bool Fetch(std::string const &key, char const *outputFilename);
+
+    // Adds a copy of outputFilename to the cache, and trims the other entries if the
+    // cache has grown too big.
+    void Store(std::string const &key, char const *outputFilename);
+};
@@ -0,0 +1,110 @@
+#include "stats.h"
+
+// Project headers
+#include "polygon/polygon.h"
+
+// Standard headers
+#include <mutex>
+
+
+bool g_statsEnabled = false;
+
+static std::mutex g_statsMutex;
+static double g_timerSeconds[NUM_STAT_TIMERS];
+static long long g_timerCalls[NUM_STAT_TIMERS];
+static long long g_counters[NUM_STAT_COUNTERS];
+
+static char const *g_timerNames[NUM_STAT_TIMERS] = {
+    "load",
+    "layout",
+    "render",
+    "render_arrow",
+    "render_box",
+    "render_zoomed_out",
+    "draw_poly",
+    "fill",
+    "encode"
+};
+
+static char const *g_counterNames[NUM_STAT_COUNTERS] = {
+    "arcs_rendered",
+    "bands",
+    "polygons",
+    "edges",
+    "scanlines",
+    "pixels_filled",
+    "pixels_blended",
+    "bytes_encoded",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions"
+};
+
+
+void StatsAddTime(StatTimer timer, double seconds)
+{
+    std::lock_guard <std::mutex> lock(g_statsMutex);
+    g_timerSeconds[timer] += seconds;
+    g_timerCalls[timer]++;
+}
+
+
+void StatsAddCount(StatCounter counter, long long n)
+{
+    std::lock_guard <std::mutex> lock(g_statsMutex);
+    g_counters[counter] += n;
+}
+
+
+// Polygon fillers keep their own stats, to keep the stats module out of the inner
+// loops. Each filler's stats must be added once, when it is finished with.
+void StatsAddFillerStats(PolygonFillerStats const &fillerStats)
+{
+    std::lock_guard <std::mutex> lock(g_statsMutex);
+    g_timerSeconds[STAT_TIMER_DRAW_POLY] += fillerStats.m_drawPolySeconds;
+    g_timerCalls[STAT_TIMER_DRAW_POLY] += fillerStats.m_polygons;
+    g_timerSeconds[STAT_TIMER_FILL] += fillerStats.m_fillSeconds;
+    g_timerCalls[STAT_TIMER_FILL] += fillerStats.m_polygons - fillerStats.m_droppedPolys;
+    g_counters[STAT_COUNTER_POLYGONS] += fillerStats.m_polygons;
+    g_counters[STAT_COUNTER_EDGES] += fillerStats.m_edges;
+    g_counters[STAT_COUNTER_SCANLINES] += fillerStats.m_scanlines;
+    g_counters[STAT_COUNTER_PIXELS_FILLED] += fillerStats.m_pixelsFilled;
+    g_counters[STAT_COUNTER_PIXELS_BLENDED] += fillerStats.m_pixelsBlended;
+}
+
+
+void StatsPrint(FILE *out)
+{
+    std::lock_guard <std::mutex> lock(g_statsMutex);
+
+    fprintf(out, "%-20s %12s %10s\n", "Timer", "ms", "calls");
+    for (int i = 0; i < NUM_STAT_TIMERS; i++) {
+        fprintf(out, "%-20s %12.3f %10lld\n", g_timerNames[i], g_timerSeconds[i] * 1000.0,
+                g_timerCalls[i]);
+    }
+
+    fprintf(out, "\n%-20s %12s\n", "Counter", "count");
+    for (int i = 0; i < NUM_STAT_COUNTERS; i++) {
+        fprintf(out, "%-20s %12lld\n", g_counterNames[i], g_counters[i]);
+    }
+}
+
+
+void StatsPrintJson(FILE *out)
+{
+    std::lock_guard <std::mutex> lock(g_statsMutex);
+
+    fprintf(out, "{\n  \"timers\": {\n");
+    for (int i = 0; i < NUM_STAT_TIMERS; i++) {
+        fprintf(out, "    \"%s\": { \"seconds\": %.9f, \"calls\": %lld }%s\n", g_timerNames[i],
+                g_timerSeconds[i], g_timerCalls[i], i + 1 < NUM_STAT_TIMERS ? "," : "");
+    }
+
+    fprintf(out, "  },\n  \"counters\": {\n");
+    for (int i = 0; i < NUM_STAT_COUNTERS; i++) {
+        fprintf(out, "    \"%s\": %lld%s\n", g_counterNames[i], g_counters[i],
+                i + 1 < NUM_STAT_COUNTERS ? "," : "");
+    }
+
+    fprintf(out, "  }\n}\n");
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "df_time.h"
+
+#include <stdio.h>
+
+
+struct PolygonFillerStats;
+
+
+// Timers and counters for finding out where the time goes. Nothing is recorded
+// unless g_statsEnabled is set, so when it is off, a timer or counter costs one
+// test of a global bool.
+
+enum StatTimer {
+    STAT_TIMER_LOAD,
+    STAT_TIMER_LAYOUT,
+    STAT_TIMER_RENDER,
+    STAT_TIMER_RENDER_ARROW,
+    STAT_TIMER_RENDER_BOX,
+    STAT_TIMER_RENDER_ZOOMED_OUT,
+    STAT_TIMER_DRAW_POLY,       // From the polygon fillers.
+    STAT_TIMER_FILL,            // From the polygon fillers.
+    STAT_TIMER_ENCODE,
+    NUM_STAT_TIMERS
+};
+
+enum StatCounter {
+    STAT_COUNTER_ARCS_RENDERED,
+    STAT_COUNTER_BANDS,
+    STAT_COUNTER_POLYGONS,
+    STAT_COUNTER_EDGES,
+    STAT_COUNTER_SCANLINES,
+    STAT_COUNTER_PIXELS_FILLED,
+    STAT_COUNTER_PIXELS_BLENDED,
+    STAT_COUNTER_BYTES_ENCODED,
+    STAT_COUNTER_CACHE_HITS,
+    STAT_COUNTER_CACHE_MISSES,
+    STAT_COUNTER_CACHE_EVICTIONS,
+    NUM_STAT_COUNTERS
+};
+
+
+extern bool g_statsEnabled;
+
+// These are thread safe, but should only be called if g_statsEnabled is set.
+void StatsAddTime(StatTimer timer, double seconds);
+void StatsAddCount(StatCounter counter, long long n);
+void StatsAddFillerStats(PolygonFillerStats const &fillerStats);
+
+// Timers are inclusive, eg. RenderArrow includes the DrawPoly calls it makes.
+void StatsPrint(FILE *out);
+void StatsPrintJson(FILE *out);
+
+
+inline void StatsCount(StatCounter counter, long long n = 1)
+{
+    if (g_statsEnabled) {
+        StatsAddCount(counter, n);
+    }
+}
+
+
+// Adds the time between construction and destruction to a timer.
+class ScopedStatTimer
+{
+private:
+    StatTimer m_timer;
+    double m_startTime;
+
+public:
+    ScopedStatTimer(StatTimer timer) {
+        m_timer = timer;
+        m_startTime = g_statsEnabled ? GetRealTime() : 0.0;
+    }
+
+    ~ScopedStatTimer() {
+        if (g_statsEnabled) {
+            StatsAddTime(m_timer, GetRealTime() - m_startTime);
+        }
+    }
+};
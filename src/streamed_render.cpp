@@ -0,0 +1,334 @@
+#include "streamed_render.h"
+
+// Project headers
+#include "antialiased_draw.h"
+#include "bmp_stream_writer.h"
+#include "chart_stream.h"
+#include "message_sequence_chart.h"
+#include "polygon/polygon.h"
+#include "stats.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// The two band buffers and their hand-over between the render thread and the
+// encoder thread.
+struct BandPipeline
+{
+    enum { NUM_BUFFERS = 2 };
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    DfBitmap *m_bands[NUM_BUFFERS];
+    int m_numRows[NUM_BUFFERS];
+    bool m_full[NUM_BUFFERS];   // True from when a band is rendered until it is encoded.
+    bool m_finished;            // No more bands will be rendered.
+    bool m_failed;              // The encoder couldn't write a band.
+    int m_next;                 // The buffer the next band is rendered into.
+    std::thread m_encoder;
+};
+
+
+static void EncoderMain(BandPipeline *pipeline, BmpStreamWriter *writer)
+{
+    int i = 0;
+    while (1) {
+        int numRows;
+        {
+            std::unique_lock <std::mutex> lock(pipeline->m_mutex);
+            while (!pipeline->m_full[i] && !pipeline->m_finished) {
+                pipeline->m_changed.wait(lock);
+            }
+            if (!pipeline->m_full[i]) {
+                return;
+            }
+            numRows = pipeline->m_numRows[i];
+        }
+
+        bool ok = writer->WriteRows(pipeline->m_bands[i], numRows);
+
+        {
+            std::lock_guard <std::mutex> lock(pipeline->m_mutex);
+            pipeline->m_full[i] = false;
+            if (!ok) {
+                pipeline->m_failed = true;
+            }
+        }
+        pipeline->m_changed.notify_all();
+
+        if (!ok) {
+            return;
+        }
+
+        i = (i + 1) % BandPipeline::NUM_BUFFERS;
+    }
+}
+
+
+static void StartPipeline(BandPipeline *pipeline, BmpStreamWriter *writer, int width, int bandHeight)
+{
+    for (int i = 0; i < BandPipeline::NUM_BUFFERS; i++) {
+        pipeline->m_bands[i] = BitmapCreate(width, bandHeight);
+        pipeline->m_numRows[i] = 0;
+        pipeline->m_full[i] = false;
+    }
+    pipeline->m_finished = false;
+    pipeline->m_failed = false;
+    pipeline->m_next = 0;
+    pipeline->m_encoder = std::thread(EncoderMain, pipeline, writer);
+}
+
+
+// Renders numRows rows of the chart, starting at chart Y coordinate y, and hands
+// them to the encoder. Returns false if the encoder has failed.
+static bool RenderBand(BandPipeline *pipeline, MessageSequenceChart *chart, int y, int numRows)
+{
+    int i = pipeline->m_next;
+
+    // Wait for the encoder to finish with this buffer.
+    {
+        std::unique_lock <std::mutex> lock(pipeline->m_mutex);
+        while (pipeline->m_full[i] && !pipeline->m_failed) {
+            pipeline->m_changed.wait(lock);
+        }
+        if (pipeline->m_failed) {
+            return false;
+        }
+    }
+
+    DfBitmap *band = pipeline->m_bands[i];
+    BitmapClear(band, g_colourWhite);
+    chart->Render(band, y);
+    StatsCount(STAT_COUNTER_BANDS);
+
+    {
+        std::lock_guard <std::mutex> lock(pipeline->m_mutex);
+        pipeline->m_numRows[i] = numRows;
+        pipeline->m_full[i] = true;
+    }
+    pipeline->m_changed.notify_all();
+
+    pipeline->m_next = (i + 1) % BandPipeline::NUM_BUFFERS;
+    return true;
+}
+
+
+// Waits for the encoder to write the bands it has been given. Returns false if it
+// failed.
+static bool FinishPipeline(BandPipeline *pipeline)
+{
+    {
+        std::lock_guard <std::mutex> lock(pipeline->m_mutex);
+        pipeline->m_finished = true;
+    }
+    pipeline->m_changed.notify_all();
+    pipeline->m_encoder.join();
+
+    for (int i = 0; i < BandPipeline::NUM_BUFFERS; i++) {
+        BitmapDelete(pipeline->m_bands[i]);
+    }
+
+    return !pipeline->m_failed;
+}
+
+
+bool RenderChartToBmpFile(MessageSequenceChart *chart, int width, int height, int bandHeight,
+                          char const *filename)
+{
+    BmpStreamWriter writer;
+    if (!writer.Open(filename, width, height)) {
+        return false;
+    }
+
+    if (bandHeight > height) {
+        bandHeight = height;
+    }
+
+    BandPipeline pipeline;
+    StartPipeline(&pipeline, &writer, width, bandHeight);
+
+    for (int y = 0; y < height; y += bandHeight) {
+        int numRows = height - y < bandHeight ? height - y : bandHeight;
+        if (!RenderBand(&pipeline, chart, y, numRows)) {
+            break;
+        }
+    }
+
+    bool ok = FinishPipeline(&pipeline);
+    if (!writer.Close()) {
+        ok = false;
+    }
+
+    return ok;
+}
+
+
+bool RenderChartStreamToBmpFile(MessageSequenceChart *chart, ChartStream *stream, int bandHeight,
+                                char const *filename, ChartError *err)
+{
+    // Nothing can be drawn until the width is known.
+    while (!stream->IsHeaderComplete()) {
+        if (!stream->Update(true, err)) {
+            return false;
+        }
+    }
+
+    int width = chart->GetWidth();
+    BmpStreamWriter writer;
+    if (!writer.Open(filename, width, 0)) {
+        err->m_message[0] = '\0';
+        return false;
+    }
+
+    BandPipeline pipeline;
+    StartPipeline(&pipeline, &writer, width, bandHeight);
+
+    // Each band is rendered as soon as all of its rows are complete. Then the arcs
+    // above it can be thrown away, so memory use doesn't grow with the input.
+    bool ok = true;
+    int y = 0;
+    while (ok) {
+        int completeHeight = stream->GetCompleteHeight();
+        while (ok && completeHeight - y >= bandHeight) {
+            ok = RenderBand(&pipeline, chart, y, bandHeight);
+            y += bandHeight;
+            chart->DiscardArcsAbove(y);
+        }
+
+        if (stream->IsFinished()) {
+            if (ok && y < completeHeight) {
+                ok = RenderBand(&pipeline, chart, y, completeHeight - y);
+            }
+            break;
+        }
+
+        if (ok && !stream->Update(true, err)) {
+            FinishPipeline(&pipeline);
+            writer.Close();
+            return false;
+        }
+    }
+
+    if (!FinishPipeline(&pipeline)) {
+        ok = false;
+    }
+    if (!writer.Close()) {
+        ok = false;
+    }
+    if (!ok) {
+        err->m_message[0] = '\0';
+    }
+
+    return ok;
+}
+
+
+// Inserts the page number before the extension, padded so that the files sort
+// in page order.
+static std::string GetPageFilename(char const *filename, int pageNum, int numPages)
+{
+    char digits[16];
+    int numDigits = sprintf(digits, "%d", numPages);
+    char number[32];
+    sprintf(number, "_%0*d", numDigits, pageNum);
+
+    std::string rv = filename;
+    size_t dot = rv.rfind('.');
+    size_t slash = rv.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = rv.size();
+    }
+    rv.insert(dot, number);
+    return rv;
+}
+
+
+struct PageJob
+{
+    MessageSequenceChart *m_chart;
+    std::vector <ChartPage> const *m_pages;
+    std::vector <std::string> const *m_filenames;
+    int m_bitmapHeight;
+};
+
+
+// Renders and writes every step'th page, starting with page first. Sets *ok to
+// false if a file couldn't be written.
+static void PageWorkerMain(PageJob const *job, int first, int step, bool *ok)
+{
+    // Each worker needs its own polygon filler.
+    AntialiasedDraw aaDraw;
+    aaDraw.SetTimingEnabled(g_statsEnabled);
+    aaDraw.SetLinearBlending(g_linearBlending);
+    RenderContext ctx(&aaDraw);
+    int width = job->m_chart->GetWidth();
+    DfBitmap *bmp = BitmapCreate(width, job->m_bitmapHeight);
+
+    *ok = true;
+    for (int i = first; i < job->m_pages->size(); i += step) {
+        ChartPage const &page = (*job->m_pages)[i];
+        int height = job->m_chart->GetPageHeight(page);
+        BitmapClear(bmp, g_colourWhite);
+        job->m_chart->RenderPage(bmp, page, &ctx);
+
+        BmpStreamWriter writer;
+        bool written = writer.Open((*job->m_filenames)[i].c_str(), width, height);
+        written = written && writer.WriteRows(bmp, height);
+        if (!writer.Close() || !written) {
+            *ok = false;
+        }
+    }
+
+    BitmapDelete(bmp);
+
+    if (g_statsEnabled) {
+        StatsAddFillerStats(aaDraw.GetFillerStats());
+    }
+}
+
+
+bool RenderChartPagesToBmpFiles(MessageSequenceChart *chart, int pageHeight, char const *filename)
+{
+    std::vector <ChartPage> pages;
+    chart->GetPages(pageHeight, &pages);
+
+    PageJob job;
+    job.m_chart = chart;
+    job.m_pages = &pages;
+    job.m_bitmapHeight = 0;
+    std::vector <std::string> filenames;
+    for (int i = 0; i < pages.size(); i++) {
+        filenames.push_back(GetPageFilename(filename, i + 1, pages.size()));
+        job.m_bitmapHeight = std::max(job.m_bitmapHeight, chart->GetPageHeight(pages[i]));
+    }
+    job.m_filenames = &filenames;
+
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency(), (int)pages.size()));
+    bool *ok = new bool[numThreads];
+    std::vector <std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.push_back(std::thread(PageWorkerMain, &job, i, numThreads, &ok[i]));
+    }
+    PageWorkerMain(&job, 0, numThreads, &ok[0]);
+    for (int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    bool allOk = true;
+    for (int i = 0; i < numThreads; i++) {
+        allOk = allOk && ok[i];
+    }
+    delete[] ok;
+
+    return allOk;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+
+class ChartStream;
+class MessageSequenceChart;
+struct ChartError;
+
+
+// Renders the top height rows of the chart to a BMP file, bandHeight rows at a
+// time. Only two bands are ever in memory: one being rendered while the other is
+// written to the file on a second thread. So peak memory depends on the width of
+// the chart, not its height. Returns false if the file couldn't be written.
+bool RenderChartToBmpFile(MessageSequenceChart *chart, int width, int height, int bandHeight,
+                          char const *filename);
+
+// As RenderChartToBmpFile(), but renders the chart that stream is parsing into
+// chart, each band as soon as its rows are complete, until the stream finishes.
+// The image is as tall as the chart turns out to be. Returns false if the chart
+// has an error, which is described in err, or if the file couldn't be written,
+// in which case err->m_message is empty.
+bool RenderChartStreamToBmpFile(MessageSequenceChart *chart, ChartStream *stream, int bandHeight,
+                                char const *filename, ChartError *err);
+
+// Splits the chart into pages of at most pageHeight rows, see
+// MessageSequenceChart::GetPages(), and writes each page to a BMP file of its own.
+// The files are named after filename, with the page number before the extension,
+// eg. chart_01.bmp. The pages are rendered on one thread per core. Each thread
+// has its own polygon filler and one bitmap the size of a page, so peak memory
+// doesn't depend on the length of the chart. Returns false if a file couldn't be
+// written.
+bool RenderChartPagesToBmpFiles(MessageSequenceChart *chart, int pageHeight, char const *filename);
@@ -0,0 +1,104 @@
+#include "string_pool.h"
+
+// Project headers
+#include "hash.h"
+
+// Standard headers
+#include <string.h>
+
+
+enum { BLOCK_SIZE = 64 * 1024 };
+
+
+size_t StringPool::Hasher::operator() (char const *str) const
+{
+    return (size_t)HashBytes(HASH_INITIAL_VALUE, str, strlen(str));
+}
+
+
+bool StringPool::Equals::operator() (char const *a, char const *b) const
+{
+    return strcmp(a, b) == 0;
+}
+
+
+StringPool::StringPool()
+{
+    m_blockPos = NULL;
+    m_blockRemaining = 0;
+}
+
+
+StringPool::~StringPool()
+{
+    Clear();
+}
+
+
+char *StringPool::Allocate(size_t size)
+{
+    if (size > m_blockRemaining) {
+        // Strings bigger than a block get a block to themselves, and the current
+        // block carries on being used.
+        if (size > BLOCK_SIZE / 4) {
+            char *block = new char[size];
+            m_blocks.push_back(block);
+            return block;
+        }
+
+        m_blockPos = new char[BLOCK_SIZE];
+        m_blockRemaining = BLOCK_SIZE;
+        m_blocks.push_back(m_blockPos);
+    }
+
+    char *rv = m_blockPos;
+    m_blockPos += size;
+    m_blockRemaining -= size;
+    return rv;
+}
+
+
+unsigned StringPool::Intern(char const *str)
+{
+    std::unordered_map <char const *, unsigned, Hasher, Equals>::iterator it = m_ids.find(str);
+    if (it != m_ids.end()) {
+        return it->second;
+    }
+
+    size_t size = strlen(str) + 1;
+    char *copy = Allocate(size);
+    memcpy(copy, str, size);
+
+    unsigned id = m_strings.size();
+    m_strings.push_back(copy);
+    m_ids[copy] = id;
+    return id;
+}
+
+
+unsigned StringPool::AddExternal(char const *str)
+{
+    unsigned id = m_strings.size();
+    m_strings.push_back(str);
+    return id;
+}
+
+
+void StringPool::Reserve(unsigned numStrings)
+{
+    m_strings.reserve(numStrings);
+    m_ids.reserve(numStrings);
+}
+
+
+void StringPool::Clear()
+{
+    for (int i = 0; i < m_blocks.size(); i++) {
+        delete[] m_blocks[i];
+    }
+    m_blocks.clear();
+    m_strings.clear();
+    m_ids.clear();
+    m_blockPos = NULL;
+    m_blockRemaining = 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+
+// Stores each distinct string once and gives it an id, counting up from zero.
+// Charts repeat the same few labels over and over, so interning them saves both
+// an allocation per label and the work of measuring the same text again: anything
+// worked out from a string can be cached in an array indexed by id.
+//
+// The strings are packed into large blocks, so they can't be freed individually.
+// They stay valid until Clear() or the pool is destroyed.
+class StringPool
+{
+private:
+    struct Hasher {
+        size_t operator() (char const *str) const;
+    };
+    struct Equals {
+        bool operator() (char const *a, char const *b) const;
+    };
+
+    std::vector <char const *> m_strings;   // Indexed by id.
+    std::unordered_map <char const *, unsigned, Hasher, Equals> m_ids;
+    std::vector <char *> m_blocks;
+    char *m_blockPos;
+    size_t m_blockRemaining;
+
+    char *Allocate(size_t size);
+
+public:
+    StringPool();
+    ~StringPool();
+
+    // Returns the id of the string, adding a copy of it if it isn't already there.
+    unsigned Intern(char const *str);
+
+    // Adds a string without copying it or checking whether it is already there.
+    // The caller must keep it alive for as long as the pool. Intern() won't find
+    // strings added this way, so only use this to rebuild a pool whose strings are
+    // already unique, eg. from a snapshot.
+    unsigned AddExternal(char const *str);
+
+    // Makes room for numStrings strings in total, to save growing the index a
+    // step at a time when a lot of strings are about to be added.
+    void Reserve(unsigned numStrings);
+
+    char const *GetString(unsigned id) const { return m_strings[id]; }
+    unsigned GetCount() const { return m_strings.size(); }
+
+    void Clear();
+};
@@ -0,0 +1,227 @@
+#include "tokenizer.h"
+
+// Standard headers
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+
+Tokenizer::Tokenizer()
+{
+    m_text = NULL;
+    m_textLen = 0;
+    m_textCapacity = 0;
+    m_pos = 0;
+    m_prevPos = 0;
+    m_prevLineNum = 1;
+    m_prevColumn = 1;
+    m_lineStart = 0;
+    m_prevLineStart = 0;
+    m_tokenCapacity = 64;
+    m_token = new char[m_tokenCapacity];
+    m_token[0] = '\0';
+    m_currentLineNum = 1;
+    m_currentColumn = 1;
+    m_statementEnd = 0;
+}
+
+
+Tokenizer::~Tokenizer()
+{
+    delete[] m_text;
+    delete[] m_token;
+}
+
+
+bool Tokenizer::Open(char const *filename)
+{
+    FILE *in = fopen(filename, "rb");
+    if (!in) {
+        return false;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    if (len < 0) {
+        fclose(in);
+        return false;
+    }
+
+    delete[] m_text;
+    m_text = new char[len + 1];
+    m_textCapacity = len + 1;
+    bool ok = fread(m_text, 1, len, in) == (size_t)len;
+    fclose(in);
+    m_textLen = ok ? len : 0;
+    m_text[m_textLen] = '\0';
+    Rewind();
+
+    return ok;
+}
+
+
+void Tokenizer::OpenFromMemory(char const *text, int len)
+{
+    delete[] m_text;
+    m_text = new char[len + 1];
+    m_textLen = len;
+    m_textCapacity = len + 1;
+    memcpy(m_text, text, len);
+    m_text[len] = '\0';
+    Rewind();
+}
+
+
+void Tokenizer::Append(char const *text, int len)
+{
+    // Nothing before the previous token will be read again, not even by
+    // UnGetToken(), so it is discarded to stop the buffer growing forever.
+    int discard = m_prevPos;
+    int keep = m_textLen - discard;
+    if (keep + len + 1 > m_textCapacity) {
+        m_textCapacity = std::max(m_textCapacity * 2, keep + len + 1);
+        char *newText = new char[m_textCapacity];
+        if (m_text) {
+            memcpy(newText, m_text + discard, keep);
+        }
+        delete[] m_text;
+        m_text = newText;
+    }
+    else {
+        memmove(m_text, m_text + discard, keep);
+    }
+
+    m_textLen = keep;
+    m_pos -= discard;
+    m_prevPos -= discard;
+    m_lineStart -= discard;
+    m_prevLineStart -= discard;
+    m_statementEnd = std::max(m_statementEnd - discard, 0);
+
+    char *dst = m_text + m_textLen;
+    for (int i = 0; i < len; i++) {
+        dst[i] = text[i];
+        if (m_scanner.IsStatementEnd(text[i], i + 1 < len ? text[i + 1] : '\0')) {
+            m_statementEnd = m_textLen + i + 1;
+        }
+    }
+
+    m_textLen += len;
+    m_text[m_textLen] = '\0';
+}
+
+
+void Tokenizer::Rewind()
+{
+    m_pos = 0;
+    m_prevPos = 0;
+    m_currentLineNum = 1;
+    m_prevLineNum = 1;
+    m_currentColumn = 1;
+    m_prevColumn = 1;
+    m_lineStart = 0;
+    m_prevLineStart = 0;
+}
+
+
+void Tokenizer::SkipWhiteSpaceAndComments()
+{
+    while (1) {
+        char c = m_text[m_pos];
+        if (c == '\n') {
+            m_currentLineNum++;
+            m_pos++;
+            m_lineStart = m_pos;
+        }
+        else if (isspace((unsigned char)c)) {
+            m_pos++;
+        }
+        else if (c == '#' || (c == '/' && m_text[m_pos + 1] == '/')) {
+            while (m_text[m_pos] != '\n' && m_text[m_pos] != '\0') {
+                m_pos++;
+            }
+        }
+        else {
+            break;
+        }
+    }
+}
+
+
+void Tokenizer::SetToken(char const *start, int len)
+{
+    if (len + 1 > m_tokenCapacity) {
+        delete[] m_token;
+        m_tokenCapacity = len + 1;
+        m_token = new char[m_tokenCapacity];
+    }
+
+    memcpy(m_token, start, len);
+    m_token[len] = '\0';
+}
+
+
+char *Tokenizer::GetToken()
+{
+    m_prevPos = m_pos;
+    m_prevLineNum = m_currentLineNum;
+    m_prevColumn = m_currentColumn;
+    m_prevLineStart = m_lineStart;
+
+    if (!m_text) {
+        m_token[0] = '\0';
+        return m_token;
+    }
+
+    SkipWhiteSpaceAndComments();
+    m_currentColumn = m_pos - m_lineStart + 1;
+
+    char const *start = m_text + m_pos;
+    int len = 0;
+
+    if (start[0] == '\0') {
+        len = 0;
+    }
+    else if (start[0] == '"') {
+        // Strings can't span lines. An unterminated one ends at the end of the
+        // line, without a closing quote, which the parser reports.
+        len = 1;
+        while (start[len] != '"' && start[len] != '\n' && start[len] != '\0') {
+            len++;
+        }
+        if (start[len] == '"') {
+            len++;
+        }
+    }
+    else if (isalnum((unsigned char)start[0]) || start[0] == '_') {
+        while (isalnum((unsigned char)start[len]) || start[len] == '_') {
+            len++;
+        }
+    }
+    else {
+        static char const *operators[] = { "=>", "|||", "...", "---" };
+        len = 1;
+        for (int i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+            int opLen = strlen(operators[i]);
+            if (strncmp(start, operators[i], opLen) == 0) {
+                len = opLen;
+                break;
+            }
+        }
+    }
+
+    m_pos += len;
+    SetToken(start, len);
+    return m_token;
+}
+
+
+void Tokenizer::UnGetToken()
+{
+    m_pos = m_prevPos;
+    m_currentLineNum = m_prevLineNum;
+    m_currentColumn = m_prevColumn;
+    m_lineStart = m_prevLineStart;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+
+// Follows the text of a .msc file a character at a time, without tokenizing it, to
+// find where statements end. Every statement ends with a ';', '{' or '}', but
+// those characters can also be in strings or comments, or be the value after an
+// '='. Strings and comments both end at the end of the line, as in Tokenizer, so
+// the state is always clear at the start of a line.
+class StatementScanner
+{
+private:
+    bool m_inString;
+    bool m_inComment;
+    char m_prevChar;        // The last character outside strings, comments and white space.
+
+public:
+    StatementScanner() {
+        m_inString = false;
+        m_inComment = false;
+        m_prevChar = '\0';
+    }
+
+    // Returns true if c ends a statement. next is the character after c, or '\0'.
+    bool IsStatementEnd(char c, char next) {
+        if (c == '\n') {
+            m_inString = false;
+            m_inComment = false;
+            return false;
+        }
+        if (m_inComment) {
+            return false;
+        }
+        if (m_inString) {
+            m_inString = c != '"';
+            return false;
+        }
+        if (c == '"') {
+            m_inString = true;
+            m_prevChar = c;
+            return false;
+        }
+        if (c == '#' || (c == '/' && next == '/')) {
+            m_inComment = true;
+            return false;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') {
+            return false;
+        }
+
+        bool isEnd = (c == ';' || c == '{' || c == '}') && m_prevChar != '=';
+        m_prevChar = c;
+        return isEnd;
+    }
+};
+
+
+// Splits the text of a .msc file into tokens. A token is one of:
+//  * a word made of letters, digits and underscores,
+//  * a double quoted string, returned with its quotes,
+//  * one of the multi-character operators "=>", "|||", "..." and "---",
+//  * any other single character.
+// White space and comments, from '#' or "//" to the end of the line, are skipped.
+//
+// The text can either be given all at once, or appended a piece at a time as it
+// arrives, see Append().
+class Tokenizer
+{
+private:
+    char *m_text;           // The text that hasn't been consumed yet, nul terminated.
+    int m_textLen;
+    int m_textCapacity;
+    int m_pos;
+    int m_prevPos;          // Where the last token started, for UnGetToken().
+    int m_prevLineNum;
+    int m_prevColumn;
+    int m_lineStart;        // Offset of the start of the current line. Negative if Append() discarded it.
+    int m_prevLineStart;
+    char *m_token;          // The most recent token.
+    int m_tokenCapacity;
+
+    // Used by Append() to find the ends of statements.
+    StatementScanner m_scanner;
+    int m_statementEnd;     // Just after the end of the last statement, or zero.
+
+    void Rewind();
+    void SkipWhiteSpaceAndComments();
+    void SetToken(char const *start, int len);
+
+public:
+    int m_currentLineNum;
+    int m_currentColumn;    // Where the most recent token starts on its line, counting bytes from 1.
+
+    Tokenizer();
+    ~Tokenizer();
+
+    bool Open(char const *filename);
+
+    // Tokenizes a copy of text, which doesn't need to be nul terminated.
+    void OpenFromMemory(char const *text, int len);
+
+    // Adds text to the end, for when the input is arriving a bit at a time. The
+    // text should end at the end of a line, because tokens are split where the
+    // text was when they were read. Text before the most recent token is freed.
+    void Append(char const *text, int len);
+
+    // True if the appended text includes the end of a statement, see
+    // StatementScanner, that hasn't been read yet. If so, the next statement can be
+    // read without running out of text.
+    bool IsStatementAvailable() const { return m_pos < m_statementEnd; }
+
+    // The text that hasn't been tokenized yet.
+    char const *GetRemainingText() const { return m_text ? m_text + m_pos : ""; }
+    int GetRemainingLength() const { return m_textLen - m_pos; }
+
+    // Returns the next token. It can be modified by the caller, but is only valid
+    // until the next call. Returns an empty string at the end of the file.
+    char *GetToken();
+
+    // Makes the next call to GetToken() return the same token again. Only one
+    // token can be un-got.
+    void UnGetToken();
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+// Standard headers
+#include <string>
+
+
+class MessageSequenceChart;
+
+
+// A minimal test harness, so that the tests build anywhere the rest of the code
+// does, with nothing else to install. Each TEST() registers itself before main()
+// starts, and test_main.cpp runs them all, or those whose names contain the
+// filter given on the command line.
+
+typedef void (*TestFunc)();
+
+struct TestRegistrar
+{
+    TestRegistrar(char const *name, TestFunc func);
+};
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistrar name##Registrar(#name, name); \
+    static void name()
+
+// A failed check is reported with its file and line, and the test carries on, so
+// that one run shows every check that fails.
+void TestCheckFailed(char const *file, int line, char const *expr);
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            TestCheckFailed(__FILE__, __LINE__, #expr); \
+        } \
+    } while (0)
+
+// Write and read whole files. Return false if they couldn't.
+bool WriteTestFile(char const *filename, std::string const &text);
+bool ReadTestFile(char const *filename, std::string *text);
+
+// Compares everything the parser fills in. The string ids can differ, so the
+// strings they stand for are compared instead. Defined in test_snapshot.cpp.
+bool ChartsEqual(MessageSequenceChart const &a, MessageSequenceChart const &b);
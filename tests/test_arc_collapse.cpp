@@ -0,0 +1,89 @@
+// Tests of CollapseRepeatedArcs(): which runs are collapsed, and that the time it
+// takes stays linear when a long run is too short to collapse.
+
+// Project headers
+#include "test.h"
+#include "arc_collapse.h"
+#include "message_sequence_chart.h"
+
+// Standard headers
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+
+// Parses a chart whose arcs are the given lines.
+static bool LoadArcs(MessageSequenceChart *chart, std::string const &arcs)
+{
+    std::string text = "msc {\n  a, b;\n" + arcs + "}\n";
+    ChartError err;
+    return chart->LoadFromMemory(text.data(), text.size(), &err);
+}
+
+
+static bool LabelIs(MessageSequenceChart const &chart, Arc const *a, char const *label)
+{
+    return a->m_params.m_label.size() == 1 &&
+           strcmp(chart.m_strings.GetString(a->m_params.m_label[0]), label) == 0;
+}
+
+
+TEST(CollapseLongRun)
+{
+    std::string arcs;
+    for (int i = 0; i < 40000; i++) {
+        arcs += "  a => b;\n";
+    }
+
+    // The run is far too short, so nothing is removed. Each arc starts a run that
+    // is one shorter than the last, which must not be counted again each time.
+    MessageSequenceChart tooShort;
+    CHECK(LoadArcs(&tooShort, arcs));
+    clock_t start = clock();
+    CHECK(CollapseRepeatedArcs(&tooShort, 100000) == 0);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    CHECK(seconds < 1.0);
+    CHECK(tooShort.m_arcs.size() == 40000);
+
+    MessageSequenceChart collapsed;
+    CHECK(LoadArcs(&collapsed, arcs));
+    CHECK(CollapseRepeatedArcs(&collapsed, 2) == 39999);
+    CHECK(collapsed.m_arcs.size() == 2);
+    if (collapsed.m_arcs.size() == 2) {
+        CHECK(collapsed.m_arcs[0]->m_type == Arc::TYPE_ARROW);
+        CHECK(collapsed.m_arcs[1]->m_type == Arc::TYPE_ELLIPSIS);
+        CHECK(LabelIs(collapsed, collapsed.m_arcs[1], "x40000"));
+    }
+}
+
+
+// A run of a two arc exchange whose labels differ only in their numbers, a run
+// of boxes that is too short, and a run of one arc that is long enough.
+TEST(CollapseMixedRuns)
+{
+    std::string arcs;
+    for (int i = 0; i < 5; i++) {
+        char line[100];
+        sprintf(line, "  a => b [label=\"req %d\"];\n  b => a [label=\"resp %d\"];\n", i, i);
+        arcs += line;
+    }
+    arcs += "  a box b;\n  a box b;\n";
+    arcs += "  b => a;\n  b => a;\n  b => a;\n  b => a;\n";
+
+    MessageSequenceChart chart;
+    CHECK(LoadArcs(&chart, arcs));
+    CHECK(CollapseRepeatedArcs(&chart, 3) == 8 + 3);
+
+    // req 0, resp 0, x5, both boxes, b => a, x4.
+    CHECK(chart.m_arcs.size() == 7);
+    if (chart.m_arcs.size() == 7) {
+        CHECK(LabelIs(chart, chart.m_arcs[0], "req 0"));
+        CHECK(LabelIs(chart, chart.m_arcs[1], "resp 0"));
+        CHECK(LabelIs(chart, chart.m_arcs[2], "x5"));
+        CHECK(chart.m_arcs[3]->m_type == Arc::TYPE_BOX);
+        CHECK(chart.m_arcs[4]->m_type == Arc::TYPE_BOX);
+        CHECK(chart.m_arcs[5]->m_entities[0] == chart.m_entities[1]);
+        CHECK(LabelIs(chart, chart.m_arcs[6], "x4"));
+    }
+}
@@ -0,0 +1,121 @@
+// Runs the tests in this directory. Usage: chisel_tests [filter]
+//
+// Only the tests whose names contain the filter are run. The exit status is 1 if
+// any check failed. Temporary files are written to the working directory.
+
+// Project headers
+#include "test.h"
+#include "antialiased_draw.h"
+
+// Deadfrog headers
+#include "fonts/df_mono.h"
+#include "df_font.h"
+
+// Standard headers
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+struct TestCase
+{
+    char const *m_name;
+    TestFunc m_func;
+};
+
+
+// A function, rather than a global vector, because the registrars in other files
+// may run before a global here would be constructed.
+static std::vector <TestCase> &GetTests()
+{
+    static std::vector <TestCase> tests;
+    return tests;
+}
+
+
+static int g_numFailedChecks = 0;
+
+
+TestRegistrar::TestRegistrar(char const *name, TestFunc func)
+{
+    TestCase test;
+    test.m_name = name;
+    test.m_func = func;
+    GetTests().push_back(test);
+}
+
+
+void TestCheckFailed(char const *file, int line, char const *expr)
+{
+    printf("%s:%d: CHECK(%s) failed\n", file, line, expr);
+    g_numFailedChecks++;
+}
+
+
+bool WriteTestFile(char const *filename, std::string const &text)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+
+    return ok;
+}
+
+
+
+bool ReadTestFile(char const *filename, std::string *text)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return false;
+    }
+
+    char buf[65536];
+    size_t len;
+    text->clear();
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        text->append(buf, len);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    char const *filter = argc > 1 ? argv[1] : NULL;
+
+    // Layout() measures text with the default font, and Render() draws with
+    // g_antialiasedDraw unless it is given a RenderContext.
+    g_defaultFont = LoadFontFromMemory(deadfrog_mono_7x13, sizeof(deadfrog_mono_7x13));
+    g_antialiasedDraw = new AntialiasedDraw;
+
+    std::vector <TestCase> const &tests = GetTests();
+    int numRun = 0;
+    int numFailed = 0;
+    for (int i = 0; i < tests.size(); i++) {
+        if (filter && !strstr(tests[i].m_name, filter)) {
+            continue;
+        }
+
+        int failedBefore = g_numFailedChecks;
+        tests[i].m_func();
+        numRun++;
+        if (g_numFailedChecks != failedBefore) {
+            printf("FAILED %s\n", tests[i].m_name);
+            numFailed++;
+        }
+        else {
+            printf("ok     %s\n", tests[i].m_name);
+        }
+        fflush(stdout);
+    }
+
+    printf("%d of %d tests passed\n", numRun - numFailed, numRun);
+    return numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+// Tests of splitting a chart into pages: that the pages are in order down the
+// chart, and that none is taller than the page height unless a single row is.
+
+// Project headers
+#include "test.h"
+#include "message_sequence_chart.h"
+
+// Standard headers
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+
+// Rows of arcs that share a row through the "," form. The first arc of each row
+// has a short label and the second a tall one, so the first arc doesn't cover the
+// gap below the second and a page can't break between them.
+static std::string MakeSharedRowChartText(int numRows)
+{
+    std::string text = "msc {\n  a, b, c;\n";
+    char line[128];
+    for (int i = 0; i < numRows; i++) {
+        if (i % 3 == 2) {
+            sprintf(line, "  a => b [label=\"single %d\"];\n", i);
+        }
+        else {
+            sprintf(line, "  a => b [label=\"short %d\"], b => c [label=\"tall\\n%d\\nrow\\nlabel\"];\n", i, i);
+        }
+        text += line;
+    }
+    text += "}\n";
+    return text;
+}
+
+
+TEST(PagesFitPageHeight)
+{
+    std::string text = MakeSharedRowChartText(60);
+    MessageSequenceChart chart;
+    ChartError err;
+    CHECK(chart.LoadFromMemory(text.data(), text.size(), &err));
+    chart.Layout();
+
+    // Page heights that put the end of a page at every point in a row.
+    for (int pageHeight = 200; pageHeight < 300; pageHeight += 7) {
+        std::vector <ChartPage> pages;
+        chart.GetPages(pageHeight, &pages);
+        CHECK(pages.size() > 1);
+
+        bool fit = true;
+        bool inOrder = pages.size() > 0 && pages[0].m_top == 0;
+        for (int i = 0; i < pages.size(); i++) {
+            if (chart.GetPageHeight(pages[i]) > pageHeight) {
+                fit = false;
+            }
+            // The blank rows between the end of a page and the next arc can be
+            // left out.
+            if (pages[i].m_bottom <= pages[i].m_top ||
+                (i > 0 && pages[i].m_top < pages[i - 1].m_bottom)) {
+                inOrder = false;
+            }
+        }
+        CHECK(fit);
+        CHECK(inOrder);
+        CHECK(pages.size() > 0 && pages.back().m_bottom == chart.GetHeight());
+    }
+}
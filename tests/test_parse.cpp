@@ -0,0 +1,119 @@
+// Tests of parsing: that a chart parsed on several threads is the same as one
+// parsed on one, and that errors are reported at the right line and column.
+
+// Project headers
+#include "test.h"
+#include "message_sequence_chart.h"
+#include "msc_generator.h"
+
+// Standard headers
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+// Big enough to be split between four threads.
+static bool MakeLargeChartText(std::string *text)
+{
+    MscGeneratorParams params = { "parse_test", 8, 3000, 2, 40, 20, 10, 7 };
+    return GenerateMsc(params, "parse_test.msc") && ReadTestFile("parse_test.msc", text);
+}
+
+
+TEST(ParallelParseMatchesSerial)
+{
+    std::string text;
+    CHECK(MakeLargeChartText(&text));
+
+    MessageSequenceChart serial;
+    serial.m_maxParseThreads = 1;
+    ChartError err;
+    CHECK(serial.LoadFromMemory(text.data(), text.size(), &err));
+    CHECK(serial.m_arcs.size() == 3000);
+
+    for (int numThreads = 2; numThreads <= 4; numThreads++) {
+        MessageSequenceChart parallel;
+        parallel.m_maxParseThreads = numThreads;
+        CHECK(parallel.LoadFromMemory(text.data(), text.size(), &err));
+        CHECK(ChartsEqual(serial, parallel));
+
+        // Every string id must refer to a string in the merged chart's pool.
+        bool idsValid = true;
+        for (int i = 0; i < parallel.m_arcs.size(); i++) {
+            std::vector <unsigned> const &label = parallel.m_arcs[i]->m_params.m_label;
+            for (int j = 0; j < label.size(); j++) {
+                if (label[j] >= parallel.m_strings.GetCount()) {
+                    idsValid = false;
+                }
+            }
+        }
+        CHECK(idsValid);
+    }
+}
+
+
+// An error in one of the parts of a parallel parse is reported exactly as a
+// serial parse reports it.
+TEST(ParallelParseErrorMatchesSerial)
+{
+    std::string text;
+    CHECK(MakeLargeChartText(&text));
+
+    // Break an arc about three quarters of the way through.
+    size_t pos = text.find(" => ", text.size() * 3 / 4);
+    CHECK(pos != std::string::npos);
+    text.replace(pos, 4, " =? ");
+
+    MessageSequenceChart serial;
+    serial.m_maxParseThreads = 1;
+    ChartError serialErr;
+    CHECK(!serial.LoadFromMemory(text.data(), text.size(), &serialErr));
+
+    MessageSequenceChart parallel;
+    parallel.m_maxParseThreads = 4;
+    ChartError parallelErr;
+    CHECK(!parallel.LoadFromMemory(text.data(), text.size(), &parallelErr));
+
+    CHECK(serialErr.m_lineNum > 0);
+    CHECK(serialErr.m_lineNum == parallelErr.m_lineNum);
+    CHECK(serialErr.m_column == parallelErr.m_column);
+    CHECK(strcmp(serialErr.m_message, parallelErr.m_message) == 0);
+}
+
+
+// Check() carries on after each error, and reports every one at the line and
+// column of the token it was found at.
+TEST(CheckReportsEveryError)
+{
+    char const *text =
+        "msc {\n"
+        "  a [label=\"Alice\"],\n"
+        "  b [label=\"Bob\"];\n"
+        "\n"
+        "  a => b [label=\"fine\"];\n"
+        "  a => c [label=\"no such entity\"];\n"
+        "  b => a [label=\"fine\"];\n"
+        "    a -? b;\n"
+        "  b => a [label=\"fine\"];\n"
+        "}\n";
+
+    MessageSequenceChart chart;
+    std::vector <ChartError> errors;
+    CHECK(!chart.CheckMemory(text, strlen(text), &errors));
+    CHECK(errors.size() == 2);
+    if (errors.size() == 2) {
+        CHECK(errors[0].m_lineNum == 6);
+        CHECK(errors[0].m_column == 8);
+        CHECK(errors[1].m_lineNum == 8);
+        CHECK(errors[1].m_column == 7);
+    }
+
+    // The statements with errors are left out, and the rest are kept.
+    CHECK(chart.m_arcs.size() == 3);
+
+    MessageSequenceChart good;
+    errors.clear();
+    char const *goodText = "msc {\n  a, b;\n  a => b;\n}\n";
+    CHECK(good.CheckMemory(goodText, strlen(goodText), &errors));
+    CHECK(errors.empty());
+}
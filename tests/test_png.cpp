@@ -0,0 +1,57 @@
+// Tests of PngWriter against the bytes of a known-good encoding. The image is
+// small, but has a row that is the same as the one above and a run of more than
+// one match can cover, so every path through the compressor is taken.
+
+// Project headers
+#include "test.h"
+#include "png_writer.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <vector>
+
+
+// 100 pixels wide, so that the zeros the Sub filter makes of a row of one colour
+// are a run of 297 bytes. The first two rows are the same and the third is half
+// red and half blue.
+static DfBitmap *MakePngTestBitmap()
+{
+    DfBitmap *bmp = BitmapCreate(100, 3);
+    for (int x = 0; x < 100; x++) {
+        bmp->pixels[x] = Colour(0x40, 0x80, 0xc0);
+        bmp->pixels[100 + x] = Colour(0x40, 0x80, 0xc0);
+        bmp->pixels[200 + x] = x < 50 ? Colour(0xff, 0, 0) : Colour(0, 0, 0xff);
+    }
+    return bmp;
+}
+
+
+// The encoding of MakePngTestBitmap(), checked by inflating it with zlib and
+// comparing the filtered rows that came out.
+static unsigned char const GOLDEN_PNG[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d,
+    0x49, 0x48, 0x44, 0x52, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00, 0x03,
+    0x08, 0x02, 0x00, 0x00, 0x00, 0xea, 0x71, 0x3d, 0xe1, 0x00, 0x00, 0x00,
+    0x21, 0x49, 0x44, 0x41, 0x54, 0x78, 0x01, 0x63, 0x74, 0x68, 0x38, 0xc0,
+    0x30, 0x0a, 0x88, 0x03, 0xa3, 0x81, 0x45, 0x42, 0x60, 0x31, 0xfe, 0x67,
+    0x18, 0x8c, 0x80, 0x91, 0xe1, 0x3f, 0xc3, 0xe0, 0x03, 0x00, 0x94, 0x81,
+    0x05, 0x03, 0xf8, 0x45, 0xc8, 0x56, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45,
+    0x4e, 0x44, 0xae, 0x42, 0x60, 0x82
+};
+
+
+TEST(PngGoldenBytes)
+{
+    DfBitmap *bmp = MakePngTestBitmap();
+    std::vector <unsigned char> png;
+    PngWriter writer;
+    writer.Open(&png, 100, 3);
+    writer.WriteRows(bmp, 3);
+    CHECK(writer.Close());
+    BitmapDelete(bmp);
+
+    CHECK(png.size() == sizeof(GOLDEN_PNG));
+    CHECK(png == std::vector <unsigned char>(GOLDEN_PNG, GOLDEN_PNG + sizeof(GOLDEN_PNG)));
+}
@@ -0,0 +1,399 @@
+// Tests of PolygonFiller: that the ways it can be set up, the clip rect and the
+// pixel formats all give the same coverage, and that CompositeCoverage() gives the
+// same pixels as drawing directly and as the scalar blend.
+
+// Project headers
+#include "test.h"
+#include "coverage_compositor.h"
+#include "polygon/polygon.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+// A fixed sequence of pseudo random numbers, the same on every platform.
+static unsigned g_randomState = 1;
+
+static unsigned Random(unsigned range)
+{
+    g_randomState = g_randomState * 1103515245 + 12345;
+    return (g_randomState >> 16) % range;
+}
+
+
+// A coordinate in whole eighths of a pixel, which are exact in floating point.
+static float RandomCoord(int range)
+{
+    return Random(range * 8) / 8.0f;
+}
+
+
+static PolygonData *CreateRandomTriangle(int width, int height)
+{
+    PolygonData *poly = new PolygonData(3);
+    for (int i = 0; i < 3; i++) {
+        poly->m_vertices[i].Set(RandomCoord(width), RandomCoord(height));
+    }
+    return poly;
+}
+
+
+// A star with many points, which needs far more edges than a PolygonFiller has
+// room for by default.
+static PolygonData *CreateStar(float cx, float cy, int numPoints)
+{
+    PolygonData *poly = new PolygonData(numPoints * 2);
+    for (int i = 0; i < numPoints * 2; i++) {
+        float radius = (i & 1) ? 20.0f : 90.0f;
+        float angle = i * 3.14159265f / numPoints;
+        poly->m_vertices[i].Set(cx + radius * cosf(angle), cy + radius * sinf(angle));
+    }
+    return poly;
+}
+
+
+static bool BitmapsEqual(DfBitmap *a, DfBitmap *b)
+{
+    return a->width == b->width && a->height == b->height &&
+           memcmp(a->pixels, b->pixels, a->width * a->height * sizeof(DfColour)) == 0;
+}
+
+
+static DfBitmap *CreateWhiteBitmap(int width, int height)
+{
+    DfBitmap *bmp = BitmapCreate(width, height);
+    BitmapClear(bmp, g_colourWhite);
+    return bmp;
+}
+
+
+TEST(PolygonRectangleCoverage)
+{
+    DfBitmap *bmp = CreateWhiteBitmap(40, 30);
+    PolygonData rect(4);
+    rect.m_vertices[0].Set(10, 10);
+    rect.m_vertices[1].Set(30, 10);
+    rect.m_vertices[2].Set(30, 20);
+    rect.m_vertices[3].Set(10, 20);
+
+    PolygonFiller filler;
+    filler.DrawPoly(bmp, &rect, g_colourBlack);
+
+    int numWrong = 0;
+    for (int y = 0; y < 30; y++) {
+        for (int x = 0; x < 40; x++) {
+            bool inside = x >= 10 && x < 30 && y >= 10 && y < 20;
+            DfColour expected = inside ? g_colourBlack : g_colourWhite;
+            if (bmp->pixels[y * 40 + x].c != expected.c) {
+                numWrong++;
+            }
+        }
+    }
+    CHECK(numWrong == 0);
+
+    PolygonFillerStats stats = filler.GetStats();
+    CHECK(stats.m_pixelsFilled == 200);
+    CHECK(stats.m_pixelsBlended == 0);
+
+    BitmapDelete(bmp);
+}
+
+
+// The edge storage can grow, be reserved up front, live in an arena, move out of
+// a small arena and shrink after each polygon. None of that may change a pixel.
+TEST(PolygonEdgeStorageEquivalence)
+{
+    PolygonData *star = CreateStar(100, 100, 150);
+    PolygonData *small = CreateStar(50, 50, 3);
+
+    DfBitmap *expected = CreateWhiteBitmap(200, 200);
+    PolygonFiller growing;
+    growing.DrawPoly(expected, star, g_colourBlack);
+    growing.DrawPoly(expected, small, g_colourWhite);
+    CHECK(growing.GetStats().m_edgeResizes > 0);
+    CHECK(growing.GetStats().m_droppedPolys == 0);
+
+    std::vector <char> bigArena(PolygonFiller::GetEdgeArenaBytes(2000));
+    std::vector <char> smallArena(PolygonFiller::GetEdgeArenaBytes(16));
+
+    for (int setup = 0; setup < 4; setup++) {
+        PolygonFiller filler;
+        if (setup == 0) {
+            CHECK(filler.ReserveEdges(2000));
+        }
+        else if (setup == 1) {
+            filler.SetEdgeArena(&bigArena[0], bigArena.size());
+        }
+        else if (setup == 2) {
+            filler.SetEdgeArena(&smallArena[0], smallArena.size());
+        }
+        else {
+            filler.SetEdgeRetentionLimit(16);
+        }
+
+        DfBitmap *bmp = CreateWhiteBitmap(200, 200);
+        filler.DrawPoly(bmp, star, g_colourBlack);
+        filler.DrawPoly(bmp, small, g_colourWhite);
+        CHECK(BitmapsEqual(bmp, expected));
+        CHECK(filler.GetStats().m_droppedPolys == 0);
+        BitmapDelete(bmp);
+    }
+
+    BitmapDelete(expected);
+    delete star;
+    delete small;
+}
+
+
+// Fillers that share a PolygonScratch, switching between bitmaps of different
+// sizes, give the same pixels as fillers that each have their own.
+TEST(PolygonSharedScratch)
+{
+    PolygonScratch scratch;
+    PolygonFiller shared1(&scratch);
+    PolygonFiller shared2(&scratch);
+    PolygonFiller own1;
+    PolygonFiller own2;
+
+    g_randomState = 1;
+    for (int i = 0; i < 20; i++) {
+        int width = 20 + Random(300);
+        int height = 20 + Random(300);
+        PolygonData *poly = CreateRandomTriangle(width, height);
+
+        DfBitmap *a = CreateWhiteBitmap(width, height);
+        DfBitmap *b = CreateWhiteBitmap(width, height);
+        ((i & 1) ? shared1 : shared2).DrawPoly(a, poly, g_colourBlack);
+        ((i & 1) ? own1 : own2).DrawPoly(b, poly, g_colourBlack);
+        CHECK(BitmapsEqual(a, b));
+
+        BitmapDelete(a);
+        BitmapDelete(b);
+        delete poly;
+    }
+}
+
+
+// With a clip rect, the pixels outside it are left alone, and those inside it are
+// the same as without one, give or take one sample. The clipper moves the ends of
+// the edges it cuts, which can change the rounding where they cross a scanline,
+// and like the filler's own clipping to the bitmap, it drops the samples within
+// an eighth of a pixel of the right edge.
+TEST(PolygonClipRect)
+{
+    g_randomState = 2;
+    int numWrong = 0;
+    for (int i = 0; i < 100; i++) {
+        PolygonData *poly = CreateRandomTriangle(120, 100);
+        int clipX = Random(100) - 10;
+        int clipY = Random(80) - 10;
+        int clipWidth = 1 + Random(60);
+        int clipHeight = 1 + Random(60);
+
+        DfBitmap *unclipped = CreateWhiteBitmap(100, 80);
+        DfBitmap *clipped = CreateWhiteBitmap(100, 80);
+        PolygonFiller filler;
+        filler.DrawPoly(unclipped, poly, g_colourBlack);
+        filler.SetClipRect(clipX, clipY, clipWidth, clipHeight);
+        filler.DrawPoly(clipped, poly, g_colourBlack);
+
+        for (int y = 0; y < 80; y++) {
+            for (int x = 0; x < 100; x++) {
+                bool inside = x >= clipX && x < clipX + clipWidth &&
+                              y >= clipY && y < clipY + clipHeight;
+                int got = clipped->pixels[y * 100 + x].r;
+                int expected = inside ? unclipped->pixels[y * 100 + x].r : 255;
+                int tolerance = inside ? 256 / SUBPIXEL_COUNT : 0;
+                if (abs(got - expected) > tolerance) {
+                    numWrong++;
+                }
+            }
+        }
+
+        BitmapDelete(unclipped);
+        BitmapDelete(clipped);
+        delete poly;
+    }
+    CHECK(numWrong == 0);
+}
+
+
+// Every format records the same coverage. A coverage mask drawn with replace is
+// the reference: black over white gives 255 * (8 - coverage) / 8, and white
+// replacing in gray gives 255 * coverage / 8.
+TEST(PolygonPixelFormatsAgree)
+{
+    int const width = 64;
+    int const height = 48;
+
+    g_randomState = 3;
+    int numWrong = 0;
+    for (int i = 0; i < 50; i++) {
+        PolygonData *poly = CreateRandomTriangle(width, height);
+        PolygonFiller filler;
+
+        std::vector <unsigned char> coverage(width * height);
+        PolygonTarget coverageTarget(&coverage[0], width, height, width, POLYGON_FORMAT_COVERAGE8);
+        filler.DrawPoly(coverageTarget, poly, g_colourBlack, POLYGON_BLEND_REPLACE);
+
+        std::vector <unsigned char> gray(width * height);
+        PolygonTarget grayTarget(&gray[0], width, height, width, POLYGON_FORMAT_GRAY8);
+        filler.DrawPoly(grayTarget, poly, g_colourWhite, POLYGON_BLEND_REPLACE);
+
+        DfBitmap *bmp = CreateWhiteBitmap(width, height);
+        filler.DrawPoly(bmp, poly, g_colourBlack);
+
+        for (int j = 0; j < width * height; j++) {
+            unsigned c = coverage[j];
+            if (c > SUBPIXEL_COUNT ||
+                gray[j] != (255 * c) >> SUBPIXEL_SHIFT ||
+                bmp->pixels[j].r != (255 * (SUBPIXEL_COUNT - c)) >> SUBPIXEL_SHIFT) {
+                numWrong++;
+            }
+        }
+
+        BitmapDelete(bmp);
+        delete poly;
+    }
+    CHECK(numWrong == 0);
+}
+
+
+// Blends colour over one pixel, a channel at a time. Slow but obviously right.
+static DfColour ReferenceBlend(DfColour dst, DfColour colour, unsigned alpha)
+{
+    DfColour rv;
+    rv.c = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned d = (dst.c >> (i * 8)) & 0xff;
+        unsigned s = (colour.c >> (i * 8)) & 0xff;
+        unsigned blended = (d * (SUBPIXEL_COUNT - alpha) + s * alpha) >> SUBPIXEL_SHIFT;
+        rv.c |= blended << (i * 8);
+    }
+    return rv;
+}
+
+
+// BlendCoverage(), which blends two channels at a time, is the same as blending
+// each channel on its own.
+TEST(BlendCoverageMatchesReference)
+{
+    g_randomState = 6;
+    int numWrong = 0;
+    for (int i = 0; i < 1000; i++) {
+        DfColour dst;
+        DfColour colour;
+        dst.c = Random(0x10000) * 0x10001u;
+        colour.c = Random(0x10000) * 0x10001u;
+        for (unsigned alpha = 0; alpha <= SUBPIXEL_COUNT; alpha++) {
+            DfColour p = dst;
+            BlendCoverage(&p, colour.c & 0xff00ff, (colour.c >> 8) & 0xff00ff, alpha);
+            if (p.c != ReferenceBlend(dst, colour, alpha).c) {
+                numWrong++;
+            }
+        }
+    }
+    CHECK(numWrong == 0);
+}
+
+
+// Compositing the coverage mask of a polygon gives exactly the pixels that drawing
+// it directly does, whatever is under it and however the mask was drawn.
+TEST(CompositeCoverageMatchesDirectDraw)
+{
+    g_randomState = 4;
+    int numWrong = 0;
+    for (int i = 0; i < 200; i++) {
+        int width = 1 + Random(80);
+        int height = 1 + Random(50);
+        PolygonData *poly = CreateRandomTriangle(width, height);
+
+        DfBitmap *direct = BitmapCreate(width, height);
+        for (int j = 0; j < width * height; j++) {
+            direct->pixels[j].c = Random(0x10000) * 0x10001u;
+        }
+        DfBitmap *composited = BitmapCreate(width, height);
+        memcpy(composited->pixels, direct->pixels, width * height * sizeof(DfColour));
+
+        DfColour colour;
+        colour.c = Random(0x10000) * 0x10001u;
+        PolygonFiller filler;
+        filler.DrawPoly(direct, poly, colour);
+
+        std::vector <unsigned char> mask(width * height);
+        PolygonTarget maskTarget(&mask[0], width, height, width, POLYGON_FORMAT_COVERAGE8);
+        filler.DrawPoly(maskTarget, poly, colour, (PolygonBlendMode)(i % 3));
+        CompositeCoverage(composited, 0, 0, maskTarget, colour);
+
+        if (!BitmapsEqual(direct, composited)) {
+            numWrong++;
+        }
+
+        BitmapDelete(direct);
+        BitmapDelete(composited);
+        delete poly;
+    }
+    CHECK(numWrong == 0);
+}
+
+
+// A mask put anywhere, including partly or wholly off the bitmap, blends each
+// pixel it covers exactly as the scalar BlendCoverage() does and leaves the rest
+// alone. Where SSE2 is used, that checks it against the scalar code. The widths
+// cover the SIMD loop, its tail, and both together.
+TEST(CompositeCoveragePlacement)
+{
+    g_randomState = 5;
+    int numWrong = 0;
+    for (int i = 0; i < 300; i++) {
+        int width = 1 + Random(40);
+        int height = 1 + Random(30);
+        int maskWidth = 1 + Random(40);
+        int maskHeight = 1 + Random(30);
+        int maskPitch = maskWidth + Random(5);
+        int x = Random(maskWidth + width + 10) - maskWidth - 5;
+        int y = Random(maskHeight + height + 10) - maskHeight - 5;
+
+        std::vector <unsigned char> mask(maskPitch * maskHeight);
+        for (int j = 0; j < mask.size(); j++) {
+            // Mostly empty or full, as real masks are.
+            unsigned r = Random(4);
+            mask[j] = r == 0 ? 0 : r == 1 ? SUBPIXEL_COUNT : Random(SUBPIXEL_COUNT + 1);
+        }
+        PolygonTarget maskTarget(&mask[0], maskWidth, maskHeight, maskPitch,
+                                 POLYGON_FORMAT_COVERAGE8);
+
+        DfBitmap *bmp = BitmapCreate(width, height);
+        for (int j = 0; j < width * height; j++) {
+            bmp->pixels[j].c = Random(0x10000) * 0x10001u;
+        }
+        std::vector <DfColour> expected(bmp->pixels, bmp->pixels + width * height);
+
+        DfColour colour;
+        colour.c = Random(0x10000) * 0x10001u;
+        for (int py = 0; py < height; py++) {
+            for (int px = 0; px < width; px++) {
+                int mx = px - x;
+                int my = py - y;
+                if (mx >= 0 && mx < maskWidth && my >= 0 && my < maskHeight) {
+                    BlendCoverage(&expected[py * width + px], colour.c & 0xff00ff,
+                                  (colour.c >> 8) & 0xff00ff, mask[my * maskPitch + mx]);
+                }
+            }
+        }
+
+        CompositeCoverage(bmp, x, y, maskTarget, colour);
+        if (memcmp(bmp->pixels, &expected[0], width * height * sizeof(DfColour)) != 0) {
+            numWrong++;
+        }
+
+        BitmapDelete(bmp);
+    }
+    CHECK(numWrong == 0);
+}
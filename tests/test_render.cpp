@@ -0,0 +1,177 @@
+// Tests that a chart rendered in pieces, as the viewer, the streamed BMP writer
+// and ChartRenderer do, is the same as the chart rendered in one go. Arcs that
+// cross the seams between bands are the ones at risk.
+
+// Project headers
+#include "test.h"
+#include "antialiased_draw.h"
+#include "chart_renderer.h"
+#include "message_sequence_chart.h"
+#include "msc_generator.h"
+#include "streamed_render.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+// A chart with every kind of arc, some with labels of several lines, so that
+// plenty of them cross band boundaries. Its text is left in render_test.msc.
+static bool LoadRenderTestChart(MessageSequenceChart *chart)
+{
+    MscGeneratorParams params = { "render_test", 6, 150, 2, 16, 25, 15, 11 };
+    ChartError err;
+    if (!GenerateMsc(params, "render_test.msc") || !chart->Load("render_test.msc", &err)) {
+        return false;
+    }
+
+    chart->Layout();
+    return true;
+}
+
+
+static DfBitmap *RenderWhole(MessageSequenceChart *chart)
+{
+    DfBitmap *bmp = BitmapCreate(chart->GetWidth(), chart->GetHeight());
+    BitmapClear(bmp, g_colourWhite);
+    chart->Render(bmp, 0);
+    return bmp;
+}
+
+
+TEST(RenderBandsMatchWhole)
+{
+    MessageSequenceChart chart;
+    CHECK(LoadRenderTestChart(&chart));
+    DfBitmap *whole = RenderWhole(&chart);
+    int width = whole->width;
+    int height = whole->height;
+
+    // Band heights that don't divide the chart evenly, including some smaller
+    // than an arc.
+    int const bandHeights[] = { 7, 97, 256, 1000 };
+    for (int b = 0; b < sizeof(bandHeights) / sizeof(bandHeights[0]); b++) {
+        int bandHeight = bandHeights[b];
+        DfBitmap *band = BitmapCreate(width, bandHeight);
+        bool same = true;
+        for (int y = 0; y < height; y += bandHeight) {
+            BitmapClear(band, g_colourWhite);
+            chart.Render(band, y);
+            int numRows = std::min(bandHeight, height - y);
+            if (memcmp(band->pixels, whole->pixels + y * width,
+                       numRows * width * sizeof(DfColour)) != 0) {
+                same = false;
+            }
+        }
+        CHECK(same);
+        BitmapDelete(band);
+    }
+
+    BitmapDelete(whole);
+}
+
+
+TEST(ChartRendererMatchesWhole)
+{
+    MessageSequenceChart chart;
+    std::string text;
+    CHECK(LoadRenderTestChart(&chart) && ReadTestFile("render_test.msc", &text));
+    DfBitmap *whole = RenderWhole(&chart);
+
+    ChartRenderer renderer;
+    ChartError err;
+    CHECK(renderer.Parse(text.data(), text.size(), &err));
+    CHECK(renderer.GetWidth() == whole->width);
+    CHECK(renderer.GetHeight() == whole->height);
+
+    // A stride wider than the chart, to check rows land in the right place.
+    int stride = (whole->width + 5) * sizeof(DfColour);
+    std::vector <DfColour> pixels((whole->width + 5) * whole->height);
+    CHECK(renderer.RenderToPixels(&pixels[0], whole->width, whole->height, stride, &err));
+
+    bool same = true;
+    for (int y = 0; y < whole->height; y++) {
+        if (memcmp(&pixels[y * (whole->width + 5)], whole->pixels + y * whole->width,
+                   whole->width * sizeof(DfColour)) != 0) {
+            same = false;
+        }
+    }
+    CHECK(same);
+
+    BitmapDelete(whole);
+}
+
+
+// The streamed BMP is 24-bit and top-down, so each row can be compared with the
+// whole render directly.
+TEST(StreamedBmpMatchesWhole)
+{
+    MessageSequenceChart chart;
+    CHECK(LoadRenderTestChart(&chart));
+    DfBitmap *whole = RenderWhole(&chart);
+    int width = whole->width;
+    int height = whole->height;
+
+    std::string file;
+    CHECK(RenderChartToBmpFile(&chart, width, height, 100, "render_test.bmp"));
+    CHECK(ReadTestFile("render_test.bmp", &file));
+
+    int rowBytes = (width * 3 + 3) & ~3;
+    CHECK(file.size() >= 54);
+    if (file.size() >= 54) {
+        unsigned char const *bytes = (unsigned char const *)file.data();
+        int offset = bytes[10] | (bytes[11] << 8) | (bytes[12] << 16) | (bytes[13] << 24);
+        CHECK(file.size() == offset + rowBytes * height);
+
+        bool same = file.size() == offset + rowBytes * height;
+        for (int y = 0; same && y < height; y++) {
+            unsigned char const *row = bytes + offset + y * rowBytes;
+            for (int x = 0; x < width; x++) {
+                DfColour c = whole->pixels[y * width + x];
+                if (row[x * 3] != c.b || row[x * 3 + 1] != c.g || row[x * 3 + 2] != c.r) {
+                    same = false;
+                }
+            }
+        }
+        CHECK(same);
+    }
+
+    BitmapDelete(whole);
+}
+
+
+// Linear blending is a setting of each ChartRenderer. It isn't picked up from
+// g_linearBlending, which is only chart-chisel's default.
+TEST(ChartRendererLinearBlending)
+{
+    MessageSequenceChart chart;
+    std::string text;
+    CHECK(LoadRenderTestChart(&chart) && ReadTestFile("render_test.msc", &text));
+
+    ChartError err;
+    std::vector <unsigned char> plain;
+    std::vector <unsigned char> linear;
+    std::vector <unsigned char> unaffected;
+    {
+        ChartRenderer renderer;
+        CHECK(renderer.Parse(text.data(), text.size(), &err));
+        CHECK(renderer.RenderToPng(&plain, &err));
+        renderer.SetLinearBlending(true);
+        CHECK(renderer.RenderToPng(&linear, &err));
+    }
+    {
+        g_linearBlending = true;
+        ChartRenderer renderer;
+        g_linearBlending = false;
+        CHECK(renderer.Parse(text.data(), text.size(), &err));
+        CHECK(renderer.RenderToPng(&unaffected, &err));
+    }
+
+    CHECK(plain != linear);
+    CHECK(plain == unaffected);
+}
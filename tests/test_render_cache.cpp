@@ -0,0 +1,71 @@
+// Tests of RenderCache: that stores and fetches round trip, and that the cache is
+// trimmed to its limit, oldest first, using its record of the total size.
+
+// Project headers
+#include "test.h"
+#include "render_cache.h"
+
+// Standard headers
+#include <stdio.h>
+#include <string>
+
+
+static char const *const CACHE_DIR = "render_cache_test";
+static char const *const KEYS[] = { "0000000000000001", "0000000000000002", "0000000000000003" };
+
+
+static void ClearTestCache()
+{
+    for (int i = 0; i < 3; i++) {
+        remove((std::string(CACHE_DIR) + "/" + KEYS[i]).c_str());
+    }
+    remove((std::string(CACHE_DIR) + "/total_bytes").c_str());
+}
+
+
+// Stores text under key and reads back the total size the cache has recorded.
+static std::string StoreText(RenderCache *cache, char const *key, std::string const &text)
+{
+    std::string totalBytes;
+    if (!WriteTestFile("render_cache_in.txt", text)) {
+        return totalBytes;
+    }
+    cache->Store(key, "render_cache_in.txt");
+    ReadTestFile((std::string(CACHE_DIR) + "/total_bytes").c_str(), &totalBytes);
+    return totalBytes;
+}
+
+
+TEST(RenderCacheTrimsToLimit)
+{
+    RenderCache cache(CACHE_DIR, 250);
+    ClearTestCache();
+    CHECK(!cache.Fetch(KEYS[0], "render_cache_out.txt"));
+
+    CHECK(StoreText(&cache, KEYS[0], std::string(100, 'a')) == "100\n");
+    std::string text;
+    CHECK(cache.Fetch(KEYS[0], "render_cache_out.txt"));
+    CHECK(ReadTestFile("render_cache_out.txt", &text) && text == std::string(100, 'a'));
+
+    // Replacing an entry takes its old size off the total.
+    CHECK(StoreText(&cache, KEYS[0], std::string(50, 'b')) == "50\n");
+    CHECK(StoreText(&cache, KEYS[1], std::string(100, 'c')) == "150\n");
+    CHECK(StoreText(&cache, KEYS[2], std::string(100, 'd')) == "250\n");
+
+    // Now the total passes the limit, so the cache is trimmed by one entry. The
+    // oldest is the one that goes, and not the one just stored, even though that
+    // replaces an older one.
+    CHECK(StoreText(&cache, KEYS[0], std::string(100, 'e')) == "200\n");
+    CHECK(cache.Fetch(KEYS[0], "render_cache_out.txt"));
+    CHECK(!cache.Fetch(KEYS[1], "render_cache_out.txt"));
+    CHECK(cache.Fetch(KEYS[2], "render_cache_out.txt"));
+
+    // An entry bigger than the limit on its own is kept, and everything else goes.
+    CHECK(StoreText(&cache, KEYS[1], std::string(300, 'f')) == "300\n");
+    CHECK(cache.Fetch(KEYS[1], "render_cache_out.txt"));
+    CHECK(ReadTestFile("render_cache_out.txt", &text) && text == std::string(300, 'f'));
+    CHECK(!cache.Fetch(KEYS[0], "render_cache_out.txt"));
+    CHECK(!cache.Fetch(KEYS[2], "render_cache_out.txt"));
+
+    ClearTestCache();
+}
@@ -0,0 +1,224 @@
+// Tests of chart snapshots: that a chart loaded from a snapshot is the same as
+// the one it was made from, and that a damaged snapshot is rejected rather than
+// misread.
+
+// Project headers
+#include "test.h"
+#include "chart_snapshot.h"
+#include "message_sequence_chart.h"
+#include "msc_generator.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+
+// Standard headers
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+static int GetEntityIndex(MessageSequenceChart const &chart, Entity const *e)
+{
+    for (int i = 0; i < chart.m_entities.size(); i++) {
+        if (chart.m_entities[i] == e) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static bool LabelsEqual(MessageSequenceChart const &a, std::vector <unsigned> const &labelA,
+                        MessageSequenceChart const &b, std::vector <unsigned> const &labelB)
+{
+    if (labelA.size() != labelB.size()) {
+        return false;
+    }
+
+    for (int i = 0; i < labelA.size(); i++) {
+        if (strcmp(a.m_strings.GetString(labelA[i]), b.m_strings.GetString(labelB[i])) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// The threads of a parallel parse intern their strings separately, and a
+// snapshot's string ids are those of the chart it was made from, so ids can't be
+// compared directly.
+bool ChartsEqual(MessageSequenceChart const &a, MessageSequenceChart const &b)
+{
+    if (!LabelsEqual(a, a.m_title, b, b.m_title) ||
+        a.m_entities.size() != b.m_entities.size() || a.m_arcs.size() != b.m_arcs.size() ||
+        a.m_pixelWidth != b.m_pixelWidth) {
+        return false;
+    }
+
+    for (int i = 0; i < a.m_entities.size(); i++) {
+        Entity const *ea = a.m_entities[i];
+        Entity const *eb = b.m_entities[i];
+        if (strcmp(ea->m_name, eb->m_name) != 0 ||
+            !LabelsEqual(a, ea->m_params.m_label, b, eb->m_params.m_label) ||
+            ea->m_params.m_bgColour.c != eb->m_params.m_bgColour.c) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < a.m_arcs.size(); i++) {
+        Arc const *aa = a.m_arcs[i];
+        Arc const *ab = b.m_arcs[i];
+        if (aa->m_type != ab->m_type ||
+            GetEntityIndex(a, aa->m_entities[0]) != GetEntityIndex(b, ab->m_entities[0]) ||
+            GetEntityIndex(a, aa->m_entities[1]) != GetEntityIndex(b, ab->m_entities[1]) ||
+            !LabelsEqual(a, aa->m_params.m_label, b, ab->m_params.m_label) ||
+            aa->m_params.m_bgColour.c != ab->m_params.m_bgColour.c) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Makes a chart, loads it and saves a snapshot of it.
+static bool MakeSnapshot(MessageSequenceChart *chart)
+{
+    MscGeneratorParams params = { "snapshot_test", 5, 40, 2, 12, 20, 10, 13 };
+    ChartError err;
+    return GenerateMsc(params, "snapshot_test.msc") &&
+           chart->Load("snapshot_test.msc", &err) &&
+           SaveChartSnapshot(chart, "snapshot_test.msc", "snapshot_test.snap");
+}
+
+
+// Loads the snapshot in snapshot_test.snap. If it is accepted, the chart must be
+// one that can be laid out and rendered.
+static bool LoadDamagedSnapshot()
+{
+    MessageSequenceChart chart;
+    if (!LoadChartSnapshot(&chart, "snapshot_test.msc", "snapshot_test.snap")) {
+        return false;
+    }
+
+    chart.Layout();
+    DfBitmap *bmp = BitmapCreate(chart.GetWidth(), 200);
+    BitmapClear(bmp, g_colourWhite);
+    chart.Render(bmp, 0);
+    BitmapDelete(bmp);
+    return true;
+}
+
+
+TEST(SnapshotRoundTrip)
+{
+    MessageSequenceChart original;
+    CHECK(MakeSnapshot(&original));
+
+    MessageSequenceChart loaded;
+    CHECK(LoadChartSnapshot(&loaded, "snapshot_test.msc", "snapshot_test.snap"));
+    CHECK(ChartsEqual(original, loaded));
+
+    // A chart that isn't empty isn't loaded into.
+    CHECK(!LoadChartSnapshot(&loaded, "snapshot_test.msc", "snapshot_test.snap"));
+}
+
+
+// A snapshot made from a different source file is ignored.
+TEST(SnapshotStaleSource)
+{
+    MessageSequenceChart original;
+    CHECK(MakeSnapshot(&original));
+
+    std::string source;
+    CHECK(ReadTestFile("snapshot_test.msc", &source));
+    source += '\n';
+    CHECK(WriteTestFile("snapshot_test.msc", source));
+
+    MessageSequenceChart loaded;
+    CHECK(!LoadChartSnapshot(&loaded, "snapshot_test.msc", "snapshot_test.snap"));
+    CHECK(loaded.m_arcs.empty());
+}
+
+
+// Every truncation is rejected, and every single byte change is either rejected
+// or gives a chart that can be drawn. Under a sanitiser, this also checks that
+// nothing is read from outside the file.
+TEST(SnapshotHostileInput)
+{
+    MessageSequenceChart original;
+    CHECK(MakeSnapshot(&original));
+
+    std::string good;
+    CHECK(ReadTestFile("snapshot_test.snap", &good));
+
+    int numAccepted = 0;
+    for (size_t len = 0; len < good.size(); len += 1 + len / 16) {
+        std::string truncated(good, 0, len);
+        CHECK(WriteTestFile("snapshot_test.snap", truncated));
+        if (LoadDamagedSnapshot()) {
+            numAccepted++;
+        }
+    }
+    CHECK(numAccepted == 0);
+
+    // Values that are likely to be out of range: zero, all ones, and the top bit.
+    unsigned char const values[] = { 0x00, 0xff, 0x80 };
+    for (size_t i = 0; i < good.size(); i++) {
+        for (int v = 0; v < 3; v++) {
+            if ((unsigned char)good[i] == values[v]) {
+                continue;
+            }
+            std::string damaged = good;
+            damaged[i] = values[v];
+            CHECK(WriteTestFile("snapshot_test.snap", damaged));
+            LoadDamagedSnapshot();
+        }
+    }
+
+    // The file is still loadable once it is put back.
+    CHECK(WriteTestFile("snapshot_test.snap", good));
+    CHECK(LoadDamagedSnapshot());
+}
+
+
+// An arc type that isn't one of Arc's is rejected, so that the caller parses the
+// source instead. The offsets are those of the structs in chart_snapshot.cpp.
+TEST(SnapshotBadArcType)
+{
+    size_t const headerSize = 64;
+    size_t const numEntitiesOffset = 40;
+    size_t const entitySize = 16;
+    size_t const arcSize = 24;
+    size_t const arcTypeOffset = 8;
+
+    MessageSequenceChart original;
+    CHECK(MakeSnapshot(&original));
+
+    std::string good;
+    CHECK(ReadTestFile("snapshot_test.snap", &good));
+    CHECK(good.size() > headerSize);
+    if (good.size() <= headerSize) {
+        return;
+    }
+
+    unsigned numEntities;
+    memcpy(&numEntities, &good[numEntitiesOffset], sizeof(numEntities));
+    CHECK(numEntities == original.m_entities.size());
+    size_t lastArc = headerSize + numEntities * entitySize + (original.m_arcs.size() - 1) * arcSize;
+    int type;
+    memcpy(&type, &good[lastArc + arcTypeOffset], sizeof(type));
+    CHECK(type == original.m_arcs.back()->m_type);
+
+    int const badTypes[] = { -1, Arc::TYPE_COMMENT + 1, 0x7fffffff };
+    for (int i = 0; i < 3; i++) {
+        std::string damaged = good;
+        memcpy(&damaged[lastArc + arcTypeOffset], &badTypes[i], sizeof(int));
+        CHECK(WriteTestFile("snapshot_test.snap", damaged));
+
+        MessageSequenceChart loaded;
+        CHECK(!LoadChartSnapshot(&loaded, "snapshot_test.msc", "snapshot_test.snap"));
+        CHECK(loaded.m_arcs.empty());
+    }
+}